@@ -0,0 +1,62 @@
+#ifndef POIROT_H
+#define POIROT_H
+
+// Viewing arrays of a host process (e.g. Julia or Python via ctypes) without copying them.
+// Viewers run on one thread of their own, the memory is owned by the caller and must stay valid until poirot_close().
+// Several viewers can be open at a time, they share the thread and the GL objects. On macOS, GLFW needs the main thread,
+// so this doesn't work there.
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The library is built with hidden symbols, only these functions are exported
+#ifdef __GNUC__
+	#define POIROT_API __attribute__((visibility("default")))
+#else
+	#define POIROT_API
+#endif
+
+// Same order as in src/volume.c
+enum poirot_dtype { POIROT_UINT8, POIROT_INT16, POIROT_UINT16, POIROT_FLOAT16, POIROT_FLOAT32, POIROT_COMPLEX64 };
+
+typedef struct poirot_viewer poirot_viewer;
+
+// Voxel (x, y, z) of frame f is at data + x * strides[0] + y * strides[1] + z * strides[2] + f * strides[3],
+// strides are in bytes and may be negative. With strides NULL, x is fastest and the array is contiguous.
+// Returns once the window shows the array, or NULL if the window can't be opened, the array doesn't fit on the GPU
+// or too many viewers are open. Errors are printed, the host process isn't exited.
+POIROT_API poirot_viewer* poirot_open(const void *data, int dtype, const int size[3], const ptrdiff_t strides[4], int nframes);
+
+// Voxels from lower to upper (exclusive) of frame changed, NULL for the whole frame and frame -1 for all frames
+POIROT_API void poirot_changed(poirot_viewer *viewer, int frame, const int lower[3], const int upper[3]);
+
+// Instead of calling poirot_changed(), the array is checked for changes every interval seconds,
+// e.g. if another library writes into it. Changed blocks are found by hashing, only these are uploaded.
+// Returns 0 if the interval isn't positive or if watching can't be started, which prints an error.
+POIROT_API int poirot_watch(poirot_viewer *viewer, double interval);
+
+// Label map drawn over the array, e.g. a segmentation, with the array's size and one frame, NULL to remove it.
+// Dtype is POIROT_UINT8, POIROT_INT16 or POIROT_UINT16, strides as for poirot_open() (NULL if contiguous).
+// The map is owned by the caller like the array and must stay valid until poirot_close().
+POIROT_API void poirot_labels(poirot_viewer *viewer, const void *labels, int dtype, const ptrdiff_t strides[3]);
+
+// Labels from lower to upper (exclusive) changed, NULL for the whole map
+POIROT_API void poirot_labels_changed(poirot_viewer *viewer, const int lower[3], const int upper[3]);
+
+// Opens another window of the same array, the array is on the GPU only once.
+// If linked, the window is linked to the array's windows open by then, they follow each other's cursor and zoom.
+POIROT_API void poirot_add_window(poirot_viewer *viewer, int linked);
+
+// False once the user closed all windows of the viewer
+POIROT_API int poirot_is_open(poirot_viewer *viewer);
+
+// Closes the viewer's windows if they are still open, the thread ends with the last viewer
+POIROT_API void poirot_close(poirot_viewer *viewer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,332 @@
+// Benchmarks for upload, frame time and coordinate math, results are written as JSON to stdout (make bench).
+// Synthetic volumes are generated for a sweep of sizes and frame counts, combinations exceeding
+// the memory cap (-m, MiB) are skipped. Rendering is headless, GPU times are measured with timer queries.
+// Before, mip levels are checked against a plain average on the CPU and the bench fails if they differ,
+// as does a linked view which doesn't follow the cursor and zoom of another.
+#define POIROT_NO_MAIN
+#include "poirot.c"
+
+const int bench_sizes[] = {64, 128, 256, 512, 1024};
+const int bench_frames[] = {1, 10, 100};
+const int bench_dtypes[] = {DTYPE_UINT8, DTYPE_FLOAT32};
+#define BENCH_COUNT(a) (sizeof(a) / sizeof(a[0]))
+
+
+
+void fill_volume(char *image, int dtype, int size, int nframes)
+{
+	size_t n = (size_t)size * size * size;
+	for (int f = 0; f < nframes; f++) {
+		for (size_t i = 0; i < n; i++) {
+			int x = i % size, y = (i / size) % size, z = i / ((size_t)size * size);
+			float value = 0.5 + 0.5 * sinf(0.1f * (x + 2 * y + 3 * z + 5 * f));
+			size_t j = i + f * n;
+			if (dtype == DTYPE_UINT8) ((uint8_t *)image)[j] = 255 * value;
+			else ((float *)image)[j] = value;
+		}
+	}
+	return;
+}
+
+
+
+// Negative if not measured
+void print_ms(const char *name, double ms)
+{
+	if (ms < 0) printf("\"%s\": null, ", name);
+	else printf("\"%s\": %.3f, ", name, ms);
+	return;
+}
+
+
+
+double time_cpu_function(int which, long iterations)
+{
+	#include "coordinates.c"
+	struct input input = { .clicked_plane = -1 };
+	struct orientation orientation;
+	setup_orientation(&orientation);
+	float mouse_tex[2] = {0.5, 0.5};
+	double start = seconds();
+	for (long i = 0; i < iterations; i++) {
+		float t = 1e-3 * i;
+		switch (which) {
+			case 0:
+				input.left_button = true;
+				input.mouse_window[0] = -0.5 + 0.4 * sinf(t);
+				input.mouse_window[1] = 0.5 + 0.4 * cosf(t);
+				apply_input(&input, planes, centres, centres_window, &orientation);
+				break;
+			case 1:
+				update_zoom(i % 2 == 0 ? exp(-zoom_speed / 60) : exp(zoom_speed / 60), 0, planes, centres, centres_window, mouse_tex);
+				break;
+			case 2: {
+				float rel_shift[2] = {i % 2 == 0 ? move_speed / 60 : -move_speed / 60, 0}; // A frame at 60 Hz
+				move_view(rel_shift, 0, planes[0], centres[0], centres_window[0]);
+				break;
+			}
+		}
+	}
+	double elapsed = seconds() - start;
+	// Keeps the compiler from dropping the loop
+	volatile float sink = planes[0][0][0] + centres_window[0][0];
+	(void)sink;
+	return 1e9 * elapsed / iterations;
+}
+
+
+
+// Largest difference of downsample() to a plain 2x2x2 average, whose samples are clamped to the edges
+float check_downsample(int dtype, int in_size[3])
+{
+	int channels = dtype_channels[dtype];
+	size_t n = (size_t)in_size[0] * in_size[1] * in_size[2];
+	float *in = malloc(sizeof(float) * channels * n);
+	for (size_t i = 0; i < channels * n; i++) in[i] = sinf(0.7f * i) + 0.1f * (i % 5);
+	ptrdiff_t strides[4];
+	contiguous_strides(dtype, in_size, strides);
+	int out_size[3];
+	for (int a = 0; a < 3; a++) out_size[a] = fmax(1, in_size[a] / 2);
+	float *out = malloc(sizeof(float) * channels * out_size[0] * out_size[1] * out_size[2]);
+	downsample(dtype, (char *)in, strides, in_size, (char *)out, out_size, 0, out_size[2]);
+
+	float error = 0;
+	for (int z = 0; z < out_size[2]; z++) {
+		for (int y = 0; y < out_size[1]; y++) {
+			for (int x = 0; x < out_size[0]; x++) {
+				for (int c = 0; c < channels; c++) {
+					float sum = 0;
+					for (int d = 0; d < 8; d++) {
+						int xs = fmin(2 * x + d % 2, in_size[0] - 1);
+						int ys = fmin(2 * y + d / 2 % 2, in_size[1] - 1);
+						int zs = fmin(2 * z + d / 4, in_size[2] - 1);
+						sum += in[channels * (xs + in_size[0] * (ys + (size_t)in_size[1] * zs)) + c];
+					}
+					float value = out[channels * (x + out_size[0] * (y + (size_t)out_size[1] * z)) + c];
+					error = fmax(error, fabs(value - sum / 8));
+				}
+			}
+		}
+	}
+	free(in);
+	free(out);
+	return error;
+}
+
+
+
+// Largest difference of a linked view, which is turned, to the cursor (texture coordinates) and zoom of the view it follows
+float check_linked_view()
+{
+	#include "coordinates.c"
+	float other_planes[3][4][3], other_centres[3][2], other_centres_window[3][4];
+	memcpy(other_planes, planes, sizeof(planes));
+	memcpy(other_centres, centres, sizeof(centres));
+	memcpy(other_centres_window, centres_window, sizeof(centres_window));
+	struct orientation o, other_o;
+	setup_orientation(&o);
+	setup_orientation(&other_o);
+	rotate_view(0.3, 0, other_planes, &other_o);
+
+	float cursor[3] = {0.45, 0.55, 0.6};
+	set_cursor(cursor, planes, centres, centres_window);
+	update_zoom(0.5, 0, planes, centres, centres_window, centres[0]);
+	update_zoom(0.25, 2, planes, centres, centres_window, centres[2]);
+	follow_view(planes, &o, other_planes, other_centres, other_centres_window, &other_o);
+
+	float error = 0;
+	float tex[3], other_tex[3];
+	get_cursor(planes, cursor);
+	orient(&o, cursor, tex);
+	get_cursor(other_planes, cursor);
+	orient(&other_o, cursor, other_tex);
+	for (int i = 0; i < 3; i++) error = fmax(error, fabs(tex[i] - other_tex[i]));
+	for (int p = 0; p < 3; p++) {
+		for (int j = 0; j < 2; j++) {
+			int axis = plane_axes[p][j];
+			float extent = planes[p][2][axis] - planes[p][0][axis];
+			error = fmax(error, fabs(extent - (other_planes[p][2][axis] - other_planes[p][0][axis])));
+		}
+	}
+	return error;
+}
+
+
+
+void bench_volume(int size[3], int dtype, int nframes, int repeats)
+{
+	size_t frame_bytes = dtype_size[dtype] * size[0] * size[1] * size[2];
+	char *image = malloc(frame_bytes * nframes);
+	fill_volume(image, dtype, size[0], nframes);
+	ptrdiff_t strides[4];
+	contiguous_strides(dtype, size, strides);
+
+	// Mip levels on the CPU
+	struct mip_builder mipmaps;
+	setup_mip_builder(&mipmaps, dtype, size);
+	set_mip_image(&mipmaps, image, strides);
+	double start = seconds();
+	build_mipmaps(&mipmaps);
+	double mip_ms = 1e3 * (seconds() - start);
+
+	// Upload of all levels, and of level 0 of every frame as in cine playback
+	bool bricked = needs_bricks(dtype, size, texture_budget);
+	double upload_ms = -1, frame_upload_ms = -1;
+	if (!bricked) {
+		glFinish();
+		start = seconds();
+		GLuint texture = setup_texture(image, dtype, size, strides, mipmaps.layout.levels);
+		struct mip_layout *layout = &mipmaps.layout;
+		const struct texture_format *f = &texture_formats[dtype];
+		for (int l = 1; l < layout->levels; l++) {
+			glTexSubImage3D(
+				GL_TEXTURE_3D, l, 0, 0, 0, layout->size[l][0], layout->size[l][1], layout->size[l][2],
+				f->format, f->type, mipmaps.pyramid + layout->offset[l]
+			);
+		}
+		glFinish();
+		upload_ms = 1e3 * (seconds() - start);
+		if (nframes > 1) {
+			start = seconds();
+			for (int i = 0; i < nframes; i++) {
+				glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, size[0], size[1], size[2], f->format, f->type, image + i * frame_bytes);
+			}
+			glFinish();
+			frame_upload_ms = 1e3 * (seconds() - start) / nframes;
+		}
+		glDeleteTextures(1, &texture);
+	}
+	delete_mip_builder(&mipmaps);
+
+	// Frame time at cursor positions along the diagonal
+	struct offscreen offscreen;
+	setup_offscreen(&offscreen, image, dtype, size, strides, window_width, window_height);
+	GLuint query;
+	glGenQueries(1, &query);
+	double gpu_ms = 0, gpu_min_ms = INFINITY, cpu_ms = 0;
+	for (int r = 0; r < repeats; r++) {
+		#include "coordinates.c"
+		struct export_view view = { .zoom = 1 };
+		for (int i = 0; i < 3; i++) view.cursor[i] = (r + 0.5) / repeats * size[i];
+		set_view(&view, size, planes, centres, centres_window);
+		glFinish();
+		start = seconds();
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		render_offscreen(&offscreen, planes, centres_window);
+		glEndQuery(GL_TIME_ELAPSED);
+		GLuint64 elapsed;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		cpu_ms += 1e3 * (seconds() - start);
+		gpu_ms += 1e-6 * elapsed;
+		gpu_min_ms = fmin(gpu_min_ms, 1e-6 * elapsed);
+	}
+	glDeleteQueries(1, &query);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	delete_offscreen(&offscreen);
+	free(image);
+
+	printf("\"bricked\": %s, \"mip_ms\": %.3f, ", bricked ? "true" : "false", mip_ms);
+	print_ms("upload_ms", upload_ms);
+	print_ms("frame_upload_ms", frame_upload_ms);
+	printf(
+		"\"gpu_frame_ms\": %.3f, \"gpu_frame_min_ms\": %.3f, \"cpu_frame_ms\": %.3f",
+		gpu_ms / repeats, gpu_min_ms, cpu_ms / repeats
+	);
+	return;
+}
+
+
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	size_t max_bytes = (size_t)2048 << 20;
+	int max_size = 1024;
+	int repeats = 20;
+	long iterations = 1000000;
+	while ((opt = getopt(argc, argv, "m:s:r:i:")) != -1) {
+		switch (opt) {
+			case 'm':
+				max_bytes = (size_t)atol(optarg) << 20;
+				break;
+			case 's':
+				max_size = atoi(optarg);
+				break;
+			case 'r':
+				repeats = fmax(1, atoi(optarg));
+				break;
+			case 'i':
+				iterations = fmax(1, atol(optarg));
+				break;
+			default:
+				printf("Usage: bench [-m max_MiB] [-s max_size] [-r repeats] [-i iterations]\n");
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	// Status goes to stderr, stdout is only JSON
+	int out = dup(STDOUT_FILENO);
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+	struct headless headless;
+	open_headless_context(&headless);
+	setup_gl_state();
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	close(out);
+
+	// Odd sizes and sizes of 1 clamp, complex values are averaged per channel
+	int check_sizes[3][3] = {{7, 5, 3}, {1, 9, 4}, {6, 1, 1}};
+	float mip_error = 0;
+	for (int i = 0; i < 3; i++) {
+		mip_error = fmax(mip_error, check_downsample(DTYPE_FLOAT32, check_sizes[i]));
+		mip_error = fmax(mip_error, check_downsample(DTYPE_COMPLEX64, check_sizes[i]));
+	}
+	if (mip_error > 1e-5) {
+		fprintf(stderr, "Error: mip levels differ from a 2x2x2 average by %g\n", mip_error);
+		exit(EXIT_FAILURE);
+	}
+
+	// Linked windows follow the cursor and zoom of the window which moved
+	float link_error = check_linked_view();
+	if (link_error > 1e-5) {
+		fprintf(stderr, "Error: a linked view is off the cursor or zoom of the view it follows by %g\n", link_error);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("{\n\t\"renderer\": \"%s\",\n", glGetString(GL_RENDERER));
+	printf("\t\"mip_check_error\": %g,\n", mip_error);
+	printf("\t\"link_check_error\": %g,\n", link_error);
+	printf("\t\"width\": %d, \"height\": %d, \"repeats\": %d,\n", window_width, window_height, repeats);
+
+	const char *cpu_names[3] = {"apply_input", "update_zoom", "move_view"};
+	printf("\t\"cpu_ns\": {");
+	for (int i = 0; i < 3; i++) printf("%s\"%s\": %.2f", i > 0 ? ", " : "", cpu_names[i], time_cpu_function(i, iterations));
+	printf("},\n");
+
+	printf("\t\"volumes\": [");
+	bool first = true;
+	for (size_t d = 0; d < BENCH_COUNT(bench_dtypes); d++) {
+		for (size_t s = 0; s < BENCH_COUNT(bench_sizes); s++) {
+			for (size_t f = 0; f < BENCH_COUNT(bench_frames); f++) {
+				int dtype = bench_dtypes[d];
+				int size[3] = {bench_sizes[s], bench_sizes[s], bench_sizes[s]};
+				int nframes = bench_frames[f];
+				if (size[0] > max_size) continue;
+				printf("%s\n\t\t{\"dtype\": \"%s\", \"size\": %d, \"frames\": %d, ", first ? "" : ",", dtype_names[dtype], size[0], nframes);
+				first = false;
+				size_t bytes = dtype_size[dtype] * size[0] * size[1] * (size_t)size[2] * nframes;
+				if (bytes > max_bytes) printf("\"skipped\": \"exceeds %zu MiB\"}", max_bytes >> 20);
+				else {
+					bench_volume(size, dtype, nframes, repeats);
+					printf("}");
+				}
+				fflush(stdout);
+			}
+		}
+	}
+	printf("\n\t]\n}\n");
+
+	close_headless_context(&headless);
+	return 0;
+}
+
@@ -0,0 +1,668 @@
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#ifdef WITH_LZ4
+	#include <lz4.h>
+#endif
+#ifdef WITH_ZSTD
+	#include <zstd.h>
+#endif
+
+// Chunked volumes (.pcv): chunks of CHUNK_SIZE^3 voxels of one frame, each compressed on its own with lz4 or zstd
+// (if built with -DWITH_LZ4 or -DWITH_ZSTD, see the Makefile) and optionally a delta filter along x beforehand,
+// followed by an index of where the chunks are. See parse_chunked_header() (volume.c) for the header.
+// The image is an anonymous mapping which is decoded into on demand: whoever reads a region of it loads the chunks
+// there first (load_box()), missing chunks are read and decoded in parallel, so that only the chunks which the
+// displayed slices or frames need are read from disk. Decoded chunks are kept up to decoded_budget, beyond it
+// the least recently loaded layers of chunks (a frame's chunks of one z, which are contiguous in the image)
+// are dropped and their pages freed. Loading pins the layers until the reader releases them (release_box()), pinned
+// layers are never dropped, so the budget can be exceeded by what is being read.
+#ifndef CHUNK_SIZE
+	#define CHUNK_SIZE 64 // Voxels per axis when packing
+#endif
+#define ZSTD_LEVEL 3
+
+size_t decoded_budget = (size_t)4096 << 20; // Bytes of decoded chunks kept per image
+
+enum chunk_codec { CODEC_NONE, CODEC_LZ4, CODEC_ZSTD, NUM_CODECS };
+enum chunk_filter { FILTER_NONE, FILTER_DELTA };
+const char *codec_names[NUM_CODECS] = {"none", "lz4", "zstd"};
+
+enum chunk_state { CHUNK_MISSING, CHUNK_DECODING, CHUNK_DECODED };
+
+// In the file's index, per chunk with x fastest, then y, z and frames
+struct chunk_entry {
+	uint64_t offset;
+	uint32_t length;
+	uint16_t codec, filter;
+};
+
+struct chunked_image {
+	const char *path;
+	int fd;
+	int dtype;
+	int size[3];
+	int nframes;
+	int chunk[3];   // Voxels
+	int nchunks[3]; // Per axis of a frame
+	size_t total_chunks;
+	struct chunk_entry *index;
+	size_t max_length; // Of a chunk in the file
+	char *image;
+	size_t image_bytes;
+	atomic_char *state; // Per chunk
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // Chunks decoded by another thread
+	// Per layer of chunks, under the lock
+	size_t nlayers;
+	size_t *layer_bytes;         // Decoded
+	unsigned long long *used;    // When last loaded, of clock
+	int *busy;                   // Calls of load_boxes() not released yet
+	unsigned long long clock;    // Calls of load_boxes()
+	size_t decoded_bytes;
+	struct worker_pool workers; // Started when the file is opened, load_box() is called for every brick, slice and step
+};
+
+// Chunks decoded or encoded in parallel, next is taken by the threads
+struct chunk_batch {
+	struct chunked_image *chunks;
+	const size_t *list;
+	size_t n;
+	atomic_size_t next;
+	// Packing
+	const char *image;
+	const ptrdiff_t *strides;
+	int codec, filter;
+	char **encoded;
+	struct chunk_entry *entries;
+};
+
+
+
+// Box of a chunk in voxels and its frame
+int chunk_box(const struct chunked_image *chunks, size_t c, int lower[3], int extent[3])
+{
+	const int *n = chunks->nchunks;
+	size_t per_frame = (size_t)n[0] * n[1] * n[2];
+	size_t i = c % per_frame;
+	int position[3] = {i % n[0], (i / n[0]) % n[1], i / ((size_t)n[0] * n[1])};
+	for (int a = 0; a < 3; a++) {
+		lower[a] = position[a] * chunks->chunk[a];
+		extent[a] = fmin(chunks->chunk[a], chunks->size[a] - lower[a]);
+	}
+	return c / per_frame;
+}
+
+
+
+// Differences to the previous value of the same channel, as integers so that it's lossless also for floats
+void delta_encode(int dtype, char *data, size_t n)
+{
+	int lag = dtype_channels[dtype];
+	size_t words = n * lag;
+	switch (dtype_size[dtype] / lag) {
+		case 1:
+			for (size_t i = words - 1; i >= (size_t)lag && i < words; i--) ((uint8_t *)data)[i] -= ((uint8_t *)data)[i - lag];
+			break;
+		case 2:
+			for (size_t i = words - 1; i >= (size_t)lag && i < words; i--) ((uint16_t *)data)[i] -= ((uint16_t *)data)[i - lag];
+			break;
+		case 4:
+			for (size_t i = words - 1; i >= (size_t)lag && i < words; i--) ((uint32_t *)data)[i] -= ((uint32_t *)data)[i - lag];
+			break;
+	}
+	return;
+}
+
+
+
+void delta_decode(int dtype, char *data, size_t n)
+{
+	int lag = dtype_channels[dtype];
+	size_t words = n * lag;
+	switch (dtype_size[dtype] / lag) {
+		case 1:
+			for (size_t i = lag; i < words; i++) ((uint8_t *)data)[i] += ((uint8_t *)data)[i - lag];
+			break;
+		case 2:
+			for (size_t i = lag; i < words; i++) ((uint16_t *)data)[i] += ((uint16_t *)data)[i - lag];
+			break;
+		case 4:
+			for (size_t i = lag; i < words; i++) ((uint32_t *)data)[i] += ((uint32_t *)data)[i - lag];
+			break;
+	}
+	return;
+}
+
+
+
+// Frame and z of chunk c, in the order of the image
+size_t chunk_layer(const struct chunked_image *chunks, size_t c)
+{
+	return c / ((size_t)chunks->nchunks[0] * chunks->nchunks[1]);
+}
+
+
+
+// Drops the least recently used layers which nobody has pinned until the decoded chunks fit into decoded_budget.
+// Expects the lock to be held. Pages shared with neighbouring layers are kept, all others are freed.
+void drop_chunks(struct chunked_image *chunks)
+{
+	size_t per_layer = (size_t)chunks->nchunks[0] * chunks->nchunks[1];
+	size_t slice = dtype_size[chunks->dtype] * chunks->size[0] * (size_t)chunks->size[1];
+	size_t page = sysconf(_SC_PAGESIZE);
+	while (chunks->decoded_bytes > decoded_budget) {
+		size_t oldest = chunks->nlayers;
+		for (size_t l = 0; l < chunks->nlayers; l++) {
+			if (chunks->layer_bytes[l] == 0 || chunks->busy[l] > 0) continue;
+			if (oldest == chunks->nlayers || chunks->used[l] < chunks->used[oldest]) oldest = l;
+		}
+		if (oldest == chunks->nlayers) return;
+		// Nobody decodes or reads chunks of a layer which isn't busy
+		for (size_t c = oldest * per_layer; c < (oldest + 1) * per_layer; c++) atomic_store(&chunks->state[c], CHUNK_MISSING);
+		chunks->decoded_bytes -= chunks->layer_bytes[oldest];
+		chunks->layer_bytes[oldest] = 0;
+		int frame = oldest / chunks->nchunks[2];
+		int z = (oldest % chunks->nchunks[2]) * chunks->chunk[2];
+		size_t begin = slice * ((size_t)frame * chunks->size[2] + z);
+		size_t end = begin + slice * (size_t)fmin(chunks->chunk[2], chunks->size[2] - z);
+		begin = (begin + page - 1) / page * page;
+		end = end / page * page;
+		if (end > begin) madvise(chunks->image + begin, end - begin, MADV_DONTNEED);
+	}
+	return;
+}
+
+
+
+// Chunks of the boxes, first to last (inclusive) per axis, returns how many there are per frame
+size_t box_chunks(const struct chunked_image *chunks, const int lower[][3], const int upper[][3], int nboxes, int first[][3], int last[][3])
+{
+	size_t most = 0;
+	for (int b = 0; b < nboxes; b++) {
+		size_t n = 1;
+		for (int a = 0; a < 3; a++) {
+			first[b][a] = fmax(0, lower[b][a] / chunks->chunk[a]);
+			last[b][a] = fmin(chunks->nchunks[a] - 1, (upper[b][a] - 1) / chunks->chunk[a]);
+			n *= fmax(0, last[b][a] - first[b][a] + 1);
+		}
+		most += n;
+	}
+	return most;
+}
+
+
+
+// Layers of the boxes' chunks are pinned (by 1) when loading, and released (by -1) when the reader is done,
+// which can drop layers. Boxes without chunks are skipped.
+void mark_layers(
+	struct chunked_image *chunks, int first_frame, int last_frame, int first[][3], int last[][3], int nboxes, int by
+) {
+	pthread_mutex_lock(&chunks->lock);
+	if (by > 0) chunks->clock++;
+	for (int f = first_frame; f <= last_frame; f++) {
+		for (int b = 0; b < nboxes; b++) {
+			if (last[b][0] < first[b][0] || last[b][1] < first[b][1]) continue;
+			for (int z = first[b][2]; z <= last[b][2]; z++) {
+				size_t l = (size_t)f * chunks->nchunks[2] + z;
+				chunks->busy[l] += by;
+				chunks->used[l] = chunks->clock;
+			}
+		}
+	}
+	if (by < 0) drop_chunks(chunks);
+	pthread_mutex_unlock(&chunks->lock);
+	return;
+}
+
+
+
+// Built with it, see the Makefile
+bool has_codec(int codec)
+{
+	#ifndef WITH_LZ4
+		if (codec == CODEC_LZ4) return false;
+	#endif
+	#ifndef WITH_ZSTD
+		if (codec == CODEC_ZSTD) return false;
+	#endif
+	return true;
+}
+
+
+
+void codec_missing(const char *path, int codec)
+{
+	printf("Error: %s needs %s, but Poirot was built without it\n", path, codec_names[codec]);
+	exit(1);
+	return;
+}
+
+
+
+// Reads chunk c, using the buffers of the thread, and writes it into the image
+void decode_chunk(struct chunked_image *chunks, size_t c, char *compressed, char *decoded)
+{
+	const struct chunk_entry *entry = &chunks->index[c];
+	int lower[3], extent[3];
+	int frame = chunk_box(chunks, c, lower, extent);
+	size_t voxels = (size_t)extent[0] * extent[1] * extent[2];
+	size_t bytes = dtype_size[chunks->dtype] * voxels;
+	if (pread(chunks->fd, compressed, entry->length, entry->offset) != (ssize_t)entry->length) {
+		printf("Error: could not read chunk %zu of %s\n", c, chunks->path);
+		exit(1);
+	}
+	char *data = decoded;
+	size_t length = 0;
+	switch (entry->codec) {
+		case CODEC_NONE:
+			data = compressed;
+			length = entry->length;
+			break;
+		case CODEC_LZ4:
+			#ifdef WITH_LZ4
+				length = fmax(0, LZ4_decompress_safe(compressed, decoded, entry->length, bytes));
+			#else
+				codec_missing(chunks->path, CODEC_LZ4);
+			#endif
+			break;
+		case CODEC_ZSTD:
+			#ifdef WITH_ZSTD
+				length = ZSTD_decompress(decoded, bytes, compressed, entry->length);
+				if (ZSTD_isError(length)) length = 0;
+			#else
+				codec_missing(chunks->path, CODEC_ZSTD);
+			#endif
+			break;
+	}
+	if (length != bytes) {
+		printf("Error: chunk %zu of %s is corrupt\n", c, chunks->path);
+		exit(1);
+	}
+	if (entry->filter == FILTER_DELTA) delta_decode(chunks->dtype, data, voxels);
+
+	size_t row = dtype_size[chunks->dtype] * extent[0];
+	const int *size = chunks->size;
+	for (int z = 0; z < extent[2]; z++) {
+		for (int y = 0; y < extent[1]; y++) {
+			size_t i = lower[0] + size[0] * ((size_t)lower[1] + y + size[1] * ((size_t)lower[2] + z + (size_t)size[2] * frame));
+			memcpy(chunks->image + dtype_size[chunks->dtype] * i, data + row * (y + extent[1] * z), row);
+		}
+	}
+	return;
+}
+
+
+
+void* decode_chunk_batch(void *arg)
+{
+	struct chunk_batch *batch = arg;
+	struct chunked_image *chunks = batch->chunks;
+	size_t chunk_bytes = dtype_size[chunks->dtype] * chunks->chunk[0] * chunks->chunk[1] * chunks->chunk[2];
+	char *compressed = malloc(chunks->max_length);
+	char *decoded = malloc(chunk_bytes);
+	size_t i;
+	while ((i = atomic_fetch_add(&batch->next, 1)) < batch->n) decode_chunk(chunks, batch->list[i], compressed, decoded);
+	free(compressed);
+	free(decoded);
+	return NULL;
+}
+
+
+
+// On the image's workers, so that reads are in flight at once, which matters on network filesystems.
+// Every task runs function on the batch, which takes chunks until none are left.
+void run_chunk_batch(struct chunk_batch *batch, void* (*function)(void *))
+{
+	struct worker_pool *workers = &batch->chunks->workers;
+	run_tasks(workers, function, batch, 0, fmin(workers->nthreads + 1, batch->n));
+	return;
+}
+
+
+
+// Chunks of the boxes which aren't decoded yet, of frame or of all frames if it's -1. They stay pinned until
+// release_boxes() is called with the same boxes. Any thread can call this, chunks which another thread is decoding
+// are waited for.
+void load_boxes(struct chunked_image *chunks, int frame, const int lower[][3], const int upper[][3], int nboxes)
+{
+	if (chunks == NULL) return;
+	int first_frame = frame == -1 ? 0 : frame;
+	int last_frame = frame == -1 ? chunks->nframes - 1 : frame;
+	size_t per_frame = (size_t)chunks->nchunks[0] * chunks->nchunks[1] * chunks->nchunks[2];
+	int first[nboxes][3], last[nboxes][3];
+	size_t most = box_chunks(chunks, lower, upper, nboxes, first, last);
+	most *= last_frame - first_frame + 1;
+	if (most == 0) return;
+	mark_layers(chunks, first_frame, last_frame, first, last, nboxes, 1);
+
+	// Claim those which nobody decodes
+	size_t *claimed = malloc(sizeof(size_t) * most);
+	size_t nclaimed = 0;
+	bool others = false;
+	for (int f = first_frame; f <= last_frame; f++) {
+		for (int b = 0; b < nboxes; b++) {
+			for (int z = first[b][2]; z <= last[b][2]; z++) {
+				for (int y = first[b][1]; y <= last[b][1]; y++) {
+					for (int x = first[b][0]; x <= last[b][0]; x++) {
+						size_t c = x + chunks->nchunks[0] * ((size_t)y + chunks->nchunks[1] * z) + per_frame * f;
+						char state = atomic_load(&chunks->state[c]);
+						if (state == CHUNK_DECODED) continue;
+						if (state == CHUNK_MISSING && atomic_compare_exchange_strong(&chunks->state[c], &state, CHUNK_DECODING)) {
+							claimed[nclaimed++] = c;
+						}
+						else others = true;
+					}
+				}
+			}
+		}
+	}
+
+	if (nclaimed > 0) {
+		struct chunk_batch batch = { .chunks = chunks, .list = claimed, .n = nclaimed };
+		run_chunk_batch(&batch, decode_chunk_batch);
+		pthread_mutex_lock(&chunks->lock);
+		for (size_t i = 0; i < nclaimed; i++) {
+			int lower[3], extent[3];
+			chunk_box(chunks, claimed[i], lower, extent);
+			size_t bytes = dtype_size[chunks->dtype] * extent[0] * extent[1] * (size_t)extent[2];
+			chunks->layer_bytes[chunk_layer(chunks, claimed[i])] += bytes;
+			chunks->decoded_bytes += bytes;
+			atomic_store(&chunks->state[claimed[i]], CHUNK_DECODED);
+		}
+		pthread_cond_broadcast(&chunks->cond);
+		drop_chunks(chunks);
+		pthread_mutex_unlock(&chunks->lock);
+	}
+	free(claimed);
+	if (!others) return;
+
+	pthread_mutex_lock(&chunks->lock);
+	for (int f = first_frame; f <= last_frame; f++) {
+		for (int b = 0; b < nboxes; b++) {
+			for (int z = first[b][2]; z <= last[b][2]; z++) {
+				for (int y = first[b][1]; y <= last[b][1]; y++) {
+					for (int x = first[b][0]; x <= last[b][0]; x++) {
+						size_t c = x + chunks->nchunks[0] * ((size_t)y + chunks->nchunks[1] * z) + per_frame * f;
+						while (atomic_load(&chunks->state[c]) != CHUNK_DECODED) pthread_cond_wait(&chunks->cond, &chunks->lock);
+					}
+				}
+			}
+		}
+	}
+	pthread_mutex_unlock(&chunks->lock);
+	return;
+}
+
+
+
+// After the boxes of load_boxes() were read
+void release_boxes(struct chunked_image *chunks, int frame, const int lower[][3], const int upper[][3], int nboxes)
+{
+	if (chunks == NULL) return;
+	int first[nboxes][3], last[nboxes][3];
+	box_chunks(chunks, lower, upper, nboxes, first, last);
+	mark_layers(chunks, frame == -1 ? 0 : frame, frame == -1 ? chunks->nframes - 1 : frame, first, last, nboxes, -1);
+	return;
+}
+
+
+
+// Before reading voxels lower to upper (exclusive) of a frame (-1 for all frames), NULL for the whole frame.
+// Chunks can be NULL if the image isn't chunked. Each call needs a release_box() with the same box.
+void load_box(struct chunked_image *chunks, int frame, const int lower[3], const int upper[3])
+{
+	if (chunks == NULL) return;
+	int box[2][3] = {{0, 0, 0}, {chunks->size[0], chunks->size[1], chunks->size[2]}};
+	if (lower != NULL) {
+		memcpy(box[0], lower, sizeof(box[0]));
+		memcpy(box[1], upper, sizeof(box[1]));
+	}
+	load_boxes(chunks, frame, &box[0], &box[1], 1);
+	return;
+}
+
+
+
+void release_box(struct chunked_image *chunks, int frame, const int lower[3], const int upper[3])
+{
+	if (chunks == NULL) return;
+	int box[2][3] = {{0, 0, 0}, {chunks->size[0], chunks->size[1], chunks->size[2]}};
+	if (lower != NULL) {
+		memcpy(box[0], lower, sizeof(box[0]));
+		memcpy(box[1], upper, sizeof(box[1]));
+	}
+	release_boxes(chunks, frame, &box[0], &box[1], 1);
+	return;
+}
+
+
+
+// The header was parsed by open_volume(), returns the image which is decoded into
+void* open_chunked_image(struct chunked_image *chunks, struct volume *volume)
+{
+	memset(chunks, 0, sizeof(struct chunked_image));
+	chunks->path = volume->path;
+	chunks->fd = volume->fd;
+	chunks->dtype = volume->dtype;
+	memcpy(chunks->size, volume->size, sizeof(chunks->size));
+	chunks->nframes = volume->nframes;
+	memcpy(chunks->chunk, volume->chunk, sizeof(chunks->chunk));
+	chunks->total_chunks = volume->nframes;
+	for (int a = 0; a < 3; a++) {
+		chunks->nchunks[a] = (chunks->size[a] + chunks->chunk[a] - 1) / chunks->chunk[a];
+		chunks->total_chunks *= chunks->nchunks[a];
+	}
+
+	chunks->index = malloc(sizeof(struct chunk_entry) * chunks->total_chunks);
+	read_header(volume, chunks->index, sizeof(struct chunk_entry) * chunks->total_chunks, volume->offset);
+	for (size_t c = 0; c < chunks->total_chunks; c++) {
+		struct chunk_entry *entry = &chunks->index[c];
+		if (entry->offset + entry->length > volume->length || entry->codec >= NUM_CODECS || entry->filter > FILTER_DELTA) {
+			printf("Error: invalid chunk index in %s\n", volume->path);
+			exit(1);
+		}
+		if (!has_codec(entry->codec)) codec_missing(volume->path, entry->codec);
+		chunks->max_length = fmax(chunks->max_length, entry->length);
+	}
+
+	// Pages which are never decoded into are never allocated
+	chunks->image_bytes = dtype_size[chunks->dtype] * chunks->size[0] * chunks->size[1] * (size_t)chunks->size[2] * chunks->nframes;
+	chunks->image = mmap(NULL, chunks->image_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (chunks->image == MAP_FAILED) {
+		printf("Error: could not reserve memory for %s\n", volume->path);
+		exit(1);
+	}
+	// Rows of a chunk are far apart in the image, e.g. a slice in x touches every page, huge pages take fewer faults
+	madvise(chunks->image, chunks->image_bytes, MADV_HUGEPAGE);
+	chunks->state = calloc(chunks->total_chunks, sizeof(atomic_char));
+	chunks->nlayers = (size_t)chunks->nchunks[2] * chunks->nframes;
+	chunks->layer_bytes = calloc(chunks->nlayers, sizeof(size_t));
+	chunks->used = calloc(chunks->nlayers, sizeof(unsigned long long));
+	chunks->busy = calloc(chunks->nlayers, sizeof(int));
+	pthread_mutex_init(&chunks->lock, NULL);
+	pthread_cond_init(&chunks->cond, NULL);
+	setup_worker_pool(&chunks->workers);
+	return chunks->image;
+}
+
+
+
+// The volume is closed by the caller
+void close_chunked_image(struct chunked_image *chunks)
+{
+	munmap(chunks->image, chunks->image_bytes);
+	free(chunks->index);
+	free((void *)chunks->state);
+	free(chunks->layer_bytes);
+	free(chunks->used);
+	free(chunks->busy);
+	pthread_mutex_destroy(&chunks->lock);
+	pthread_cond_destroy(&chunks->cond);
+	delete_worker_pool(&chunks->workers);
+	return;
+}
+
+
+
+// Codec, optionally prefixed by "delta+" for the filter, e.g. "delta+zstd" or "delta" alone. Returns false if unknown.
+bool parse_codec(const char *name, int *codec, int *filter)
+{
+	*filter = FILTER_NONE;
+	if (strncmp(name, "delta", 5) == 0) {
+		*filter = FILTER_DELTA;
+		name += 5;
+		if (*name == '\0') name = "none";
+		else if (*name == '+') name++;
+		else return false;
+	}
+	*codec = -1;
+	for (int i = 0; i < NUM_CODECS; i++) {
+		if (strcmp(name, codec_names[i]) == 0) *codec = i;
+	}
+	return *codec != -1;
+}
+
+
+
+size_t encoded_bound(int codec, size_t bytes)
+{
+	switch (codec) {
+		#ifdef WITH_LZ4
+		case CODEC_LZ4:
+			return LZ4_compressBound(bytes);
+		#endif
+		#ifdef WITH_ZSTD
+		case CODEC_ZSTD:
+			return ZSTD_compressBound(bytes);
+		#endif
+	}
+	return bytes;
+}
+
+
+
+void* encode_chunk_batch(void *arg)
+{
+	struct chunk_batch *batch = arg;
+	struct chunked_image *chunks = batch->chunks;
+	size_t chunk_bytes = dtype_size[chunks->dtype] * chunks->chunk[0] * chunks->chunk[1] * chunks->chunk[2];
+	char *raw = malloc(chunk_bytes);
+	char *filtered = malloc(chunk_bytes);
+	size_t i;
+	while ((i = atomic_fetch_add(&batch->next, 1)) < batch->n) {
+		size_t c = batch->list[i];
+		int lower[3], extent[3];
+		int frame = chunk_box(chunks, c, lower, extent);
+		size_t voxels = (size_t)extent[0] * extent[1] * extent[2];
+		size_t bytes = dtype_size[chunks->dtype] * voxels;
+		const char *source = batch->image + frame * batch->strides[3];
+		for (int a = 0; a < 3; a++) source += lower[a] * batch->strides[a];
+		copy_box(chunks->dtype, source, batch->strides, extent, raw);
+
+		const char *input = raw;
+		if (batch->filter == FILTER_DELTA) {
+			memcpy(filtered, raw, bytes);
+			delta_encode(chunks->dtype, filtered, voxels);
+			input = filtered;
+		}
+		char *out = malloc(encoded_bound(batch->codec, bytes));
+		size_t length = 0;
+		switch (batch->codec) {
+			#ifdef WITH_LZ4
+			case CODEC_LZ4:
+				length = fmax(0, LZ4_compress_default(input, out, bytes, LZ4_compressBound(bytes)));
+				break;
+			#endif
+			#ifdef WITH_ZSTD
+			case CODEC_ZSTD:
+				length = ZSTD_compress(out, ZSTD_compressBound(bytes), input, bytes, ZSTD_LEVEL);
+				if (ZSTD_isError(length)) length = 0;
+				break;
+			#endif
+			default:
+				memcpy(out, input, bytes);
+				length = bytes;
+		}
+		struct chunk_entry *entry = &batch->entries[i];
+		*entry = (struct chunk_entry) { 0, length, batch->codec, batch->filter };
+		if (batch->codec != CODEC_NONE && (length == 0 || length >= bytes)) {
+			// Chunks which the codec failed on or couldn't shrink are stored as they are
+			memcpy(out, raw, bytes);
+			*entry = (struct chunk_entry) { 0, bytes, CODEC_NONE, FILTER_NONE };
+		}
+		batch->encoded[i] = out;
+	}
+	free(raw);
+	free(filtered);
+	return NULL;
+}
+
+
+
+// Writes the image as a chunked volume, one layer of chunks in z at a time is encoded in parallel and then written
+void pack_chunked(
+	const char *path, const char *image, int dtype, int size[3], const ptrdiff_t strides[4], int nframes,
+	int codec, int filter
+) {
+	if (!has_codec(codec)) codec_missing(path, codec);
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		printf("Error: could not create %s\n", path);
+		exit(1);
+	}
+	struct chunked_image chunks = { .path = path, .dtype = dtype, .nframes = nframes };
+	memcpy(chunks.size, size, sizeof(chunks.size));
+	chunks.total_chunks = nframes;
+	for (int a = 0; a < 3; a++) {
+		chunks.chunk[a] = CHUNK_SIZE;
+		chunks.nchunks[a] = (size[a] + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		chunks.total_chunks *= chunks.nchunks[a];
+	}
+	struct chunk_entry *index = malloc(sizeof(struct chunk_entry) * chunks.total_chunks);
+	setup_worker_pool(&chunks.workers);
+
+	unsigned char header[CHUNKED_HEADER_SIZE] = {0};
+	memcpy(header, "POIROTCV", 8);
+	uint32_t fields[10] = {1, dtype, size[0], size[1], size[2], nframes, CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE, 0};
+	memcpy(header + 8, fields, sizeof(fields));
+	fwrite(header, 1, sizeof(header), file);
+	uint64_t offset = sizeof(header);
+
+	size_t layer = (size_t)chunks.nchunks[0] * chunks.nchunks[1];
+	size_t *list = malloc(sizeof(size_t) * layer);
+	char **encoded = malloc(sizeof(char *) * layer);
+	for (size_t first = 0; first < chunks.total_chunks; first += layer) {
+		for (size_t i = 0; i < layer; i++) list[i] = first + i;
+		struct chunk_batch batch = {
+			.chunks = &chunks, .list = list, .n = layer, .image = image, .strides = strides,
+			.codec = codec, .filter = filter, .encoded = encoded, .entries = index + first
+		};
+		run_chunk_batch(&batch, encode_chunk_batch);
+		for (size_t i = 0; i < layer; i++) {
+			struct chunk_entry *entry = &index[first + i];
+			entry->offset = offset;
+			if (fwrite(encoded[i], 1, entry->length, file) != entry->length) {
+				printf("Error: could not write %s\n", path);
+				exit(1);
+			}
+			offset += entry->length;
+			free(encoded[i]);
+		}
+	}
+	size_t raw_bytes = dtype_size[dtype] * size[0] * size[1] * (size_t)size[2] * nframes;
+	fwrite(index, sizeof(struct chunk_entry), chunks.total_chunks, file);
+	memcpy(header + 48, &offset, sizeof(offset));
+	fseek(file, 0, SEEK_SET);
+	fwrite(header, 1, sizeof(header), file);
+	if (fclose(file) != 0) {
+		printf("Error: could not write %s\n", path);
+		exit(1);
+	}
+	printf("Packed %zu chunks into %s, %.1f%% of the raw size\n", chunks.total_chunks, path, 100.0 * offset / raw_bytes);
+	free(index);
+	free(list);
+	free(encoded);
+	delete_worker_pool(&chunks.workers);
+	return;
+}
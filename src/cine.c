@@ -0,0 +1,364 @@
+#include <pthread.h>
+
+// Cine playback: frames are copied from the image into a ring of slots in one persistently mapped
+// pixel buffer by a worker thread, the render loop uploads a slot into the texture when the frame is due
+// and fences the upload so that the worker can't overwrite a slot the GPU still reads from.
+// Slots hold the frame followed by its mip levels, which the worker builds as well. In grids (grid.c), slots hold the
+// frames of all cells one after the other instead, like the layers of the 2D array texture, which has no mip levels.
+#ifndef CINE_RING_SIZE
+	#define CINE_RING_SIZE 3
+#endif
+
+enum slot_state { SLOT_FREE, SLOT_FILLING, SLOT_READY, SLOT_UPLOADING };
+#define NUM_CINE_KEYS 5
+
+struct cine {
+	struct viewer **cells; // Volumes of the frames, one unless gridded
+	int ncells;
+	int dtype;
+	int size[3];
+	int nframes;
+	size_t frame_bytes; // Contiguous per cell, in a slot
+	size_t slot_bytes;
+	struct mip_builder mipmaps;
+	bool direct; // No ring, the caller switches frames itself (brick cache)
+	GLuint texture, buffer;
+	char *mapped;
+	GLsync fences[CINE_RING_SIZE];
+	char state[CINE_RING_SIZE];
+	int slot_frame[CINE_RING_SIZE];
+	unsigned int slot_generation[CINE_RING_SIZE];
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int generation; // Incremented when seeking, invalidates prefetched frames
+	int fill_frame;          // Next frame the worker copies
+	bool quit;
+	int frame;               // Displayed
+	int want;                // To be displayed
+	bool playing;
+	float fps;
+	double start_time;
+	int start_frame;
+	long last_tick;          // Frames since start_time
+	unsigned long shown, dropped;
+};
+
+
+
+void* cine_worker(void *arg)
+{
+	struct cine *cine = arg;
+	size_t frame_bytes = cine->frame_bytes;
+	size_t slot_bytes = cine->slot_bytes;
+	pthread_mutex_lock(&cine->lock);
+	while (!cine->quit) {
+		int s = -1;
+		for (int i = 0; i < CINE_RING_SIZE; i++) {
+			if (cine->state[i] == SLOT_FREE) {
+				s = i;
+				break;
+			}
+		}
+		if (s == -1) {
+			pthread_cond_wait(&cine->cond, &cine->lock);
+			continue;
+		}
+		int frame = cine->fill_frame;
+		unsigned int generation = cine->generation;
+		cine->fill_frame = (frame + 1) % cine->nframes;
+		cine->state[s] = SLOT_FILLING;
+		cine->slot_frame[s] = frame;
+		cine->slot_generation[s] = generation;
+		pthread_mutex_unlock(&cine->lock);
+
+		// Page faults of a mapped file happen here and not in the render loop
+		char *slot = cine->mapped + s * slot_bytes;
+		for (int c = 0; c < cine->ncells; c++) {
+			struct viewer *viewer = cine->cells[c];
+			load_box(viewer->chunks, frame, NULL, NULL);
+			copy_box(cine->dtype, viewer->image + frame * viewer->strides[3], viewer->strides, cine->size, slot + c * frame_bytes);
+		}
+		if (cine->mipmaps.layout.levels > 1) {
+			// Not built in place because reading from the mapped buffer can be slow
+			struct viewer *viewer = cine->cells[0];
+			set_mip_image(&cine->mipmaps, viewer->image + frame * viewer->strides[3], viewer->strides);
+			build_mipmaps(&cine->mipmaps);
+			memcpy(slot + frame_bytes, cine->mipmaps.pyramid, cine->mipmaps.layout.bytes);
+		}
+		for (int c = 0; c < cine->ncells; c++) release_box(cine->cells[c]->chunks, frame, NULL, NULL);
+
+		pthread_mutex_lock(&cine->lock);
+		cine->state[s] = generation == cine->generation ? SLOT_READY : SLOT_FREE;
+		glfwPostEmptyEvent();
+	}
+	pthread_mutex_unlock(&cine->lock);
+	return NULL;
+}
+
+
+
+// Texture is the 3D texture of the volume, or the 2D array of the cells if there are several
+void setup_cine(struct cine *cine, struct viewer *cells[], int ncells, GLuint texture)
+{
+	memset(cine, 0, sizeof(struct cine));
+	struct viewer *viewer = cells[0];
+	cine->cells = cells;
+	cine->ncells = ncells;
+	cine->dtype = viewer->dtype;
+	for (int i = 0; i < 3; i++) cine->size[i] = viewer->size[i];
+	cine->nframes = viewer->nframes;
+	cine->frame_bytes = dtype_size[cine->dtype] * cine->size[0] * cine->size[1] * (size_t)cine->size[2];
+	cine->texture = texture;
+	cine->direct = texture == 0;
+	cine->fps = 10;
+	if (cine->nframes == 1 || cine->direct) return;
+
+	if (ncells == 1) setup_mip_builder(&cine->mipmaps, cine->dtype, cine->size);
+	cine->slot_bytes = ncells * cine->frame_bytes + cine->mipmaps.layout.bytes;
+	size_t bytes = CINE_RING_SIZE * cine->slot_bytes;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &cine->buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, cine->buffer);
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, flags);
+	cine->mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, flags);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	cine->fill_frame = 1;
+	pthread_mutex_init(&cine->lock, NULL);
+	pthread_cond_init(&cine->cond, NULL);
+	pthread_create(&cine->worker, NULL, cine_worker, cine);
+	return;
+}
+
+
+
+// Needs to be called with the lock held
+void cine_seek(struct cine *cine, int frame)
+{
+	cine->generation++;
+	cine->fill_frame = frame;
+	for (int i = 0; i < CINE_RING_SIZE; i++) {
+		if (cine->state[i] == SLOT_READY) cine->state[i] = SLOT_FREE;
+	}
+	pthread_cond_signal(&cine->cond);
+	return;
+}
+
+
+
+// Drops prefetched frames, e.g. because the image changed
+void reload_cine(struct cine *cine)
+{
+	if (cine->nframes == 1 || cine->direct) return;
+	pthread_mutex_lock(&cine->lock);
+	cine_seek(cine, (cine->frame + 1) % cine->nframes);
+	pthread_mutex_unlock(&cine->lock);
+	return;
+}
+
+
+
+void report_cine(struct cine *cine)
+{
+	unsigned long total = cine->shown + cine->dropped;
+	printf(
+		"Cine: %lu frames shown, %lu dropped (%.1f%%) at %.1f fps\n",
+		cine->shown, cine->dropped, total > 0 ? 100.0 * cine->dropped / total : 0.0, cine->fps
+	);
+	return;
+}
+
+
+
+void play_cine(struct cine *cine, bool play)
+{
+	if (cine->nframes == 1) return;
+	cine->playing = play;
+	cine->start_time = glfwGetTime();
+	cine->start_frame = cine->frame;
+	cine->last_tick = 0;
+	if (!play) report_cine(cine);
+	return;
+}
+
+
+
+void step_cine(struct cine *cine, int step)
+{
+	if (cine->nframes == 1) return;
+	if (cine->playing) play_cine(cine, false);
+	cine->want = ((cine->want + step) % cine->nframes + cine->nframes) % cine->nframes;
+	return;
+}
+
+
+
+void set_cine_fps(struct cine *cine, float fps)
+{
+	cine->fps = fmax(0.5, fps);
+	if (cine->playing) play_cine(cine, true);
+	return;
+}
+
+
+
+// Seconds until the next frame is due, negative if not playing.
+// A late frame doesn't need polling, the worker posts an empty event when it is ready.
+double cine_timeout(struct cine *cine)
+{
+	if (!cine->playing) return -1;
+	double t = (glfwGetTime() - cine->start_time) * cine->fps;
+	return (floor(t) + 1 - t) / cine->fps;
+}
+
+
+
+// Returns true if the displayed frame changed
+bool update_cine(struct cine *cine)
+{
+	if (cine->nframes == 1) return false;
+
+	if (!cine->direct) {
+		// Retire uploads the GPU has finished
+		pthread_mutex_lock(&cine->lock);
+		for (int i = 0; i < CINE_RING_SIZE; i++) {
+			if (cine->state[i] != SLOT_UPLOADING) continue;
+			GLenum status = glClientWaitSync(cine->fences[i], 0, 0);
+			if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+				glDeleteSync(cine->fences[i]);
+				cine->state[i] = SLOT_FREE;
+				pthread_cond_signal(&cine->cond);
+			}
+		}
+		pthread_mutex_unlock(&cine->lock);
+	}
+
+	long tick = 0;
+	if (cine->playing) {
+		tick = floor((glfwGetTime() - cine->start_time) * cine->fps);
+		if (tick == cine->last_tick) return false;
+		cine->want = (cine->start_frame + tick) % cine->nframes;
+	}
+	if (cine->want == cine->frame) return false;
+
+	if (cine->direct) {
+		cine->frame = cine->want;
+	}
+	else {
+		// Find the wanted frame, frames which are behind were dropped
+		pthread_mutex_lock(&cine->lock);
+		int s = -1;
+		bool pending = false;
+		for (int i = 0; i < CINE_RING_SIZE; i++) {
+			if (cine->slot_generation[i] != cine->generation) continue;
+			if (cine->state[i] != SLOT_READY && cine->state[i] != SLOT_FILLING) continue;
+			int ahead = (cine->slot_frame[i] - cine->want + cine->nframes) % cine->nframes;
+			if (ahead == 0) {
+				if (cine->state[i] == SLOT_READY) s = i;
+				else pending = true;
+			}
+			else if (ahead > CINE_RING_SIZE && cine->state[i] == SLOT_READY) {
+				cine->state[i] = SLOT_FREE;
+				pthread_cond_signal(&cine->cond);
+			}
+		}
+		if (s == -1) {
+			if (!pending) cine_seek(cine, cine->want);
+			pthread_mutex_unlock(&cine->lock);
+			return false;
+		}
+		cine->state[s] = SLOT_UPLOADING;
+		pthread_mutex_unlock(&cine->lock);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, cine->buffer);
+		const struct texture_format *f = &texture_formats[cine->dtype];
+		struct mip_layout *layout = &cine->mipmaps.layout;
+		if (cine->ncells > 1) {
+			glTextureSubImage3D(
+				cine->texture, 0, 0, 0, 0, cine->size[0], cine->size[1], cine->size[2] * cine->ncells,
+				f->format, f->type, (void *)(s * cine->slot_bytes)
+			);
+		}
+		else glBindTexture(GL_TEXTURE_3D, cine->texture);
+		for (int l = 0; l < layout->levels; l++) {
+			size_t offset = s * cine->slot_bytes + (l == 0 ? 0 : cine->frame_bytes + layout->offset[l]);
+			glTexSubImage3D(
+				GL_TEXTURE_3D, l, 0, 0, 0, layout->size[l][0], layout->size[l][1], layout->size[l][2],
+				f->format, f->type, (void *)offset
+			);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		cine->fences[s] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		cine->frame = cine->want;
+	}
+
+	if (cine->playing) {
+		if (tick > cine->last_tick + 1) cine->dropped += tick - cine->last_tick - 1;
+		cine->last_tick = tick;
+	}
+	cine->shown++;
+	return true;
+}
+
+
+
+// Presses are counted per window on the input thread, so that the render thread misses none (apply_cine_controls()),
+// the cine is shared by the windows of a volume
+struct cine_controls {
+	int toggles, steps, speedups;
+};
+
+
+
+void handle_cine_keys(GLFWwindow *window, struct cine_controls *controls, char previous[NUM_CINE_KEYS])
+{
+	const int keys[NUM_CINE_KEYS] = {GLFW_KEY_SPACE, GLFW_KEY_PERIOD, GLFW_KEY_COMMA, GLFW_KEY_RIGHT_BRACKET, GLFW_KEY_LEFT_BRACKET};
+	char pressed[NUM_CINE_KEYS];
+	for (int i = 0; i < NUM_CINE_KEYS; i++) {
+		char state = key_down(window, keys[i]);
+		pressed[i] = state && !previous[i];
+		previous[i] = state;
+	}
+	controls->toggles += pressed[0];
+	controls->steps += pressed[1] - pressed[2];
+	controls->speedups += pressed[3] - pressed[4];
+	return;
+}
+
+
+
+// Applies what was pressed since applied, which is updated
+void apply_cine_controls(struct cine *cine, const struct cine_controls *controls, struct cine_controls *applied)
+{
+	if ((controls->toggles - applied->toggles) % 2 != 0) play_cine(cine, !cine->playing);
+	if (controls->steps != applied->steps) step_cine(cine, controls->steps - applied->steps);
+	if (controls->speedups != applied->speedups) set_cine_fps(cine, cine->fps * pow(1.25, controls->speedups - applied->speedups));
+	*applied = *controls;
+	return;
+}
+
+
+
+void stop_cine(struct cine *cine)
+{
+	if (cine->shown > 0) report_cine(cine);
+	if (cine->nframes == 1 || cine->direct) return;
+	pthread_mutex_lock(&cine->lock);
+	cine->quit = true;
+	pthread_cond_signal(&cine->cond);
+	pthread_mutex_unlock(&cine->lock);
+	pthread_join(cine->worker, NULL);
+	for (int i = 0; i < CINE_RING_SIZE; i++) {
+		if (cine->state[i] == SLOT_UPLOADING) glDeleteSync(cine->fences[i]);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, cine->buffer);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glDeleteBuffers(1, &cine->buffer);
+	if (cine->ncells == 1) delete_mip_builder(&cine->mipmaps);
+	pthread_mutex_destroy(&cine->lock);
+	pthread_cond_destroy(&cine->cond);
+	return;
+}
+
@@ -0,0 +1,294 @@
+
+// Window/level: either set manually by dragging the middle mouse button or computed on the GPU
+// from the displayed part of the three slices whenever they change (shaders.c), nothing is read back.
+#ifndef MAX_CONTRAST_SAMPLES
+	#define MAX_CONTRAST_SAMPLES 512 // Per axis of each slice
+#endif
+
+enum contrast_mode { CONTRAST_MANUAL, CONTRAST_MINMAX, CONTRAST_PERCENTILES, NUM_CONTRAST_MODES };
+enum colormap { COLORMAP_GREY, COLORMAP_HOT, COLORMAP_VIRIDIS, COLORMAP_RED, NUM_COLORMAPS };
+enum complex_part { COMPLEX_MAGNITUDE, COMPLEX_PHASE, COMPLEX_REAL, COMPLEX_IMAGINARY, NUM_COMPLEX_PARTS }; // As in the shaders
+const char *complex_part_names[NUM_COMPLEX_PARTS] = {"magnitude", "phase", "real part", "imaginary part"};
+
+// Control points, evenly spaced
+const float colormap_points[NUM_COLORMAPS][5][3] = {
+	{{0.0, 0.0, 0.0},   {0.25, 0.25, 0.25}, {0.5, 0.5, 0.5},    {0.75, 0.75, 0.75}, {1.0, 1.0, 1.0}},
+	{{0.0, 0.0, 0.0},   {0.7, 0.0, 0.0},    {1.0, 0.4, 0.0},    {1.0, 0.8, 0.2},    {1.0, 1.0, 1.0}},
+	{{0.27, 0.0, 0.33}, {0.23, 0.32, 0.55}, {0.13, 0.57, 0.55}, {0.37, 0.79, 0.38}, {0.99, 0.91, 0.14}},
+	{{0.0, 0.0, 0.0},   {0.25, 0.0, 0.0},   {0.5, 0.0, 0.0},    {0.75, 0.0, 0.0},   {1.0, 0.0, 0.0}}
+};
+
+float contrast_percentiles[2] = {0.01, 0.99};
+
+struct contrast {
+	char mode;
+	char colormap;
+	char part;       // Of complex values
+	bool complex;
+	float window[2]; // Lower and upper bound in manual mode
+	float base[2];   // Window which the manual one is relative to, see struct contrast_settings
+	int drags;
+	GLuint program, shaders[1];
+	GLuint buffer, colormap_texture;
+	GLint uniform_pass, uniform_origin, uniform_edges, uniform_samples, uniform_percentiles;
+	GLint uniform_slab_mode, uniform_slab_origin, uniform_slab_edges, uniform_part;
+};
+
+// Chosen with keys and mouse on the input thread, applied on the render thread (apply_contrast_settings()).
+// The manual window is relative to the automatic one which was shown when dragging started, because only
+// the render thread can read that back: the level is shifted by level half widths and the width scaled by exp(log_width).
+struct contrast_settings {
+	char mode;
+	char colormap;
+	char part;
+	int drags; // Started from an automatic window
+	float level, log_width;
+};
+
+struct contrast_input {
+	struct contrast_settings settings;
+	char previous_keys[3];
+	double previous_mouse[2];
+};
+
+
+
+void set_colormap(struct contrast *contrast, char colormap)
+{
+	contrast->colormap = colormap;
+	GLubyte colours[256][4];
+	for (int i = 0; i < 256; i++) {
+		float x = i / 255.0 * 4;
+		int j = fmin(3, x);
+		float w = x - j;
+		for (int c = 0; c < 3; c++) {
+			colours[i][c] = 255 * ((1 - w) * colormap_points[colormap][j][c] + w * colormap_points[colormap][j+1][c]) + 0.5;
+		}
+		colours[i][3] = 255;
+	}
+	glTextureSubImage1D(contrast->colormap_texture, 0, 0, 256, GL_RGBA, GL_UNSIGNED_BYTE, colours);
+	return;
+}
+
+
+
+void setup_contrast(struct contrast *contrast, bool bricked, int dtype, int size[3])
+{
+	contrast->mode = CONTRAST_MINMAX;
+	contrast->part = COMPLEX_MAGNITUDE;
+	contrast->complex = dtype_channels[dtype] == 2;
+	contrast->window[0] = 0;
+	contrast->window[1] = 1;
+	contrast->base[0] = 0;
+	contrast->base[1] = 1;
+
+	setup_contrast_shaders(&contrast->program, contrast->shaders);
+	set_volume_uniforms(contrast->program, bricked, dtype, size);
+	contrast->uniform_pass        = glGetUniformLocation(contrast->program, "pass");
+	contrast->uniform_origin      = glGetUniformLocation(contrast->program, "origin");
+	contrast->uniform_edges       = glGetUniformLocation(contrast->program, "edges");
+	contrast->uniform_samples     = glGetUniformLocation(contrast->program, "samples");
+	contrast->uniform_percentiles = glGetUniformLocation(contrast->program, "percentiles");
+	contrast->uniform_slab_mode   = glGetUniformLocation(contrast->program, "slab_mode");
+	contrast->uniform_slab_origin = glGetUniformLocation(contrast->program, "slab_origin");
+	contrast->uniform_slab_edges  = glGetUniformLocation(contrast->program, "slab_edges");
+	contrast->uniform_part        = glGetUniformLocation(contrast->program, "complex_part");
+
+	glGenBuffers(1, &contrast->buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, contrast->buffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (4 + HISTOGRAM_BINS), NULL, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, contrast->buffer);
+
+	glActiveTexture(GL_TEXTURE2);
+	glGenTextures(1, &contrast->colormap_texture);
+	glBindTexture(GL_TEXTURE_1D, contrast->colormap_texture);
+	glTexStorage1D(GL_TEXTURE_1D, 1, GL_RGBA8, 256);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glActiveTexture(GL_TEXTURE0);
+	set_colormap(contrast, COLORMAP_GREY);
+	return;
+}
+
+
+
+// Corners as displayed, see displayed_corners(), samples outside of the volume don't count.
+// With a slab switched on, its projections are sampled instead of the slices, slab may be NULL.
+void update_contrast(struct contrast *contrast, float corners[3][4][3], int size[3], struct slab *slab)
+{
+	if (contrast->mode == CONTRAST_MANUAL) return;
+
+	float origin[3][3], edges[6][3];
+	float slab_origin[3][2], slab_edges[6][2];
+	int samples[3][2];
+	int max_samples[2] = {0, 0};
+	for (int p = 0; p < 3; p++) {
+		for (int i = 0; i < 3; i++) {
+			origin[p][i] = corners[p][0][i];
+			edges[2*p][i] = corners[p][1][i] - corners[p][0][i];
+			edges[2*p+1][i] = corners[p][3][i] - corners[p][0][i];
+		}
+		for (int j = 0; j < 2; j++) {
+			float voxels = 0;
+			for (int i = 0; i < 3; i++) voxels += pow(edges[2*p+j][i] * size[i], 2);
+			samples[p][j] = fmax(1, fmin(MAX_CONTRAST_SAMPLES, sqrt(voxels)));
+			if (samples[p][j] > max_samples[j]) max_samples[j] = samples[p][j];
+		}
+		if (slab == NULL) continue;
+		// Same corners in the plane's view coordinates, where the slab's layer spans [0, 1]
+		float q[4][3];
+		for (int c = 0; c < 4; c++) unorient(&slab->orientation, corners[p][c], q[c]);
+		for (int j = 0; j < 2; j++) {
+			int axis = plane_axes[p][j];
+			slab_origin[p][j] = q[0][axis];
+			slab_edges[2*p][j] = q[1][axis] - q[0][axis];
+			slab_edges[2*p+1][j] = q[3][axis] - q[0][axis];
+		}
+	}
+
+	GLuint reset[2] = {0xFFFFFFFF, 0};
+	glNamedBufferSubData(contrast->buffer, 0, sizeof(reset), reset);
+	glClearNamedBufferSubData(contrast->buffer, GL_R32UI, 4 * sizeof(GLuint), HISTOGRAM_BINS * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+
+	glUseProgram(contrast->program);
+	glUniform3fv(contrast->uniform_origin, 3, &origin[0][0]);
+	glUniform3fv(contrast->uniform_edges, 6, &edges[0][0]);
+	glUniform2iv(contrast->uniform_samples, 3, &samples[0][0]);
+	glUniform1i(contrast->uniform_part, contrast->part);
+	if (slab != NULL && slab->mode != SLAB_OFF) {
+		set_slab_uniforms(slab, contrast->program);
+		glUniform2fv(contrast->uniform_slab_origin, 3, &slab_origin[0][0]);
+		glUniform2fv(contrast->uniform_slab_edges, 6, &slab_edges[0][0]);
+	}
+	else glUniform1i(contrast->uniform_slab_mode, SLAB_OFF);
+	if (contrast->mode == CONTRAST_PERCENTILES) glUniform2fv(contrast->uniform_percentiles, 1, contrast_percentiles);
+	else glUniform2f(contrast->uniform_percentiles, 0, 1);
+
+	int groups[2] = {(max_samples[0] + 15) / 16, (max_samples[1] + 15) / 16};
+	for (int pass = 0; pass < 3; pass++) {
+		if (pass == 1 && contrast->mode != CONTRAST_PERCENTILES) continue;
+		glUniform1i(contrast->uniform_pass, pass);
+		if (pass < 2) glDispatchCompute(groups[0], groups[1], 3);
+		else glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+	return;
+}
+
+
+
+void set_contrast_uniforms(struct contrast *contrast, GLuint program)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "auto_contrast"), contrast->mode != CONTRAST_MANUAL);
+	glUniform2fv(glGetUniformLocation(program, "window"), 1, contrast->window);
+	glUniform1i(glGetUniformLocation(program, "complex_part"), contrast->part);
+	return;
+}
+
+
+
+void setup_contrast_input(struct contrast_input *input)
+{
+	memset(input, 0, sizeof(struct contrast_input));
+	input->settings.mode = CONTRAST_MINMAX;
+	input->settings.colormap = COLORMAP_GREY;
+	return;
+}
+
+
+
+// A toggles between manual, min/max and percentile contrast, C cycles colormaps, M cycles the parts of complex values,
+// dragging with the middle button changes the level (vertical) and width (horizontal).
+// Returns true if the settings changed.
+bool handle_contrast_input(GLFWwindow *window, int width, int height, struct contrast_input *input)
+{
+	struct contrast_settings *settings = &input->settings;
+	char *previous = input->previous_keys;
+	double *previous_mouse = input->previous_mouse;
+	char keys[3] = {
+		key_down(window, GLFW_KEY_A),
+		key_down(window, GLFW_KEY_C),
+		key_down(window, GLFW_KEY_M)
+	};
+	bool changed = false;
+	if (keys[0] && !previous[0]) {
+		settings->mode = (settings->mode + 1) % NUM_CONTRAST_MODES;
+		changed = true;
+	}
+	if (keys[1] && !previous[1]) {
+		settings->colormap = (settings->colormap + 1) % NUM_COLORMAPS;
+		changed = true;
+	}
+	if (keys[2] && !previous[2]) {
+		settings->part = (settings->part + 1) % NUM_COMPLEX_PARTS;
+		changed = true;
+	}
+	for (int i = 0; i < 3; i++) previous[i] = keys[i];
+
+	double mouse[2];
+	glfwGetCursorPos(window, &mouse[0], &mouse[1]);
+	if (button_down(window, GLFW_MOUSE_BUTTON_MIDDLE)) {
+		if (settings->mode != CONTRAST_MANUAL) {
+			settings->mode = CONTRAST_MANUAL;
+			settings->drags++;
+			settings->level = 0;
+			settings->log_width = 0;
+		}
+		settings->level -= 2 * exp(settings->log_width) * (mouse[1] - previous_mouse[1]) / height;
+		settings->log_width += 2 * (mouse[0] - previous_mouse[0]) / width;
+		changed = true;
+	}
+	previous_mouse[0] = mouse[0];
+	previous_mouse[1] = mouse[1];
+	return changed;
+}
+
+
+
+// Returns true if the contrast changed
+bool apply_contrast_settings(struct contrast *contrast, const struct contrast_settings *settings)
+{
+	bool changed = settings->mode != contrast->mode;
+	if (settings->colormap != contrast->colormap) {
+		set_colormap(contrast, settings->colormap);
+		changed = true;
+	}
+	if (settings->part != contrast->part && contrast->complex) {
+		contrast->part = settings->part;
+		printf("Showing the %s\n", complex_part_names[(int)contrast->part]);
+		changed = true;
+	}
+	if (settings->drags != contrast->drags) {
+		// Continue from the automatic window, only time it is read back
+		glGetNamedBufferSubData(contrast->buffer, 2 * sizeof(GLuint), 2 * sizeof(float), contrast->base);
+		contrast->drags = settings->drags;
+	}
+	contrast->mode = settings->mode;
+	if (contrast->mode != CONTRAST_MANUAL) return changed;
+
+	float level = 0.5 * (contrast->base[0] + contrast->base[1]);
+	float half_width = 0.5 * (contrast->base[1] - contrast->base[0]);
+	if (half_width <= 0) half_width = 0.5;
+	level += half_width * settings->level;
+	half_width *= exp(settings->log_width);
+	float window[2] = {level - half_width, level + half_width};
+	if (memcmp(window, contrast->window, sizeof(window)) != 0) {
+		memcpy(contrast->window, window, sizeof(window));
+		changed = true;
+	}
+	return changed;
+}
+
+
+
+void delete_contrast(struct contrast *contrast)
+{
+	glDeleteProgram(contrast->program);
+	glDeleteShader(contrast->shaders[0]);
+	glDeleteBuffers(1, &contrast->buffer);
+	glDeleteTextures(1, &contrast->colormap_texture);
+	return;
+}
+
@@ -96,7 +96,7 @@ void update_view_slices(char plane, float tex_coords[3][4][3], float tex_centres
 
 
 
-void move_view(float rel_shift[2], char p, float plane[4][3], float centre[4], float centre_window[2]) {
+void move_view(float rel_shift[2], char p, float plane[4][3], float centre[2], float centre_window[4]) {
 	for (int a = 0; a < 2; a++) {
 		int axis = plane_axes[p][a];
 		float move = rel_shift[a] * (plane[2][axis] - plane[0][axis]);
@@ -113,3 +113,269 @@ void move_view(float rel_shift[2], char p, float plane[4][3], float centre[4], f
 	return;
 }
 
+
+
+// Texture coordinates where the slices cross
+void get_cursor(float planes[3][4][3], float cursor[3])
+{
+	cursor[0] = planes[2][0][0];
+	cursor[1] = planes[1][0][1];
+	cursor[2] = planes[0][0][2];
+	return;
+}
+
+
+
+// Moves the slices and crosses to the cursor, the zoom is kept
+void set_cursor(float cursor[3], float planes[3][4][3], float centres[3][2], float centres_window[3][4])
+{
+	for (int p = 0; p < 3; p++) {
+		for (int j = 0; j < 2; j++) centres[p][j] = cursor[plane_axes[p][j]];
+	}
+	update_view_slices(0, planes, centres);
+	update_view_slices(1, planes, centres);
+	for (int p = 0; p < 3; p++) tex2window(p, centres[p], centres_window[p], planes[p][0], planes[p][2]);
+	return;
+}
+
+
+
+// The planes are axis aligned in view coordinates q, which are mapped to texture coordinates
+// by origin + basis q in the plane shader, so the planes can be oblique while zooming, moving
+// and the crosses work as if they weren't. The basis is orthonormal, its columns are the axes of q.
+struct orientation {
+	float basis[3][3];
+	float origin[3];
+};
+
+
+
+void setup_orientation(struct orientation *o)
+{
+	memset(o, 0, sizeof(struct orientation));
+	for (int i = 0; i < 3; i++) o->basis[i][i] = 1;
+	return;
+}
+
+
+
+void orient(const struct orientation *o, const float q[3], float tex[3])
+{
+	for (int i = 0; i < 3; i++) {
+		tex[i] = o->origin[i];
+		for (int j = 0; j < 3; j++) tex[i] += o->basis[i][j] * q[j];
+	}
+	return;
+}
+
+
+
+void unorient(const struct orientation *o, const float tex[3], float q[3])
+{
+	for (int j = 0; j < 3; j++) {
+		q[j] = 0;
+		for (int i = 0; i < 3; i++) q[j] += o->basis[i][j] * (tex[i] - o->origin[i]);
+	}
+	return;
+}
+
+
+
+// Turns the other two planes around the normal of plane, the cursor stays where it is
+void rotate_view(float angle, char plane, float planes[3][4][3], struct orientation *o)
+{
+	float q[3], tex[3];
+	get_cursor(planes, q);
+	orient(o, q, tex);
+	int a = plane_axes[plane][0];
+	int b = plane_axes[plane][1];
+	float c = cos(angle), s = sin(angle);
+	for (int i = 0; i < 3; i++) {
+		float u = o->basis[i][a], v = o->basis[i][b];
+		o->basis[i][a] = c * u - s * v;
+		o->basis[i][b] = s * u + c * v;
+	}
+	// Gram-Schmidt, against rounding errors piling up
+	for (int j = 0; j < 3; j++) {
+		for (int k = 0; k < j; k++) {
+			float dot = 0;
+			for (int i = 0; i < 3; i++) dot += o->basis[i][j] * o->basis[i][k];
+			for (int i = 0; i < 3; i++) o->basis[i][j] -= dot * o->basis[i][k];
+		}
+		float norm = 0;
+		for (int i = 0; i < 3; i++) norm += o->basis[i][j] * o->basis[i][j];
+		for (int i = 0; i < 3; i++) o->basis[i][j] /= sqrt(norm);
+	}
+	for (int i = 0; i < 3; i++) {
+		o->origin[i] = tex[i];
+		for (int j = 0; j < 3; j++) o->origin[i] -= o->basis[i][j] * q[j];
+	}
+	return;
+}
+
+
+
+// Texture coordinates of the corners as drawn, stretched by the ratio like in the plane shader
+void displayed_corners(float planes[3][4][3], const struct orientation *o, float ratio, int ratio_axis, float corners[3][4][3])
+{
+	for (int p = 0; p < 3; p++) {
+		int axis = plane_axes[p][ratio_axis];
+		for (int c = 0; c < 4; c++) {
+			float q[3] = {planes[p][c][0], planes[p][c][1], planes[p][c][2]};
+			q[axis] = (q[axis] - 0.5) * ratio + 0.5;
+			orient(o, q, corners[p][c]);
+		}
+	}
+	return;
+}
+
+
+
+void set_orientation_uniforms(GLuint program, const struct orientation *o)
+{
+	glUseProgram(program);
+	glUniformMatrix3fv(glGetUniformLocation(program, "basis"), 1, GL_TRUE, &o->basis[0][0]);
+	glUniform3fv(glGetUniformLocation(program, "origin"), 1, o->origin);
+	return;
+}
+
+
+
+// Bits of planes and crosses which need to be redrawn
+#define DIRTY_PLANE(i) (1 << (i))
+#define DIRTY_CROSS(i) (1 << (3 + (i)))
+#define DIRTY_ALL 0x3F
+
+unsigned char find_dirty(float old_planes[3][4][3], float planes[3][4][3], float old_centres_window[3][4], float centres_window[3][4])
+{
+	unsigned char dirty = 0;
+	for (int i = 0; i < 3; i++) {
+		if (memcmp(old_planes[i], planes[i], sizeof(planes[i])) != 0) dirty |= DIRTY_PLANE(i);
+		if (memcmp(old_centres_window[i], centres_window[i], sizeof(centres_window[i])) != 0) dirty |= DIRTY_CROSS(i);
+	}
+	return dirty;
+}
+
+
+
+// Per plane state read by the plane shader, layout std430 as in VIEW_BUFFER_SOURCE (shaders.c)
+struct plane_state {
+	float corners[4][4]; // Texture coordinates, the fourth component is unused
+	float rect[4];       // Lower left and upper right corner in window coordinates
+	float centre[4];     // Cross, see centres_window
+	float ratio;
+	int axis;            // Texture coordinate stretched by ratio
+	float lod;
+	float padding;
+};
+
+// Each plane is drawn as two triangles followed by two thin quads for the cross,
+// vertices are generated in the shader from gl_VertexID
+#define PLANE_VERTICES 18
+
+// Persistently mapped, only the states of changed planes are written and flushed.
+// The fence of the last draw is waited on before writing, the GPU might still read the buffer.
+// The draw commands are mapped the same way, one per changed plane, instanced over the cells of grid windows (grid.c).
+struct draw_command {
+	GLuint count, instances, first, base_instance;
+};
+
+struct view_buffer {
+	GLuint buffer, vertex_array;
+	struct plane_state *planes;
+	GLuint commands_buffer;
+	struct draw_command *commands;
+	GLsync fence;
+};
+
+
+
+void setup_view_buffer(struct view_buffer *view)
+{
+	size_t bytes = 3 * sizeof(struct plane_state);
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT;
+	glGenBuffers(1, &view->buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, view->buffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, bytes, NULL, flags);
+	view->planes = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bytes, flags | GL_MAP_FLUSH_EXPLICIT_BIT);
+	memset(view->planes, 0, bytes);
+	for (int p = 0; p < 3; p++) {
+		const float *v = &three_planes_vertices[8 * p];
+		float rect[4] = {v[0], v[1], v[4], v[5]};
+		memcpy(view->planes[p].rect, rect, sizeof(rect));
+	}
+	glFlushMappedBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bytes);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, view->buffer);
+	view->fence = NULL;
+
+	bytes = 3 * sizeof(struct draw_command);
+	glGenBuffers(1, &view->commands_buffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, view->commands_buffer);
+	glBufferStorage(GL_DRAW_INDIRECT_BUFFER, bytes, NULL, flags);
+	view->commands = glMapBufferRange(GL_DRAW_INDIRECT_BUFFER, 0, bytes, flags | GL_MAP_FLUSH_EXPLICIT_BIT);
+
+	// Empty, but drawing requires one
+	glGenVertexArrays(1, &view->vertex_array);
+	return;
+}
+
+
+
+void update_view_buffer(
+	struct view_buffer *view, unsigned char dirty,
+	float planes[3][4][3], float centres_window[3][4], float lod[3],
+	float ratio, int ratio_axis
+) {
+	if (view->fence != NULL) {
+		while (glClientWaitSync(view->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(view->fence);
+		view->fence = NULL;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, view->buffer);
+	for (int p = 0; p < 3; p++) {
+		if (!(dirty & (DIRTY_PLANE(p) | DIRTY_CROSS(p)))) continue;
+		struct plane_state *state = &view->planes[p];
+		for (int c = 0; c < 4; c++) memcpy(state->corners[c], planes[p][c], sizeof(planes[p][c]));
+		memcpy(state->centre, centres_window[p], sizeof(centres_window[p]));
+		state->ratio = ratio;
+		state->axis = plane_axes[p][ratio_axis];
+		state->lod = lod[p];
+		glFlushMappedBufferRange(GL_SHADER_STORAGE_BUFFER, p * sizeof(struct plane_state), sizeof(struct plane_state));
+	}
+	return;
+}
+
+
+
+// One draw for all changed planes and their crosses in all cells, a plane covers the previous drawing of itself.
+// After update_view_buffer(), which waited for the last draw.
+void draw_view(struct view_buffer *view, unsigned char dirty, int ncells)
+{
+	int n = 0;
+	for (int p = 0; p < 3; p++) {
+		if (!(dirty & (DIRTY_PLANE(p) | DIRTY_CROSS(p)))) continue;
+		view->commands[n++] = (struct draw_command) { PLANE_VERTICES, ncells, p * PLANE_VERTICES, 0 };
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, view->commands_buffer);
+	glFlushMappedBufferRange(GL_DRAW_INDIRECT_BUFFER, 0, n * sizeof(struct draw_command));
+	glBindVertexArray(view->vertex_array);
+	glMultiDrawArraysIndirect(GL_TRIANGLES, NULL, n, 0);
+	view->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	return;
+}
+
+
+
+void delete_view_buffer(struct view_buffer *view)
+{
+	if (view->fence != NULL) glDeleteSync(view->fence);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, view->buffer);
+	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+	glDeleteBuffers(1, &view->buffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, view->commands_buffer);
+	glUnmapBuffer(GL_DRAW_INDIRECT_BUFFER);
+	glDeleteBuffers(1, &view->commands_buffer);
+	glDeleteVertexArrays(1, &view->vertex_array);
+	return;
+}
+
@@ -0,0 +1,151 @@
+// Grid windows (-g): volumes of the same size side by side in one window, e.g. reconstructions with different
+// regularisation, each cell showing the three planes of one volume. All cells share the planes, orientation and cursor,
+// so that they show the same voxels. The volumes are layers of one 2D array texture, slice z of cell c is layer
+// c * size_z + z, and one instanced draw (drawing.c) draws the changed planes of all cells. The array has no mip levels,
+// as those of 2D layers wouldn't reduce z like the levels of the volume texture, so cells are always sampled at level 0.
+// Contrast follows the first volume, so that all are shown in the same range. Slabs, bricks, slice-only mode and
+// regions of interest are not available in grid windows.
+
+bool grid_view = false; // -g, all volumes in the windows of the first
+
+
+
+// Columns and rows, as square as possible
+void grid_layout(int ncells, int grid[2])
+{
+	grid[0] = ceil(sqrt(ncells));
+	grid[1] = (ncells + grid[0] - 1) / grid[0];
+	return;
+}
+
+
+
+// Mouse in window coordinates to those of the cell under it, movements scaled to the cell
+void to_cell(const int grid[2], float mouse_window[2], float mouse_delta[2])
+{
+	for (int i = 0; i < 2; i++) {
+		float x = 0.5 * (mouse_window[i] + 1) * grid[i];
+		int cell = fmax(0, fmin(grid[i] - 1, floor(x)));
+		mouse_window[i] = 2 * (x - cell) - 1;
+		mouse_delta[i] *= grid[i];
+	}
+	return;
+}
+
+
+
+// Before any window opens
+void check_grid(struct viewer *cells[], int ncells)
+{
+	struct viewer *first = cells[0];
+	for (int c = 1; c < ncells; c++) {
+		if (
+			memcmp(cells[c]->size, first->size, sizeof(first->size)) != 0 ||
+			cells[c]->dtype != first->dtype || cells[c]->nframes != first->nframes
+		) {
+			printf("Error: volumes in a grid need the same size, data type and number of frames\n");
+			exit(1);
+		}
+	}
+	if (slice_only) {
+		printf("Error: grids can't be shown in slice-only mode\n");
+		exit(1);
+	}
+	size_t bytes = dtype_size[first->dtype] * first->size[0] * first->size[1] * (size_t)first->size[2] * ncells;
+	if (bytes > texture_budget) {
+		printf("Error: the grid needs %zu MiB on the GPU, more than the texture budget of %zu MiB\n", bytes >> 20, texture_budget >> 20);
+		exit(1);
+	}
+	return;
+}
+
+
+
+// Returns 0 if the grid is larger than array textures can be
+GLuint setup_grid_texture(struct viewer *cells[], int ncells)
+{
+	struct viewer *first = cells[0];
+	int *size = first->size;
+	int max_size, max_layers;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	if (size[0] > max_size || size[1] > max_size || (long)size[2] * ncells > max_layers) {
+		printf("Error: grids are limited to %d x %d voxels per slice and %d slices in all\n", max_size, max_size, max_layers);
+		return 0;
+	}
+	GLuint texture;
+	glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &texture);
+	glTextureStorage3D(texture, 1, texture_formats[first->dtype].internal_format, size[0], size[1], size[2] * ncells);
+	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	const float zeros[4] = {0.0, 0.0, 0.0, 0.0};
+	glTextureParameterfv(texture, GL_TEXTURE_BORDER_COLOR, zeros);
+	return texture;
+}
+
+
+
+// Box of a frame of the cell's volume into its layers
+void upload_grid_box(GLuint texture, int cell, struct viewer *viewer, int frame, const int lower[3], const int upper[3])
+{
+	load_box(viewer->chunks, frame, lower, upper);
+	int offset[3] = {lower[0], lower[1], cell * viewer->size[2] + lower[2]};
+	int extent[3];
+	for (int i = 0; i < 3; i++) extent[i] = upper[i] - lower[i];
+	ptrdiff_t *strides = viewer->strides;
+	const char *box = viewer->image + frame * strides[3] + lower[0] * strides[0] + lower[1] * strides[1] + lower[2] * strides[2];
+	glActiveTexture(GL_TEXTURE7);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	upload_box_as(GL_TEXTURE_2D_ARRAY, &texture_formats[viewer->dtype], 0, offset, extent, box, strides, viewer->dtype);
+	release_box(viewer->chunks, frame, lower, upper);
+	glActiveTexture(GL_TEXTURE0);
+	return;
+}
+
+
+
+// When the grid is set up, later frames come through the cine ring (cine.c)
+void upload_grid_frame(GLuint texture, struct viewer *cells[], int ncells, int frame)
+{
+	const int lower[3] = {0, 0, 0};
+	for (int c = 0; c < ncells; c++) upload_grid_box(texture, c, cells[c], frame, lower, cells[c]->size);
+	return;
+}
+
+
+
+// On the render thread, uploads what changed in the displayed frame of the cine, at once, and drops its prefetched frames
+// if anything changed. Returns true if anything was uploaded.
+bool update_grid(GLuint texture, struct viewer *cells[], int ncells, struct cine *cine, struct change changes[MAX_CHANGES])
+{
+	bool changed = false, reload = false;
+	for (int c = 0; c < ncells; c++) {
+		struct viewer *viewer = cells[c];
+		struct change everything = { -1, {0, 0, 0}, {viewer->size[0], viewer->size[1], viewer->size[2]} };
+		int n = take_changes(viewer, changes);
+		if (n == -1) {
+			changes[0] = everything;
+			n = 1;
+		}
+		reload |= n > 0;
+		for (int i = 0; i < n; i++) {
+			if (changes[i].frame != -1 && changes[i].frame != cine->frame) continue;
+			upload_grid_box(texture, c, viewer, cine->frame, changes[i].lower, changes[i].upper);
+			changed = true;
+		}
+	}
+	if (reload) reload_cine(cine);
+	return changed;
+}
+
+
+
+void set_grid_uniforms(GLuint program, const int grid[2], int ncells)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "gridded"), ncells > 1);
+	glUniform2iv(glGetUniformLocation(program, "grid"), 1, grid);
+	return;
+}
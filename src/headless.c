@@ -0,0 +1,292 @@
+#include <time.h>
+#include <errno.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// Headless export: views listed in a file are rendered offscreen and written as images,
+// without a display, e.g. on compute nodes.
+// The context is created with EGL on Mesa's surfaceless platform, falling back to the default display,
+// and if neither works, to Mesa's software rasteriser (llvmpipe).
+// Views use the same functions as the mouse and keys, so that images match what the window shows.
+
+struct headless {
+	EGLDisplay display;
+	EGLContext context;
+};
+
+struct export_view {
+	float cursor[3]; // Voxel
+	float zoom;      // Fraction of the volume shown in each plane
+};
+
+
+
+bool try_headless_context(struct headless *headless)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	headless->display = EGL_NO_DISPLAY;
+	if (get_platform_display != NULL) headless->display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (headless->display == EGL_NO_DISPLAY) headless->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (headless->display == EGL_NO_DISPLAY || !eglInitialize(headless->display, NULL, NULL)) return false;
+
+	// Nothing is drawn to a surface, but some drivers only have configs for pbuffers
+	const EGLint config_attributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+	const EGLint context_attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 5,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint nconfigs;
+	if (!eglChooseConfig(headless->display, config_attributes, &config, 1, &nconfigs) || nconfigs == 0) {
+		config = EGL_NO_CONFIG_KHR;
+	}
+	headless->context = EGL_NO_CONTEXT;
+	if (eglBindAPI(EGL_OPENGL_API)) {
+		headless->context = eglCreateContext(headless->display, config, EGL_NO_CONTEXT, context_attributes);
+	}
+	if (
+		headless->context == EGL_NO_CONTEXT ||
+		!eglMakeCurrent(headless->display, EGL_NO_SURFACE, EGL_NO_SURFACE, headless->context)
+	) {
+		eglTerminate(headless->display);
+		return false;
+	}
+	return true;
+}
+
+
+
+void open_headless_context(struct headless *headless)
+{
+	if (!try_headless_context(headless)) {
+		setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+		if (!try_headless_context(headless)) {
+			printf("Error: could not create an OpenGL 4.5 context without a display\n");
+			exit(1);
+		}
+	}
+	gladLoadGLLoader((GLADloadproc)eglGetProcAddress);
+	printf("Rendering with %s\n", glGetString(GL_RENDERER));
+	return;
+}
+
+
+
+void close_headless_context(struct headless *headless)
+{
+	eglMakeCurrent(headless->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(headless->display, headless->context);
+	eglTerminate(headless->display);
+	return;
+}
+
+
+
+// One view per line: cursor x y z in voxels and optionally the zoom, lines starting with # are skipped
+int read_views(const char *path, struct export_view **views)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		printf("Error: could not open %s\n", path);
+		exit(1);
+	}
+	int n = 0, capacity = 64;
+	*views = malloc(sizeof(struct export_view) * capacity);
+	char line[256];
+	int line_number = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		line_number++;
+		char *c = line;
+		while (*c == ' ' || *c == '\t') c++;
+		if (*c == '#' || *c == '\n' || *c == '\0') continue;
+		struct export_view view = { .zoom = 1 };
+		if (sscanf(c, "%f %f %f %f", &view.cursor[0], &view.cursor[1], &view.cursor[2], &view.zoom) < 3) {
+			printf("Error: need x y z [zoom] in line %d of %s\n", line_number, path);
+			exit(1);
+		}
+		view.zoom = fmax(1e-3, fmin(1, view.zoom));
+		if (n == capacity) {
+			capacity *= 2;
+			*views = realloc(*views, sizeof(struct export_view) * capacity);
+		}
+		(*views)[n++] = view;
+	}
+	fclose(file);
+	return n;
+}
+
+
+
+// Expects the planes in their initial state (coordinates.c)
+void set_view(struct export_view *view, int size[3], float planes[3][4][3], float centres[3][2], float centres_window[3][4])
+{
+	float tex[3];
+	for (int i = 0; i < 3; i++) tex[i] = fmax(0, fmin(1, (view->cursor[i] + 0.5) / size[i]));
+	set_cursor(tex, planes, centres, centres_window);
+	for (int p = 0; p < 3; p++) update_zoom(view->zoom, p, planes, centres, centres_window, centres[p]);
+	return;
+}
+
+
+
+double seconds()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+
+
+// Everything needed to draw the planes without a window, the volume is fully uploaded
+struct offscreen {
+	int *size;
+	int width, height;
+	int ratio_axis;
+	float ratio;
+	GLuint program, shaders[2];
+	struct view_buffer view;
+	bool bricked;
+	struct brick_cache bricks;
+	GLuint texture;
+	struct contrast contrast;
+	struct framebuffer framebuffer;
+};
+
+
+
+void setup_offscreen(struct offscreen *offscreen, void *image, int dtype, int size[3], const ptrdiff_t strides[3], int width, int height)
+{
+	offscreen->size = size;
+	offscreen->width = width;
+	offscreen->height = height;
+	glViewport(0, 0, width, height);
+	get_ratio(width, height, &offscreen->ratio, &offscreen->ratio_axis);
+
+	setup_plane_shaders(&offscreen->program, offscreen->shaders);
+	glUseProgram(offscreen->program);
+	glUniform2f(glGetUniformLocation(offscreen->program, "pixel"), 2.0 / width, 2.0 / height);
+	setup_view_buffer(&offscreen->view);
+	struct orientation orientation;
+	setup_orientation(&orientation);
+	set_orientation_uniforms(offscreen->program, &orientation);
+	const int grid[2] = {1, 1};
+	set_grid_uniforms(offscreen->program, grid, 1);
+
+	offscreen->bricked = needs_bricks(dtype, size, texture_budget);
+	if (offscreen->bricked) setup_brick_cache(&offscreen->bricks, image, dtype, size, strides, texture_budget, NULL);
+	else {
+		struct mip_builder mipmaps;
+		start_mipmaps(&mipmaps, image, strides, dtype, size);
+		offscreen->texture = setup_texture(image, dtype, size, strides, mipmaps.layout.levels);
+		upload_mipmaps(&mipmaps, offscreen->texture);
+		delete_mip_builder(&mipmaps);
+	}
+	set_volume_uniforms(offscreen->program, offscreen->bricked, dtype, size);
+	setup_contrast(&offscreen->contrast, offscreen->bricked, dtype, size);
+	setup_framebuffer(&offscreen->framebuffer, width, height);
+	return;
+}
+
+
+
+// Leaves the framebuffer bound
+void render_offscreen(struct offscreen *offscreen, float planes[3][4][3], float centres_window[3][4])
+{
+	// Axis aligned
+	struct orientation orientation;
+	setup_orientation(&orientation);
+	float corners[3][4][3], cursor[3];
+	displayed_corners(planes, &orientation, offscreen->ratio, offscreen->ratio_axis, corners);
+	get_cursor(planes, cursor);
+	if (offscreen->bricked) {
+		update_bricks(&offscreen->bricks, corners, cursor, 0);
+		while (upload_bricks(&offscreen->bricks, max_brick_uploads) > 0);
+	}
+	update_contrast(&offscreen->contrast, corners, offscreen->size, NULL);
+	set_contrast_uniforms(&offscreen->contrast, offscreen->program);
+
+	float lod[3];
+	for (int p = 0; p < 3; p++) lod[p] = plane_lod(corners[p], offscreen->size, offscreen->width, offscreen->height);
+	update_view_buffer(&offscreen->view, DIRTY_ALL, planes, centres_window, lod, offscreen->ratio, offscreen->ratio_axis);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, offscreen->framebuffer.id);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glUseProgram(offscreen->program);
+	draw_view(&offscreen->view, DIRTY_ALL, 1);
+	return;
+}
+
+
+
+void delete_offscreen(struct offscreen *offscreen)
+{
+	delete_framebuffer(&offscreen->framebuffer);
+	delete_view_buffer(&offscreen->view);
+	delete_contrast(&offscreen->contrast);
+	if (offscreen->bricked) delete_brick_cache(&offscreen->bricks);
+	else glDeleteTextures(1, &offscreen->texture);
+	glDeleteProgram(offscreen->program);
+	for (int i = 0; i < 2; i++) glDeleteShader(offscreen->shaders[i]);
+	return;
+}
+
+
+
+// Renders the three planes of every view into one image, images are written in parallel by the image writer
+void export_views(void *image, int dtype, int size[3], const ptrdiff_t strides[3], const char *views_path, const char *directory, int width, int height)
+{
+	struct export_view *views;
+	int nviews = read_views(views_path, &views);
+	if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+		printf("Error: could not create directory %s\n", directory);
+		exit(1);
+	}
+
+	struct headless headless;
+	open_headless_context(&headless);
+	setup_gl_state();
+	struct offscreen offscreen;
+	setup_offscreen(&offscreen, image, dtype, size, strides, width, height);
+
+	#include "coordinates.c"
+	float initial_planes[3][4][3], initial_centres[3][2], initial_centres_window[3][4];
+	memcpy(initial_planes, planes, sizeof(planes));
+	memcpy(initial_centres, centres, sizeof(centres));
+	memcpy(initial_centres_window, centres_window, sizeof(centres_window));
+
+	struct image_writer writer;
+	setup_image_writer(&writer);
+
+	double start = seconds();
+	for (int v = 0; v < nviews; v++) {
+		memcpy(planes, initial_planes, sizeof(planes));
+		memcpy(centres, initial_centres, sizeof(centres));
+		memcpy(centres_window, initial_centres_window, sizeof(centres_window));
+		set_view(&views[v], size, planes, centres, centres_window);
+
+		render_offscreen(&offscreen, planes, centres_window);
+		unsigned char *pixels = malloc((size_t)3 * width * height);
+		glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/view_%05d.png", directory, v);
+		queue_image(&writer, path, pixels, width, height);
+	}
+	delete_image_writer(&writer);
+	double elapsed = seconds() - start;
+	printf(
+		"Exported %lu images in %.2f s (%.1f images/s)\n",
+		writer.written, elapsed, writer.written / fmax(elapsed, 1e-9)
+	);
+
+	delete_offscreen(&offscreen);
+	close_headless_context(&headless);
+	free(views);
+	if (writer.failed > 0) exit(1);
+	return;
+}
+
@@ -0,0 +1,165 @@
+#include <pthread.h>
+#include <png.h>
+
+// Images are compressed and written by a pool of threads, so that rendering doesn't wait for the disk.
+// The queue takes ownership of the pixels, queue_image() blocks while it is full, try_queue_image() doesn't.
+// Images without a path are raw frames of a video file, written at their offset so that the order of writing doesn't matter.
+#ifndef IMAGE_QUEUE_SIZE
+	#define IMAGE_QUEUE_SIZE 16
+#endif
+
+struct image {
+	char *path;
+	unsigned char *pixels; // RGB, bottom row first as read from GL
+	int width, height;
+	int fd; // Of a raw video if path is NULL
+	off_t offset;
+};
+
+struct image_writer {
+	struct image queue[IMAGE_QUEUE_SIZE];
+	int head, count;
+	bool quit;
+	int nthreads;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long written, failed;
+};
+
+
+
+bool write_png(const char *path, const unsigned char *pixels, int width, int height)
+{
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) return false;
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info = png_create_info_struct(png);
+	if (png == NULL || info == NULL || setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, &info);
+		fclose(file);
+		return false;
+	}
+	png_init_io(png, file);
+	png_set_IHDR(
+		png, info, width, height, 8, PNG_COLOR_TYPE_RGB,
+		PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT
+	);
+	png_set_compression_level(png, 1); // Speed matters more than size
+	png_write_info(png, info);
+	for (int y = height - 1; y >= 0; y--) png_write_row(png, pixels + (size_t)3 * width * y);
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+	return fclose(file) == 0;
+}
+
+
+
+// Top row first, e.g. for ffmpeg -f rawvideo -pix_fmt rgb24
+bool write_raw_frame(int fd, off_t offset, const unsigned char *pixels, int width, int height)
+{
+	size_t row = (size_t)3 * width;
+	for (int y = 0; y < height; y++) {
+		if (pwrite(fd, pixels + row * (height - 1 - y), row, offset + row * y) != (ssize_t)row) return false;
+	}
+	return true;
+}
+
+
+
+void* image_writer_thread(void *arg)
+{
+	struct image_writer *writer = arg;
+	pthread_mutex_lock(&writer->lock);
+	while (true) {
+		if (writer->count == 0) {
+			if (writer->quit) break;
+			pthread_cond_wait(&writer->cond, &writer->lock);
+			continue;
+		}
+		struct image image = writer->queue[writer->head];
+		writer->head = (writer->head + 1) % IMAGE_QUEUE_SIZE;
+		writer->count--;
+		pthread_cond_broadcast(&writer->cond);
+		pthread_mutex_unlock(&writer->lock);
+
+		bool ok;
+		if (image.path != NULL) ok = write_png(image.path, image.pixels, image.width, image.height);
+		else ok = write_raw_frame(image.fd, image.offset, image.pixels, image.width, image.height);
+		if (!ok) printf("Error: could not write %s\n", image.path != NULL ? image.path : "a frame of the video");
+		free(image.path);
+		free(image.pixels);
+
+		pthread_mutex_lock(&writer->lock);
+		if (ok) writer->written++;
+		else writer->failed++;
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return NULL;
+}
+
+
+
+void setup_image_writer(struct image_writer *writer)
+{
+	memset(writer, 0, sizeof(struct image_writer));
+	writer->nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (writer->nthreads < 1) writer->nthreads = 1;
+	writer->threads = malloc(sizeof(pthread_t) * writer->nthreads);
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->cond, NULL);
+	for (int t = 0; t < writer->nthreads; t++) pthread_create(&writer->threads[t], NULL, image_writer_thread, writer);
+	return;
+}
+
+
+
+// Needs the lock and room in the queue
+void push_image(struct image_writer *writer, struct image image)
+{
+	int i = (writer->head + writer->count) % IMAGE_QUEUE_SIZE;
+	writer->queue[i] = image;
+	writer->count++;
+	pthread_cond_broadcast(&writer->cond);
+	return;
+}
+
+
+
+void queue_image(struct image_writer *writer, const char *path, unsigned char *pixels, int width, int height)
+{
+	pthread_mutex_lock(&writer->lock);
+	while (writer->count == IMAGE_QUEUE_SIZE) pthread_cond_wait(&writer->cond, &writer->lock);
+	push_image(writer, (struct image) {strdup(path), pixels, width, height, -1, 0});
+	pthread_mutex_unlock(&writer->lock);
+	return;
+}
+
+
+
+// Path can be NULL for a raw frame of fd at offset. Returns false if the queue is full, then the caller keeps the pixels.
+bool try_queue_image(struct image_writer *writer, const char *path, unsigned char *pixels, int width, int height, int fd, off_t offset)
+{
+	pthread_mutex_lock(&writer->lock);
+	bool room = writer->count < IMAGE_QUEUE_SIZE;
+	if (room) push_image(writer, (struct image) {path != NULL ? strdup(path) : NULL, pixels, width, height, fd, offset});
+	pthread_mutex_unlock(&writer->lock);
+	return room;
+}
+
+
+
+// Waits until all queued images are written
+void delete_image_writer(struct image_writer *writer)
+{
+	pthread_mutex_lock(&writer->lock);
+	writer->quit = true;
+	pthread_cond_broadcast(&writer->cond);
+	pthread_mutex_unlock(&writer->lock);
+	for (int t = 0; t < writer->nthreads; t++) pthread_join(writer->threads[t], NULL);
+	free(writer->threads);
+	pthread_mutex_destroy(&writer->lock);
+	pthread_cond_destroy(&writer->cond);
+	return;
+}
+
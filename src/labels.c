@@ -0,0 +1,197 @@
+// Label map of a segmentation drawn over the image, e.g. organs or regions of interest from another tool.
+// The map has the image's size and is uploaded whole as an integer texture next to the image (units 5 and 6),
+// changes reported by the caller or found by watch.c are uploaded again as boxes.
+// Colours come from a palette texture with one colour per label, label 0 is transparent.
+enum label_mode { LABELS_OFF, LABELS_FILLED, LABELS_OUTLINED, NUM_LABEL_MODES };
+
+// Labels are unsigned on the GPU, int16 labels are reinterpreted
+const struct texture_format label_formats[NUM_DTYPES] = {
+	[DTYPE_UINT8]  = {GL_R8UI,  GL_RED_INTEGER, GL_UNSIGNED_BYTE,  1.0},
+	[DTYPE_INT16]  = {GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT, 1.0},
+	[DTYPE_UINT16] = {GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT, 1.0},
+};
+
+struct labels {
+	GLuint texture;          // 0 if the viewer has no label map
+	GLuint palette;          // 256 labels per row, one row for 1 byte labels, 256 rows for 2 bytes
+	unsigned int generation; // Of the viewer's label map which is uploaded
+	struct change changes[MAX_CHANGES];
+};
+
+unsigned char (*label_palette)[4] = NULL; // Read with -P, otherwise colours are spread over the hues
+
+
+
+bool is_label_dtype(int dtype)
+{
+	return dtype == DTYPE_UINT8 || dtype == DTYPE_INT16 || dtype == DTYPE_UINT16;
+}
+
+
+
+// Hues of consecutive labels are apart by the golden ratio, so neighbours differ. Filled at half opacity.
+void default_label_palette()
+{
+	label_palette = calloc(65536, 4);
+	for (int l = 1; l < 65536; l++) {
+		float hue = fmod(l * 0.618033988749895, 1.0);
+		for (int i = 0; i < 3; i++) {
+			// Saturation 0.7, value 1
+			float k = fmod(6 * hue + (float[3]){5, 3, 1}[i], 6);
+			label_palette[l][i] = 255 * (1 - 0.7 * fmax(0, fmin(1, fmin(k, 4 - k))));
+		}
+		label_palette[l][3] = 128;
+	}
+	return;
+}
+
+
+
+// Lines "label r g b [alpha [visible]]" as in ITK-SNAP's label descriptions, colours 0 to 255 and alpha 0 to 1.
+// Labels not listed keep their default colour, invisible ones are not drawn.
+void load_label_palette(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		printf("Error: could not open %s\n", path);
+		exit(1);
+	}
+	default_label_palette();
+	char line[1024];
+	int number = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		number++;
+		char *c = line;
+		while (*c == ' ' || *c == '\t') c++;
+		if (*c == '#' || *c == '\n' || *c == '\r' || *c == '\0') continue;
+		long label;
+		int r, g, b, visible = 1;
+		float alpha = 0.5;
+		int n = sscanf(c, "%ld %d %d %d %f %d", &label, &r, &g, &b, &alpha, &visible);
+		if (n < 4 || label < 0 || label > 65535) {
+			printf("Error: line %d of %s is not \"label r g b [alpha [visible]]\"\n", number, path);
+			exit(1);
+		}
+		int rgba[4] = {r, g, b, visible == 0 ? 0 : 255 * alpha};
+		for (int i = 0; i < 4; i++) label_palette[label][i] = fmax(0, fmin(255, rgba[i]));
+	}
+	fclose(file);
+	return;
+}
+
+
+
+// On the render thread, from label_palette
+void setup_label_palette(struct labels *labels, int dtype)
+{
+	int rows = dtype_size[dtype] == 1 ? 1 : 256;
+	if (label_palette == NULL) default_label_palette();
+	glCreateTextures(GL_TEXTURE_2D, 1, &labels->palette);
+	glTextureStorage2D(labels->palette, 1, GL_RGBA8, 256, rows);
+	glTextureParameteri(labels->palette, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTextureParameteri(labels->palette, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTextureSubImage2D(labels->palette, 0, 0, 0, 256, rows, GL_RGBA, GL_UNSIGNED_BYTE, label_palette);
+	return;
+}
+
+
+
+void delete_labels(struct labels *labels)
+{
+	glDeleteTextures(1, &labels->texture);
+	glDeleteTextures(1, &labels->palette);
+	labels->texture = 0;
+	labels->palette = 0;
+	return;
+}
+
+
+
+// Boxes of the label map into its texture, bound to unit 5
+void upload_label_boxes(const struct change changes[], int n, const char *image, int dtype, const ptrdiff_t strides[3])
+{
+	glActiveTexture(GL_TEXTURE5);
+	for (int c = 0; c < n; c++) {
+		const int *lower = changes[c].lower;
+		int extent[3];
+		for (int i = 0; i < 3; i++) extent[i] = changes[c].upper[i] - lower[i];
+		const char *box = image + lower[0] * strides[0] + lower[1] * strides[1] + lower[2] * strides[2];
+		upload_box_as(GL_TEXTURE_3D, &label_formats[dtype], 0, lower, extent, box, strides, dtype);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	return;
+}
+
+
+
+// On the render thread, takes the viewer's label map or its changes, a map larger than textures can be isn't shown.
+// Returns true if the windows need to be redrawn, expects a context to be current.
+bool update_labels(struct labels *labels, struct viewer *viewer)
+{
+	pthread_mutex_lock(&viewer->lock);
+	char *image = viewer->labels;
+	int dtype = viewer->label_dtype;
+	ptrdiff_t strides[3] = {viewer->label_strides[0], viewer->label_strides[1], viewer->label_strides[2]};
+	unsigned int generation = viewer->label_generation;
+	pthread_mutex_unlock(&viewer->lock);
+	int n = take_label_changes(viewer, labels->changes);
+	struct change everything = { -1, {0, 0, 0}, {viewer->size[0], viewer->size[1], viewer->size[2]} };
+
+	if (generation != labels->generation) {
+		labels->generation = generation;
+		delete_labels(labels);
+		if (image == NULL) return true;
+		int max_size;
+		glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+		if (viewer->size[0] > max_size || viewer->size[1] > max_size || viewer->size[2] > max_size) {
+			printf("Error: label maps are limited to %d voxels per axis\n", max_size);
+			return true;
+		}
+		glCreateTextures(GL_TEXTURE_3D, 1, &labels->texture);
+		glTextureStorage3D(labels->texture, 1, label_formats[dtype].internal_format, viewer->size[0], viewer->size[1], viewer->size[2]);
+		glTextureParameteri(labels->texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTextureParameteri(labels->texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		setup_label_palette(labels, dtype);
+		n = 1;
+		labels->changes[0] = everything;
+	}
+	else if (image == NULL || n == 0) return false;
+	else if (n == -1) {
+		n = 1;
+		labels->changes[0] = everything;
+	}
+	glBindTextureUnit(5, labels->texture);
+	upload_label_boxes(labels->changes, n, image, dtype, strides);
+	return true;
+}
+
+
+
+// In the current context, before the labels are sampled
+void bind_labels(struct labels *labels)
+{
+	glBindTextureUnit(5, labels->texture);
+	glBindTextureUnit(6, labels->palette);
+	return;
+}
+
+
+
+void set_label_uniforms(struct labels *labels, GLuint program, int mode)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "has_labels"), labels->texture != 0);
+	glUniform1i(glGetUniformLocation(program, "label_mode"), mode);
+	return;
+}
+
+
+
+// L on the input thread cycles through filled, outlined and off, previous is the key's state
+void handle_label_keys(GLFWwindow *window, char *mode, bool *previous)
+{
+	bool state = key_down(window, GLFW_KEY_L);
+	if (state && !*previous) *mode = (*mode + 1) % NUM_LABEL_MODES;
+	*previous = state;
+	return;
+}
@@ -0,0 +1,166 @@
+// Shared library for host processes, see include/poirot.h (make lib/libpoirot.so).
+// The event loop's thread owns GLFW and its render thread the GL contexts, the caller's thread only touches the viewer's change queue.
+#define POIROT_NO_MAIN
+#include "poirot.c"
+#include "../include/poirot.h"
+
+struct poirot_viewer {
+	struct viewer viewer; // Its started tells whether GLFW and the first window could be set up
+	struct watch watch;
+	bool watching;
+};
+
+// GLFW is global, so all viewers of the host process share one event loop on one thread,
+// which ends when all windows are closed and is started again by the next poirot_open()
+struct viewer_list poirot_viewers = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+pthread_t poirot_loop;
+bool poirot_loop_started = false; // Until joined, with the list's lock
+
+
+
+void* poirot_thread(void *arg)
+{
+	glfwSetErrorCallback(error_callback);
+	if (!glfwInit()) {
+		printf("Error: could not initialise GLFW\n");
+		pthread_mutex_lock(&poirot_viewers.lock);
+		stop_viewer_list(&poirot_viewers);
+		pthread_mutex_unlock(&poirot_viewers.lock);
+		return NULL;
+	}
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+	// Failures of a first window are reported to poirot_open() by poirot(), instead of exiting the host process
+	poirot(&poirot_viewers, window_width, window_height);
+	poirot_done();
+	return NULL;
+}
+
+
+
+poirot_viewer* poirot_open(const void *data, int dtype, const int size[3], const ptrdiff_t strides[4], int nframes)
+{
+	if (data == NULL || dtype < 0 || dtype >= NUM_DTYPES || nframes < 1) return NULL;
+	for (int i = 0; i < 3; i++) if (size[i] < 1) return NULL;
+
+	struct poirot_viewer *p = malloc(sizeof(struct poirot_viewer));
+	setup_viewer(&p->viewer, (void *)data, dtype, size, strides, nframes);
+	p->watching = false;
+	pthread_mutex_lock(&poirot_viewers.lock);
+	if (list_viewer(&poirot_viewers, &p->viewer) < 0) {
+		pthread_mutex_unlock(&poirot_viewers.lock);
+		printf("Error: can't open more than %d viewers\n", MAX_VIEWERS);
+		delete_viewer(&p->viewer);
+		free(p);
+		return NULL;
+	}
+	if (!poirot_viewers.running) {
+		// The last event loop has ended or is ending, its thread doesn't need the lock anymore
+		if (poirot_loop_started) pthread_join(poirot_loop, NULL);
+		poirot_viewers.running = true;
+		pthread_create(&poirot_loop, NULL, poirot_thread, NULL);
+		poirot_loop_started = true;
+	}
+	pthread_mutex_unlock(&poirot_viewers.lock);
+
+	// Until the window is open and the array on the GPU
+	if (!wait_viewer_started(&p->viewer)) {
+		poirot_close(p);
+		return NULL;
+	}
+	return p;
+}
+
+
+
+void poirot_changed(poirot_viewer *p, int frame, const int lower[3], const int upper[3])
+{
+	report_change(&p->viewer, frame, lower, upper);
+	return;
+}
+
+
+
+int poirot_watch(poirot_viewer *p, double interval)
+{
+	if (p->watching) return 1;
+	if (interval <= 0) return 0;
+	p->watching = start_watch(&p->watch, &p->viewer, NULL, interval, false);
+	return p->watching;
+}
+
+
+
+void poirot_labels(poirot_viewer *p, const void *labels, int dtype, const ptrdiff_t strides[3])
+{
+	if (labels != NULL && !is_label_dtype(dtype)) {
+		printf("Error: label maps need uint8, int16 or uint16 voxels\n");
+		return;
+	}
+	set_viewer_labels(&p->viewer, (void *)labels, dtype, strides);
+	return;
+}
+
+
+
+void poirot_labels_changed(poirot_viewer *p, const int lower[3], const int upper[3])
+{
+	report_label_change(&p->viewer, lower, upper);
+	return;
+}
+
+
+
+void poirot_add_window(poirot_viewer *p, int linked)
+{
+	add_windows(&p->viewer, 1, linked);
+	return;
+}
+
+
+
+int poirot_is_open(poirot_viewer *p)
+{
+	pthread_mutex_lock(&p->viewer.lock);
+	bool open = p->viewer.nwindows > 0;
+	pthread_mutex_unlock(&p->viewer.lock);
+	return open;
+}
+
+
+
+void poirot_close(poirot_viewer *p)
+{
+	struct viewer_list *list = &poirot_viewers;
+	pthread_mutex_lock(&list->lock);
+	pthread_mutex_lock(&p->viewer.lock);
+	p->viewer.quit = true;
+	wake_viewer(&p->viewer);
+	pthread_mutex_unlock(&p->viewer.lock);
+
+	// The event loop closes its windows and unlists it, unless the loop has ended
+	while (list->running && viewer_slot(list, &p->viewer) >= 0) pthread_cond_wait(&list->cond, &list->lock);
+	int slot = viewer_slot(list, &p->viewer);
+	if (slot >= 0) list->viewers[slot] = NULL;
+	// The last viewer joins the thread once the event loop has ended, unless another viewer was opened meanwhile
+	while (true) {
+		bool last = true;
+		for (int v = 0; v < MAX_VIEWERS; v++) last &= list->viewers[v] == NULL;
+		if (!last) break;
+		if (list->running) {
+			pthread_cond_wait(&list->cond, &list->lock);
+			continue;
+		}
+		if (poirot_loop_started) pthread_join(poirot_loop, NULL);
+		poirot_loop_started = false;
+		break;
+	}
+	pthread_mutex_unlock(&list->lock);
+
+	if (p->watching) stop_watch(&p->watch);
+	delete_viewer(&p->viewer);
+	free(p);
+	return;
+}
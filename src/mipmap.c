@@ -0,0 +1,372 @@
+#include <stdint.h>
+#include <pthread.h>
+
+// Mip levels are built on the CPU because glGenerateMipmap is slow or unsupported for some formats.
+// Each level is the 2x2x2 box average of the previous one, computed in parallel over slabs of z.
+// Level 0 is the image itself, which may be strided, the other levels are stored one after the other in the pyramid.
+#define MAX_MIP_LEVELS 16
+
+struct mip_layout {
+	int levels;
+	int size[MAX_MIP_LEVELS][3];
+	size_t offset[MAX_MIP_LEVELS]; // In the pyramid, offset[0] is unused
+	size_t bytes;                  // Of the pyramid
+};
+
+struct mip_builder {
+	int dtype;
+	struct mip_layout layout;
+	const char *image;
+	ptrdiff_t strides[3]; // Of the image
+	char *pyramid;
+	int done; // Levels finished, including level 0
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+};
+
+struct mip_slab {
+	int dtype;
+	const char *in;
+	const ptrdiff_t *in_strides;
+	int *in_size;
+	char *out;
+	int *out_size;
+	int z_begin, z_end;
+};
+
+
+
+void setup_mip_layout(struct mip_layout *layout, int dtype, int size[3])
+{
+	layout->levels = 1;
+	layout->bytes = 0;
+	for (int i = 0; i < 3; i++) layout->size[0][i] = size[i];
+	while (
+		layout->levels < MAX_MIP_LEVELS &&
+		(layout->size[layout->levels-1][0] > 1 || layout->size[layout->levels-1][1] > 1 || layout->size[layout->levels-1][2] > 1)
+	) {
+		int l = layout->levels;
+		for (int i = 0; i < 3; i++) layout->size[l][i] = fmax(1, layout->size[l-1][i] / 2);
+		layout->offset[l] = layout->bytes;
+		layout->bytes += dtype_size[dtype] * layout->size[l][0] * layout->size[l][1] * layout->size[l][2];
+		layout->levels++;
+	}
+	return;
+}
+
+
+
+void load_strided_row(int dtype, const char *in, ptrdiff_t stride, float *restrict out, int n)
+{
+	switch (dtype) {
+		case DTYPE_UINT8:
+			for (int i = 0; i < n; i++) out[i] = *(const uint8_t *)(in + i * stride);
+			break;
+		case DTYPE_INT16:
+			for (int i = 0; i < n; i++) out[i] = *(const int16_t *)(in + i * stride);
+			break;
+		case DTYPE_UINT16:
+			for (int i = 0; i < n; i++) out[i] = *(const uint16_t *)(in + i * stride);
+			break;
+		case DTYPE_FLOAT16:
+			for (int i = 0; i < n; i++) out[i] = *(const _Float16 *)(in + i * stride);
+			break;
+		case DTYPE_FLOAT32:
+			for (int i = 0; i < n; i++) out[i] = *(const float *)(in + i * stride);
+			break;
+		case DTYPE_COMPLEX64:
+			for (int i = 0; i < n; i++) memcpy(out + 2 * i, in + i * stride, 2 * sizeof(float));
+			break;
+	}
+	return;
+}
+
+
+
+void load_row(int dtype, const char *in, ptrdiff_t stride, float *restrict out, int n)
+{
+	if (stride != (ptrdiff_t)dtype_size[dtype]) {
+		load_strided_row(dtype, in, stride, out, n);
+		return;
+	}
+	switch (dtype) {
+		case DTYPE_UINT8:
+			for (int i = 0; i < n; i++) out[i] = ((const uint8_t *)in)[i];
+			break;
+		case DTYPE_INT16:
+			for (int i = 0; i < n; i++) out[i] = ((const int16_t *)in)[i];
+			break;
+		case DTYPE_UINT16:
+			for (int i = 0; i < n; i++) out[i] = ((const uint16_t *)in)[i];
+			break;
+		case DTYPE_FLOAT16:
+			for (int i = 0; i < n; i++) out[i] = ((const _Float16 *)in)[i];
+			break;
+		case DTYPE_FLOAT32:
+		case DTYPE_COMPLEX64:
+			memcpy(out, in, dtype_size[dtype] * n);
+			break;
+	}
+	return;
+}
+
+
+
+void store_row(int dtype, const float *restrict in, char *out, int n)
+{
+	switch (dtype) {
+		case DTYPE_UINT8:
+			for (int i = 0; i < n; i++) ((uint8_t *)out)[i] = in[i] + 0.5f;
+			break;
+		case DTYPE_INT16:
+			for (int i = 0; i < n; i++) ((int16_t *)out)[i] = in[i] + (in[i] < 0 ? -0.5f : 0.5f);
+			break;
+		case DTYPE_UINT16:
+			for (int i = 0; i < n; i++) ((uint16_t *)out)[i] = in[i] + 0.5f;
+			break;
+		case DTYPE_FLOAT16:
+			for (int i = 0; i < n; i++) ((_Float16 *)out)[i] = in[i];
+			break;
+		case DTYPE_FLOAT32:
+		case DTYPE_COMPLEX64:
+			memcpy(out, in, dtype_size[dtype] * n);
+			break;
+	}
+	return;
+}
+
+
+
+// Rows are converted to float, summed over y and z and then pairwise over x,
+// the loops are simple enough for the compiler to vectorise. Complex values are averaged per channel.
+void* downsample_slab(void *arg)
+{
+	struct mip_slab *slab = arg;
+	int *in_size = slab->in_size;
+	const ptrdiff_t *in_strides = slab->in_strides;
+	int *out_size = slab->out_size;
+	size_t bytes = dtype_size[slab->dtype];
+	int channels = dtype_channels[slab->dtype];
+	int n = channels * in_size[0];
+	float *sum = malloc(sizeof(float) * 2 * n);
+	float *row = sum + n;
+	int pairs = in_size[0] / 2;
+
+	for (int z = slab->z_begin; z < slab->z_end; z++) {
+		int zs[2] = {2 * z, fmin(2 * z + 1, in_size[2] - 1)};
+		for (int y = 0; y < out_size[1]; y++) {
+			int ys[2] = {2 * y, fmin(2 * y + 1, in_size[1] - 1)};
+			for (int r = 0; r < 4; r++) {
+				const char *in = slab->in + ys[r % 2] * in_strides[1] + zs[r / 2] * in_strides[2];
+				if (r == 0) {
+					load_row(slab->dtype, in, in_strides[0], sum, in_size[0]);
+					continue;
+				}
+				load_row(slab->dtype, in, in_strides[0], row, in_size[0]);
+				for (int x = 0; x < n; x++) sum[x] += row[x];
+			}
+			if (channels == 1) {
+				for (int x = 0; x < pairs; x++) row[x] = 0.125f * (sum[2*x] + sum[2*x+1]);
+			}
+			else {
+				for (int x = 0; x < pairs; x++) {
+					for (int c = 0; c < channels; c++) row[channels*x+c] = 0.125f * (sum[channels*2*x+c] + sum[channels*(2*x+1)+c]);
+				}
+			}
+			if (pairs == 0) for (int c = 0; c < channels; c++) row[c] = 0.25f * sum[c];
+			store_row(slab->dtype, row, slab->out + bytes * out_size[0] * (y + (size_t)out_size[1] * z), out_size[0]);
+		}
+	}
+	free(sum);
+	return NULL;
+}
+
+
+
+// Output slices z_begin to z_end (exclusive), in slabs on the shared workers (workers.c)
+void downsample(
+	int dtype, const char *in, const ptrdiff_t in_strides[3], int in_size[3],
+	char *out, int out_size[3], int z_begin, int z_end
+) {
+	int n = z_end - z_begin;
+	struct worker_pool *workers = shared_workers();
+	int nslabs = fmin(workers->nthreads + 1, n);
+	if (nslabs < 1) return;
+	struct mip_slab slabs[nslabs];
+	for (int t = 0; t < nslabs; t++) {
+		slabs[t] = (struct mip_slab) {
+			dtype, in, in_strides, in_size, out, out_size,
+			z_begin + t * n / nslabs, z_begin + (t + 1) * n / nslabs
+		};
+	}
+	run_tasks(workers, downsample_slab, slabs, sizeof(struct mip_slab), nslabs);
+	return;
+}
+
+
+
+// Strides of a level, level 0 is the image
+void level_strides(struct mip_builder *builder, int level, ptrdiff_t strides[3])
+{
+	if (level == 0) {
+		for (int i = 0; i < 3; i++) strides[i] = builder->strides[i];
+		return;
+	}
+	ptrdiff_t tmp[4];
+	contiguous_strides(builder->dtype, builder->layout.size[level], tmp);
+	for (int i = 0; i < 3; i++) strides[i] = tmp[i];
+	return;
+}
+
+
+
+const char* level_data(struct mip_builder *builder, int level)
+{
+	return level == 0 ? builder->image : builder->pyramid + builder->layout.offset[level];
+}
+
+
+
+void build_mipmaps(struct mip_builder *builder)
+{
+	struct mip_layout *layout = &builder->layout;
+	for (int l = 1; l < layout->levels; l++) {
+		ptrdiff_t in_strides[3];
+		level_strides(builder, l - 1, in_strides);
+		downsample(
+			builder->dtype, level_data(builder, l - 1), in_strides, layout->size[l-1],
+			builder->pyramid + layout->offset[l], layout->size[l], 0, layout->size[l][2]
+		);
+		pthread_mutex_lock(&builder->lock);
+		builder->done = l + 1;
+		pthread_cond_signal(&builder->cond);
+		pthread_mutex_unlock(&builder->lock);
+	}
+	return;
+}
+
+
+
+void* mip_builder_thread(void *arg)
+{
+	build_mipmaps(arg);
+	return NULL;
+}
+
+
+
+void setup_mip_builder(struct mip_builder *builder, int dtype, int size[3])
+{
+	builder->dtype = dtype;
+	setup_mip_layout(&builder->layout, dtype, size);
+	builder->image = NULL;
+	builder->pyramid = malloc(builder->layout.bytes);
+	builder->done = 1;
+	pthread_mutex_init(&builder->lock, NULL);
+	pthread_cond_init(&builder->cond, NULL);
+	return;
+}
+
+
+
+void delete_mip_builder(struct mip_builder *builder)
+{
+	free(builder->pyramid);
+	pthread_mutex_destroy(&builder->lock);
+	pthread_cond_destroy(&builder->cond);
+	return;
+}
+
+
+
+void set_mip_image(struct mip_builder *builder, const void *image, const ptrdiff_t strides[3])
+{
+	builder->image = image;
+	for (int i = 0; i < 3; i++) builder->strides[i] = strides[i];
+	return;
+}
+
+
+
+// Builds the levels in the background, so that level 0 can be uploaded meanwhile
+void start_mipmaps(struct mip_builder *builder, void *image, const ptrdiff_t strides[3], int dtype, int size[3])
+{
+	setup_mip_builder(builder, dtype, size);
+	set_mip_image(builder, image, strides);
+	pthread_create(&builder->thread, NULL, mip_builder_thread, builder);
+	return;
+}
+
+
+
+// Uploads every level as soon as it is finished, the builder is kept for update_mipmaps()
+void upload_mipmaps(struct mip_builder *builder, GLuint texture)
+{
+	struct mip_layout *layout = &builder->layout;
+	const struct texture_format *f = &texture_formats[builder->dtype];
+	glBindTexture(GL_TEXTURE_3D, texture);
+	for (int l = 1; l < layout->levels; l++) {
+		pthread_mutex_lock(&builder->lock);
+		while (builder->done <= l) pthread_cond_wait(&builder->cond, &builder->lock);
+		pthread_mutex_unlock(&builder->lock);
+		glTexSubImage3D(
+			GL_TEXTURE_3D, l, 0, 0, 0, layout->size[l][0], layout->size[l][1], layout->size[l][2],
+			f->format, f->type, builder->pyramid + layout->offset[l]
+		);
+	}
+	pthread_join(builder->thread, NULL);
+	return;
+}
+
+
+
+// Uploads the box from lower to upper (exclusive) of the image, and rebuilds and uploads the slabs
+// of the other levels which depend on it. The pyramid must be that of the image.
+void update_mipmaps(struct mip_builder *builder, GLuint texture, const int lower[3], const int upper[3])
+{
+	struct mip_layout *layout = &builder->layout;
+	const struct texture_format *f = &texture_formats[builder->dtype];
+	glBindTexture(GL_TEXTURE_3D, texture);
+	int extent[3];
+	const char *corner = builder->image;
+	for (int i = 0; i < 3; i++) {
+		extent[i] = upper[i] - lower[i];
+		corner += lower[i] * builder->strides[i];
+	}
+	upload_box(0, lower, extent, corner, builder->strides, builder->dtype);
+
+	// Slice z of level l averages slices 2z and 2z+1 of level l-1
+	int z_begin = lower[2], z_end = upper[2];
+	for (int l = 1; l < layout->levels; l++) {
+		z_begin /= 2;
+		z_end = fmin((z_end + 1) / 2, layout->size[l][2]);
+		if (z_begin >= z_end) break;
+		ptrdiff_t in_strides[3];
+		level_strides(builder, l - 1, in_strides);
+		char *out = builder->pyramid + layout->offset[l];
+		downsample(builder->dtype, level_data(builder, l - 1), in_strides, layout->size[l-1], out, layout->size[l], z_begin, z_end);
+		size_t slice = dtype_size[builder->dtype] * layout->size[l][0] * layout->size[l][1];
+		glTexSubImage3D(
+			GL_TEXTURE_3D, l, 0, 0, z_begin, layout->size[l][0], layout->size[l][1], z_end - z_begin,
+			f->format, f->type, out + slice * z_begin
+		);
+	}
+	return;
+}
+
+
+
+// Level of detail at which one texel covers about one pixel of the plane, corners as displayed (displayed_corners())
+float plane_lod(float corners[4][3], int size[3], int width, int height)
+{
+	float pixels[2] = {0.48 * width, 0.48 * height};
+	const int ends[2] = {1, 3};
+	float lod = 0;
+	for (int j = 0; j < 2; j++) {
+		float voxels = 0;
+		for (int i = 0; i < 3; i++) voxels += pow((corners[ends[j]][i] - corners[0][i]) * size[i], 2);
+		lod = fmax(lod, log2(sqrt(voxels) / pixels[j]));
+	}
+	return lod;
+}
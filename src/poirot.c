@@ -1,15 +1,32 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <math.h>
+#include <time.h>
 #include "../../glaze/include/glaze.h" // TODO need to register this somehow, how?
 #include <GLFW/glfw3.h>
 
 #include "vertices.c"
 #include "drawing.c"
-#include "shaders.c"
+#include "workers.c"
+#include "volume.c"
+#include "chunks.c"
+#include "viewer.c"
+#include "snapshot.c"
+#include "watch.c"
 #include "texture.c"
+#include "mipmap.c"
+#include "shaders.c"
 #include "window.c"
+#include "cine.c"
+#include "slab.c"
+#include "slices.c"
+#include "labels.c"
+#include "contrast.c"
+#include "trace.c"
+#include "image_writer.c"
+#include "recorder.c"
 
 #ifndef MAX_OPEN_WINDOWS
 	#define MAX_OPEN_WINDOWS 16
@@ -19,16 +36,31 @@
 
 
 // TODO: put these in a config struct?
-float zoom_incr = 0.0075;
-float move_speed = 0.0075;
+float zoom_speed = 0.5;   // Of the view per second, exponentially
+float scroll_zoom = 0.1;  // Of the view per step of the wheel
+float move_speed = 0.5;   // Of the view per second
+float drag_speed = 0.75;  // Of the view per window coordinate dragged
+float rotate_speed = 0.6; // Radians per second
+size_t texture_budget = (size_t)2048 << 20; // Bytes, larger volumes are split into bricks
+bool slice_only = false; // Only the slices through the cursor are uploaded (slices.c)
+int max_brick_uploads = 64; // Per frame
+size_t max_change_bytes = (size_t)128 << 20; // Uploaded per frame, the rest of the changes follows
+double watch_interval = 0.5; // Seconds
+size_t time_cache_budget = (size_t)1024 << 20; // Bytes, time curves are copied with time innermost if they fit
+const char *trace_path = NULL; // Chrome trace written when quitting
+bool link_all = false; // -l, all windows follow each other's cursor and zoom
 
 
 int window_width = 960;
 int window_height = 960;
 
-extern inline int idx(int x, int y, int z, int f, int size[3])
+#include "grid.c"
+#include "shared_volume.c"
+#include "roi.c"
+
+extern inline size_t idx(int x, int y, int z, int f, int size[3])
 {
-	int tmp = size[0] * size[1];
+	size_t tmp = (size_t)size[0] * size[1];
 	return x + y * size[0] + z * tmp + f * tmp * size[2];
 }
 
@@ -45,20 +77,6 @@ void get_ratio(int width, int height, float* p_ratio, int* p_ratio_axis)
 	return;
 }
 
-bool update_size(GLFWwindow* window, int* p_width, int* p_height, float* p_ratio, int* p_ratio_axis)
-{
-	int w, h;
-	glfwGetWindowSize(window, &w, &h);
-	if (*p_width != w || *p_height != h) {
-		glViewport(0, 0, w, h);
-		get_ratio(w, h, p_ratio, p_ratio_axis);
-		*p_width = w;
-		*p_height = h;
-		return true;
-	}
-	return false;
-}
-
 void update_position(char plane, float planes[3][4][3], float centres[3][2], float centres_window[3][4], float mouse_window[2])
 {
 	// Change position of cross of plane
@@ -101,87 +119,138 @@ void update_zoom(float zoom, char plane, float planes[3][4][3], float centres[3]
 	return;
 }
 
-bool handle_mouse_and_keys(GLFWwindow* window, int width, int height, float planes[3][4][3], float centres[3][2], float centres_window[3][4])
+
+
+// The other view moves to the cursor in texture coordinates, their orientations can differ,
+// and zooms about it until its planes are as large as those of the view
+void follow_view(
+	float planes[3][4][3], const struct orientation *o,
+	float other_planes[3][4][3], float other_centres[3][2], float other_centres_window[3][4], const struct orientation *other_o
+) {
+	float cursor[3], tex[3];
+	get_cursor(planes, cursor);
+	orient(o, cursor, tex);
+	unorient(other_o, tex, cursor);
+	for (int k = 0; k < 3; k++) cursor[k] = fmax(0, fmin(1, cursor[k]));
+	set_cursor(cursor, other_planes, other_centres, other_centres_window);
+	for (int p = 0; p < 3; p++) {
+		int axis = plane_axes[p][0];
+		float zoom = (planes[p][2][axis] - planes[p][0][axis]) / (other_planes[p][2][axis] - other_planes[p][0][axis]);
+		update_zoom(zoom, p, other_planes, other_centres, other_centres_window, other_centres[p]);
+	}
+	return;
+}
+
+// Input is read from the window's events and applied separately, so that it can be replayed without a window (bench.c)
+struct input {
+	bool left_button, right_button;
+	bool zoom_in, zoom_out;
+	bool move_up, move_down, move_right, move_left;
+	bool rotate_left, rotate_right, reset_rotation;
+	float scroll; // Steps of the wheel since the last input
+	float mouse_window[2];
+	float mouse_delta[2];
+	char clicked_plane; // Where the right mouse button was pressed, -1 if released
+	double time;        // Of the last input
+	float dt;           // Seconds which held keys count for
+	bool moving;        // A key which zooms, pans or turns was held
+};
+
+// Held keys act for the time since the last input, so that they are as fast however often the input is read,
+// a key which was just pressed acts for one frame at 60 Hz
+void read_input(GLFWwindow* window, int width, int height, struct input *input)
 {
-	char mouse_right_button_state = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT);
-	char mouse_right_button	      = mouse_right_button_state                           == GLFW_PRESS;
-	char mouse_left_button        = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
-	char zoom_in_key              = glfwGetKey(window, GLFW_KEY_EQUAL)                 == GLFW_PRESS;
-	char zoom_out_key             = glfwGetKey(window, GLFW_KEY_MINUS)                 == GLFW_PRESS;
-	char move_up_key              = glfwGetKey(window, GLFW_KEY_UP)                    == GLFW_PRESS;
-	char move_down_key            = glfwGetKey(window, GLFW_KEY_DOWN)                  == GLFW_PRESS;
-	char move_right_key           = glfwGetKey(window, GLFW_KEY_RIGHT)                 == GLFW_PRESS;
-	char move_left_key            = glfwGetKey(window, GLFW_KEY_LEFT)                  == GLFW_PRESS;
-
-	static char clicked_plane = -1;
-	//printf("%d\n", clicked_plane);
-	if (mouse_right_button_state == GLFW_RELEASE) clicked_plane = -1;
+	struct window_events *events = glfwGetWindowUserPointer(window);
+	input->left_button  = button_down(window, GLFW_MOUSE_BUTTON_LEFT);
+	input->right_button = button_down(window, GLFW_MOUSE_BUTTON_RIGHT);
+	input->zoom_in      = key_down(window, GLFW_KEY_EQUAL);
+	input->zoom_out     = key_down(window, GLFW_KEY_MINUS);
+	input->move_up      = key_down(window, GLFW_KEY_UP);
+	input->move_down    = key_down(window, GLFW_KEY_DOWN);
+	input->move_right   = key_down(window, GLFW_KEY_RIGHT);
+	input->move_left    = key_down(window, GLFW_KEY_LEFT);
+	input->rotate_left  = key_down(window, GLFW_KEY_Q);
+	input->rotate_right = key_down(window, GLFW_KEY_E);
+	input->reset_rotation = key_down(window, GLFW_KEY_R);
+	input->scroll = events->scroll;
+	update_mouse_position(window, width, height, input->mouse_window, input->mouse_delta);
+
+	double time = glfwGetTime();
+	input->dt = input->moving ? fmin(0.1, time - input->time) : 1.0 / 60;
+	input->time = time;
+	input->moving = (
+		input->zoom_in     || input->zoom_out     ||
+		input->move_up     || input->move_down    || input->move_right || input->move_left ||
+		input->rotate_left || input->rotate_right
+	);
+	return;
+}
+
+// Returns true if any of the keys or buttons is pressed.
+// Q and E turn the other planes around the normal of the plane under the mouse, R makes them axis aligned again.
+bool apply_input(struct input *input, float planes[3][4][3], float centres[3][2], float centres_window[3][4], struct orientation *orientation)
+{
+	if (!input->right_button) input->clicked_plane = -1;
 
 	bool any_key_pressed = (
-		mouse_left_button || mouse_right_button ||
-		zoom_in_key       || zoom_out_key  ||
-		move_up_key       || move_down_key || move_right_key || move_left_key
+		input->left_button || input->right_button ||
+		input->zoom_in     || input->zoom_out     ||
+		input->move_up     || input->move_down    || input->move_right || input->move_left ||
+		input->rotate_left || input->rotate_right || input->reset_rotation ||
+		input->scroll != 0
 	);
-	if (!any_key_pressed) return false; 
+	if (!any_key_pressed) return false;
 
-	float mouse_window[2];
-	float mouse_delta[2];
-	update_mouse_position(window, width, height, mouse_window, mouse_delta); // TODO maybe this can be merged with the effect of mouse_delta? check below what it does
+	float *mouse_window = input->mouse_window;
 	float mouse_tex[2];
 	char plane = current_plane(mouse_window[0], mouse_window[1]);
 
 	// Is mouse in a plane?
 	if (plane != -1) {
 		window2tex(plane, mouse_window, mouse_tex, planes[plane][0], planes[plane][2]);
-		if (mouse_left_button) update_position(plane, planes, centres, centres_window, mouse_window);
-		if (zoom_in_key || zoom_out_key) {
+		if (input->left_button) update_position(plane, planes, centres, centres_window, mouse_window);
+		if (input->zoom_in || input->zoom_out || input->scroll != 0) {
 			float zoom = 1;
-			if (zoom_in_key)	zoom -= zoom_incr;
-			else if (zoom_out_key)	zoom += zoom_incr;
+			if (input->zoom_in)		zoom = exp(-zoom_speed * input->dt);
+			else if (input->zoom_out)	zoom = exp(zoom_speed * input->dt);
+			zoom *= pow(1 - scroll_zoom, input->scroll);
 			update_zoom(zoom, plane, planes, centres, centres_window, mouse_tex);
 		}
-		if (move_up_key || move_down_key || move_right_key || move_left_key) {
-			char sign = move_up_key || move_right_key ? 1 : -1;
-			char axis = move_up_key || move_down_key ? 1 : 0;
+		if (input->move_up || input->move_down || input->move_right || input->move_left) {
+			char sign = input->move_up || input->move_right ? 1 : -1;
+			char axis = input->move_up || input->move_down ? 1 : 0;
 			float rel_shift[2] = {0};
-			rel_shift[axis] = sign * move_speed;
+			rel_shift[axis] = sign * move_speed * input->dt;
 			move_view(rel_shift, plane, planes[plane], centres[plane], centres_window[plane]);
 		}
-		if (clicked_plane == -1) clicked_plane = plane;
+		if (input->rotate_left || input->rotate_right) {
+			float angle = rotate_speed * input->dt;
+			rotate_view(input->rotate_left ? angle : -angle, plane, planes, orientation);
+		}
+		if (input->clicked_plane == -1) input->clicked_plane = plane;
+	}
+	if (input->reset_rotation) {
+		float cursor[3], tex[3];
+		get_cursor(planes, cursor);
+		orient(orientation, cursor, tex);
+		for (int i = 0; i < 3; i++) tex[i] = fmax(0, fmin(1, tex[i]));
+		setup_orientation(orientation);
+		set_cursor(tex, planes, centres, centres_window);
 	}
-
 
 	// Was mouse previously clicked in a plane and right mouse button is still held?
-	if (clicked_plane != -1 && mouse_right_button) {
+	char clicked_plane = input->clicked_plane;
+	if (clicked_plane != -1 && input->right_button) {
 		float rel_shift[2];
-		for (int i = 0; i < 2; i++) rel_shift[i] = 100 * mouse_delta[i] * move_speed;
+		for (int i = 0; i < 2; i++) rel_shift[i] = drag_speed * input->mouse_delta[i];
 		move_view(rel_shift, clicked_plane, planes[clicked_plane], centres[clicked_plane], centres_window[clicked_plane]);
 	}
 
 	return true;
 }
 
-
-
-
-void poirot(int width, int height)
-{ // float *image, int size[3], int nframes, 
-
-	int nframes = 1;
-	int size[3] = {100, 100, 100};
-
-	float image[100 * 100 * 100] = { 0 };
-	for (int i = 49; i < 52; i++) {
-		for (int j = 49; j < 52; j++) {
-			for (int k = 49; k < 52; k++) {
-				image[idx(i, j, k, 0, size)] = 1;
-			}
-		}
-	}
-
-	GLFWwindow* window = open_window(width, height);
-	// TODO break this down?
-	gladLoadGL();
+void setup_gl_state()
+{
 	glEnable(GL_DEBUG_OUTPUT);
 	glDebugMessageCallback(glErrorCallback, NULL);
 	glClearColor(0, 0, 0, 1);
@@ -190,95 +259,835 @@ void poirot(int width, int height)
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glEnable(GL_CULL_FACE);
 	glCullFace(GL_BACK);
-	glLineWidth(2.0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	return;
+}
+
+// What the input thread hands to the render thread, through the window's snapshot
+struct view_state {
+	float planes[3][4][3], centres_window[3][4];
+	struct orientation orientation;
+	int width, height;
+	struct contrast_settings contrast;
+	struct slab_settings slab;
+	struct cine_controls cine;
+	struct roi_view roi;
+	bool overlay;
+	bool recording;
+	char label_mode;
+	double input_time; // When the input was sampled, for the latency
+};
 
-	bool update = false;
+enum window_stage { WINDOW_OPENING, WINDOW_OPEN, WINDOW_CLOSED };
+
+// Per window, the volume it shows is shared with other windows. Grid windows show the volumes of several viewers (grid.c).
+// GLFW wants input handled on the main thread, the input thread, while the window's context is only current
+// on the render thread, so that large uploads don't hold up the input.
+struct view_window {
+	GLFWwindow *window;
+	struct window_events events;
+	struct viewer *viewer; // Of the first cell
+	struct viewer **cells;
+	int ncells;
+	int grid[2];           // Columns and rows of cells
+	struct shared_volume *volume;
+	int link; // Windows of the same link follow each other's cursor and zoom (follow_view()), 0 if none
+	struct snapshot snapshot; // Of struct view_state
+	// Input thread
+	struct view_state state, published;
+	float centres[3][2];
+	struct input input;
+	struct contrast_input contrast_input;
+	char cine_keys[NUM_CINE_KEYS];
+	char slab_keys[NUM_SLAB_KEYS];
+	struct roi_input roi_input;
+	bool trace_key;
+	bool record_key;
+	bool label_key;
+	double input_time;
+	int title_frame;
+	// Render thread
+	struct view_state shown; // Last taken from the snapshot
+	int width, height;
 	int ratio_axis;
 	float ratio;
-	get_ratio(width, height, &ratio, &ratio_axis);
+	GLuint program, shaders[2];
+	GLint uniform_pixel;
+	float drawn_planes[3][4][3], drawn_centres_window[3][4]; // As last drawn
+	struct orientation drawn_orientation;
+	struct cine_controls cine; // Applied
+	struct view_buffer view;
+	struct contrast contrast;
+	struct slab slab;
+	struct slices slices; // In slice-only mode
+	struct roi_plot plot;
+	struct framebuffer framebuffer;
+	const char *trace_path;
+	struct trace trace;
+	struct recorder recorder;
+	unsigned char dirty;
+	bool resized, new_frame, new_data, new_contrast, new_slab, new_overlay, new_roi, new_labels;
+	int missing_bricks;
+	bool check_bricks; // Other windows of the volume uploaded bricks, which may have evicted this window's
+	atomic_int frame;  // Of the cine, put into the title by the input thread
+	// Both, the worker of the region of interest has its own lock
+	struct roi roi;
+	// Both, under the render thread's lock
+	char stage;
+	bool closing;
+};
 
-	// TODO outsource this?
-	GLuint plane_program, plane_shaders[2], cross_program, cross_shaders[2];
-	setup_plane_shaders(&plane_program, plane_shaders);
-	setup_cross_shaders(&cross_program, cross_shaders);
 
-	GLint uniform_ratio = glGetUniformLocation(plane_program, "ratio");
-	GLint uniform_ratio_axis = glGetUniformLocation(plane_program, "axis");
-	GLint cross_vertical = glGetUniformLocation(cross_program, "vertical");
 
-	glUseProgram(plane_program);
-	glUniform1f(uniform_ratio, ratio);
-	glUniform1i(uniform_ratio_axis, ratio_axis);
+// On the input thread, the render thread sets up the rest (setup_window_drawing()). Returns false if it can't be opened.
+bool setup_view_window(
+	struct view_window *w, struct viewer *cells[], int ncells, struct shared_volume *volume,
+	GLFWwindow *share, int width, int height, const char *trace_path
+) {
+	memset(w, 0, sizeof(struct view_window));
+	w->window = open_window(width, height, share);
+	if (w->window == NULL) return false;
+	setup_window_events(w->window, &w->events);
+	glfwMakeContextCurrent(NULL);
+	struct viewer *viewer = cells[0];
+	w->viewer = viewer;
+	w->cells = cells;
+	w->ncells = ncells;
+	grid_layout(ncells, w->grid);
+	w->volume = volume;
+	w->trace_path = trace_path;
 
 	#include "coordinates.c"
+	memcpy(w->state.planes, planes, sizeof(planes));
+	setup_orientation(&w->state.orientation);
+	memcpy(w->centres, centres, sizeof(centres));
+	memcpy(w->state.centres_window, centres_window, sizeof(centres_window));
+	w->state.width = width;
+	w->state.height = height;
+	w->input.clicked_plane = -1;
+	setup_contrast_input(&w->contrast_input);
+	w->state.contrast = w->contrast_input.settings;
+	setup_slab_settings(&w->state.slab);
+	w->state.label_mode = LABELS_FILLED;
+	setup_roi_input(&w->roi_input);
+	setup_roi(&w->roi, viewer->image, viewer->chunks, viewer->dtype, viewer->size, viewer->strides, viewer->nframes);
+	w->published = w->state;
+	setup_snapshot(&w->snapshot, sizeof(struct view_state));
+	publish_snapshot(&w->snapshot, &w->state);
+	w->stage = WINDOW_OPENING;
+	return true;
+}
+
+
+
+// On the render thread, in pixels, the planes of each cell are laid out like those of a window
+void cell_size(struct view_window *w, int *width, int *height)
+{
+	*width = w->width / w->grid[0];
+	*height = w->height / w->grid[1];
+	return;
+}
+
+
+
+// On the render thread, texture coordinates of the planes' corners as displayed and of the cursor
+void shown_corners(struct view_window *w, float corners[3][4][3], float cursor[3])
+{
+	float q[3];
+	displayed_corners(w->shown.planes, &w->shown.orientation, w->ratio, w->ratio_axis, corners);
+	get_cursor(w->shown.planes, q);
+	orient(&w->shown.orientation, q, cursor);
+	return;
+}
+
+
 
-	GLuint buffers[2];
-	glGenBuffers(2, &buffers[0]);
-
-	// TODO: single plane, think I need only one for all three orientations?
-	GLuint three_planes_vertex_array = setup_three_planes(buffers[0], planes);
-	GLuint crosses_vertex_array = setup_crosses(buffers[1], centres_window);
-	GLuint texture = setup_texture(image, size);
-
-	while (!glfwWindowShouldClose(window)) {
-
-		//glfwPollEvents();
-		bool ...
-		while (
-			....
-			update = update_size(window, &width, &height, &ratio, &ratio_axis);
-			... = handle_mouse_and_keys(window, width, height, planes, centres, centres_window)
-			esc = glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS
-		)
-			glfwWaitEvents();
+// On the render thread, voxels which the planes show, their changes are uploaded first
+void shown_boxes(struct view_window *w, struct change boxes[3])
+{
+	float corners[3][4][3], cursor[3];
+	shown_corners(w, corners, cursor);
+	int *size = w->viewer->size;
+	int margin = (slab_thickness(&w->slab) + 1) / 2;
+	for (int p = 0; p < 3; p++) {
+		for (int i = 0; i < 3; i++) {
+			float lower = 1, upper = 0;
+			for (int c = 0; c < 4; c++) {
+				lower = fmin(lower, corners[p][c][i]);
+				upper = fmax(upper, corners[p][c][i]);
+			}
+			boxes[p].lower[i] = fmax(0, floor(lower * size[i]) - 1 - margin);
+			boxes[p].upper[i] = fmin(size[i], ceil(upper * size[i]) + 1 + margin);
 		}
-		if (esc) break;
+	}
+	return;
+}
+
+
+
+// On the render thread, the volume is uploaded with its first window, the window's context is left current.
+// Returns false if the volume or its slices don't fit on the GPU, the window is closed then without drawing.
+bool setup_window_drawing(struct view_window *w)
+{
+	glfwMakeContextCurrent(w->window);
+	// TODO break this down?
+	gladLoadGL();
+	setup_gl_state();
+	struct shared_volume *volume = w->volume;
+	struct viewer *viewer = w->viewer;
+	if (volume->nwindows == 0 && !setup_shared_volume(volume, w->cells, w->ncells)) return false;
+	if (volume->sliced && !setup_slices(&w->slices, viewer->dtype, viewer->size, viewer->strides, viewer->chunks)) {
+		if (volume->nwindows == 0) delete_shared_volume(volume);
+		return false;
+	}
+	volume->nwindows++;
+
+	w->shown = *(const struct view_state *)take_snapshot(&w->snapshot);
+	w->width = w->shown.width;
+	w->height = w->shown.height;
+	int width, height;
+	cell_size(w, &width, &height);
+	get_ratio(width, height, &w->ratio, &w->ratio_axis);
+	glViewport(0, 0, w->width, w->height);
+
+	// Programs aren't shared, uniforms differ between windows
+	setup_plane_shaders(&w->program, w->shaders);
+	w->uniform_pixel = glGetUniformLocation(w->program, "pixel");
+	glUseProgram(w->program);
+	glUniform2f(w->uniform_pixel, 2.0 / width, 2.0 / height);
+	set_grid_uniforms(w->program, w->grid, w->ncells);
+
+	setup_view_buffer(&w->view);
+	set_volume_uniforms(w->program, volume->bricked, viewer->dtype, viewer->size);
+	set_orientation_uniforms(w->program, &w->shown.orientation);
+	set_label_uniforms(&volume->labels, w->program, w->shown.label_mode);
+	bind_shared_volume(volume);
+	if (volume->sliced) set_slice_uniforms(&w->slices, w->program);
+	setup_slab(&w->slab, volume->bricked, viewer->dtype, viewer->size);
+	apply_slab_settings(&w->slab, &w->shown.slab);
+	set_slab_uniforms(&w->slab, w->program);
+	float corners[3][4][3], cursor[3];
+	shown_corners(w, corners, cursor);
+	if (volume->bricked) update_bricks(&volume->bricks, corners, cursor, slab_thickness(&w->slab));
+	update_slab(&w->slab, w->shown.planes, &w->shown.orientation);
+
+	setup_contrast(&w->contrast, volume->bricked, viewer->dtype, viewer->size);
+	apply_contrast_settings(&w->contrast, &w->shown.contrast);
+	update_contrast(&w->contrast, corners, viewer->size, &w->slab);
+	set_contrast_uniforms(&w->contrast, w->program);
+	if (volume->sliced) set_slice_uniforms(&w->slices, w->contrast.program);
+	set_grid_uniforms(w->contrast.program, w->grid, w->ncells);
+
+	setup_roi_plot(&w->plot, viewer->nframes);
+	setup_framebuffer(&w->framebuffer, w->width, w->height);
+	setup_trace(&w->trace, w->trace_path);
+	w->dirty = DIRTY_ALL;
+	return true;
+}
+
+
+
+// On the input thread, returns true if the window is to be closed
+bool poll_view_window(struct view_window *w)
+{
+	struct view_state *state = &w->state;
+	w->input_time = glfwGetTime();
+	glfwGetWindowSize(w->window, &state->width, &state->height);
+	read_input(w->window, state->width, state->height, &w->input);
+	if (slice_only) {
+		// Slices are axis aligned
+		w->input.rotate_left = false;
+		w->input.rotate_right = false;
+	}
+	if (w->ncells == 1 && handle_roi_input(
+		w->window, &w->roi_input, &w->roi, &state->roi, w->input.mouse_window, w->input.left_button,
+		state->planes, &state->orientation, state->slab.mode == SLAB_OFF ? 1 : state->slab.thickness
+	)) w->input.left_button = false;
+	// In grids, the mouse acts on the cell under it and so on all cells
+	struct input cell_input = w->input;
+	to_cell(w->grid, cell_input.mouse_window, cell_input.mouse_delta);
+	apply_input(&cell_input, state->planes, w->centres, state->centres_window, &state->orientation);
+	w->input.clicked_plane = cell_input.clicked_plane;
+	handle_contrast_input(w->window, state->width, state->height, &w->contrast_input);
+	state->contrast = w->contrast_input.settings;
+	handle_slab_keys(w->window, &state->slab, w->slab_keys);
+	if (slice_only || w->ncells > 1) state->slab.mode = SLAB_OFF;
+	handle_cine_keys(w->window, &state->cine, w->cine_keys);
+	handle_trace_keys(w->window, &state->overlay, &w->trace_key);
+	handle_record_keys(w->window, &state->recording, &w->record_key);
+	handle_label_keys(w->window, &state->label_mode, &w->label_key);
+	float cursor[3], tex[3];
+	int voxel[3];
+	get_cursor(state->planes, cursor);
+	orient(&state->orientation, cursor, tex);
+	for (int i = 0; i < 3; i++) voxel[i] = fmax(0, fmin(w->viewer->size[i] - 1, tex[i] * w->viewer->size[i]));
+	set_roi_cursor(&w->roi, voxel);
+
+	int frame = atomic_load(&w->frame);
+	if (frame != w->title_frame) {
+		char title[64];
+		snprintf(title, sizeof(title), "Frame %d/%d", frame + 1, w->viewer->nframes);
+		glfwSetWindowTitle(w->window, title);
+		w->title_frame = frame;
+	}
+	bool close = (
+		key_down(w->window, GLFW_KEY_ESCAPE) ||
+		glfwWindowShouldClose(w->window) ||
+		viewer_should_quit(w->viewer)
+	);
+	end_window_events(&w->events);
+	return close;
+}
+
 
 
-		if (... check below, crosses updated there as well) {
-			glClear(GL_COLOR_BUFFER_BIT);
-			glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
-			glBufferSubData(GL_ARRAY_BUFFER, sizeof(crosses), sizeof(centres_window), centres_window);
+// On the input thread, hands the state to the render thread if it changed
+bool publish_view_state(struct view_window *w)
+{
+	w->state.input_time = w->published.input_time;
+	if (memcmp(&w->state, &w->published, sizeof(struct view_state)) == 0) return false;
+	w->state.input_time = w->input_time;
+	publish_snapshot(&w->snapshot, &w->state);
+	memcpy(&w->published, &w->state, sizeof(struct view_state));
+	return true;
+}
+
+
+
+// On the render thread, makes the window's context current and takes the latest state, if there is a new one
+void take_view_state(struct view_window *w)
+{
+	glfwMakeContextCurrent(w->window);
+	trace_stage(&w->trace, TRACE_INPUT);
+	w->new_roi |= take_roi_results(&w->roi);
+	const struct view_state *state = take_snapshot(&w->snapshot);
+	if (state == NULL) return;
+	w->new_roi |= memcmp(&state->roi, &w->shown.roi, sizeof(struct roi_view)) != 0;
+	w->new_labels |= state->label_mode != w->shown.label_mode;
+	memcpy(&w->shown, state, sizeof(struct view_state));
+	w->trace.input_time = state->input_time;
+	if (state->width != w->width || state->height != w->height) {
+		w->width = state->width;
+		w->height = state->height;
+		glViewport(0, 0, w->width, w->height);
+		int width, height;
+		cell_size(w, &width, &height);
+		get_ratio(width, height, &w->ratio, &w->ratio_axis);
+		w->resized = true;
+		w->dirty = DIRTY_ALL;
+	}
+	w->new_contrast |= apply_contrast_settings(&w->contrast, &state->contrast);
+	w->new_slab |= apply_slab_settings(&w->slab, &state->slab);
+	set_slab_part(&w->slab, w->contrast.part);
+	apply_cine_controls(&w->volume->cine, &state->cine, &w->cine);
+	w->new_overlay |= set_trace_overlay(&w->trace, state->overlay);
+	set_recording(&w->recorder, state->recording, w->width, w->height);
+	return;
+}
+
+
+
+// On the render thread, in slice-only mode, the slices through the cursor of the displayed frame
+void request_shown_slices(struct view_window *w)
+{
+	struct viewer *viewer = w->viewer;
+	float corners[3][4][3], cursor[3];
+	shown_corners(w, corners, cursor);
+	int voxel[3];
+	for (int i = 0; i < 3; i++) voxel[i] = fmax(0, fmin(viewer->size[i] - 1, cursor[i] * viewer->size[i]));
+	if (w->new_data) invalidate_slices(&w->slices);
+	int frame = w->volume->cine.frame;
+	request_slices(&w->slices, viewer->image + frame * viewer->strides[3], frame, voxel);
+	return;
+}
+
+
+
+// Input which doesn't change the view doesn't count
+bool needs_drawing(struct view_window *w)
+{
+	bool new_slices = false;
+	if (w->volume->sliced) {
+		request_shown_slices(w);
+		new_slices = slices_ready(&w->slices);
+	}
+	if (w->check_bricks) {
+		w->check_bricks = false;
+		float corners[3][4][3], cursor[3];
+		shown_corners(w, corners, cursor);
+		update_bricks(&w->volume->bricks, corners, cursor, slab_thickness(&w->slab));
+		w->missing_bricks = w->volume->bricks.nmissing;
+	}
+	w->dirty |= find_dirty(w->drawn_planes, w->shown.planes, w->drawn_centres_window, w->shown.centres_window);
+	bool new_orientation = memcmp(&w->drawn_orientation, &w->shown.orientation, sizeof(struct orientation)) != 0;
+	if (w->new_frame || w->new_data || w->new_contrast || w->new_slab || w->new_labels || new_orientation || new_slices) {
+		w->dirty = DIRTY_ALL;
+	}
+	return w->dirty || w->new_overlay || w->new_roi || w->missing_bricks > 0;
+}
+
+
+
+// Expects the window's context to be current, returns true if bricks were uploaded
+bool draw_view_window(struct view_window *w)
+{
+	struct shared_volume *volume = w->volume;
+	struct viewer *viewer = w->viewer;
+	struct trace *trace = &w->trace;
+	float (*planes)[4][3] = w->shown.planes;
+	trace_stage(trace, TRACE_UPDATE);
+	bool new_orientation = memcmp(&w->drawn_orientation, &w->shown.orientation, sizeof(struct orientation)) != 0;
+	bool new_view = w->resized || new_orientation || memcmp(w->drawn_planes, planes, sizeof(w->drawn_planes)) != 0;
+	float corners[3][4][3], cursor[3];
+	shown_corners(w, corners, cursor);
+
+	if (w->resized) resize_framebuffer(&w->framebuffer, w->width, w->height);
+
+	if (w->new_frame) {
+		atomic_store(&w->frame, volume->cine.frame);
+		glfwPostEmptyEvent();
+	}
+
+	bool new_slices = new_view || w->new_data || w->new_contrast || w->new_slab;
+	bool uploaded = false;
+	bind_shared_volume(volume);
+	if (volume->bricked) {
+		struct brick_cache *bricks = &volume->bricks;
+		// Always, because other windows of the volume may have evicted bricks
+		update_bricks(bricks, corners, cursor, slab_thickness(&w->slab));
+		if (bricks->nmissing > 0) {
+			new_slices = true;
+			w->dirty = DIRTY_ALL;
+			trace_stage(trace, TRACE_UPLOAD);
+			w->missing_bricks = upload_bricks(bricks, max_brick_uploads);
+			fence_shared_volume(volume);
+			uploaded = true;
+			trace_stage(trace, TRACE_UPDATE);
 		}
-		//printf("%f, %f\n", centres_window[0][0], centres_window[0][1]);
-
-		// TODO outsource all this into a drawing function?
-		glUseProgram(plane_program);
-		glBindVertexArray(three_planes_vertex_array);
-
-		if (update) {
-			// TODO don't copy all?
-			glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
-			glBufferSubData(GL_ARRAY_BUFFER, sizeof(three_planes_vertices), sizeof(planes), planes);
-			glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
-			glBufferSubData(GL_ARRAY_BUFFER, sizeof(crosses), sizeof(centres_window), centres_window);
-			glUniform1f(uniform_ratio, ratio);
-			update = false;
+		else w->missing_bricks = 0;
+	}
+	if (volume->sliced && upload_slices(&w->slices)) {
+		set_slice_uniforms(&w->slices, w->program);
+		set_slice_uniforms(&w->slices, w->contrast.program);
+		new_slices = true;
+		w->dirty = DIRTY_ALL;
+	}
+	if (uploaded || w->new_data) invalidate_slab(&w->slab);
+	if (update_slab(&w->slab, planes, &w->shown.orientation) || w->new_slab) set_slab_uniforms(&w->slab, w->program);
+	if (new_slices) {
+		update_contrast(&w->contrast, corners, viewer->size, &w->slab);
+		set_contrast_uniforms(&w->contrast, w->program);
+	}
+
+	trace_stage(trace, TRACE_UPLOAD);
+
+	int width, height;
+	cell_size(w, &width, &height);
+	float lod[3];
+	for (int p = 0; p < 3; p++) lod[p] = plane_lod(corners[p], viewer->size, width, height);
+	update_view_buffer(&w->view, w->dirty, planes, w->shown.centres_window, lod, w->ratio, w->ratio_axis);
+
+	// Draw only the planes which changed, the rest of the framebuffer is kept
+	trace_stage(trace, TRACE_DRAW);
+	trace_gpu_begin(trace);
+	glBindFramebuffer(GL_FRAMEBUFFER, w->framebuffer.id);
+	if (w->dirty == DIRTY_ALL) glClear(GL_COLOR_BUFFER_BIT);
+	glUseProgram(w->program);
+	if (new_view) glUniform2f(w->uniform_pixel, 2.0 / width, 2.0 / height);
+	if (new_orientation) set_orientation_uniforms(w->program, &w->shown.orientation);
+	if (w->new_labels) set_label_uniforms(&volume->labels, w->program, w->shown.label_mode);
+	draw_view(&w->view, w->dirty, w->ncells);
+	trace_gpu_end(trace);
+
+	// Flush and swap
+	trace_stage(trace, TRACE_SWAP);
+	copy_framebuffer(&w->framebuffer);
+	draw_roi_plot(&w->plot, &w->roi, &w->shown.roi, planes, volume->cine.frame, w->width, w->height);
+	record_frame(&w->recorder, w->width, w->height);
+	draw_trace_overlay(trace, w->width, w->height);
+	glFlush();
+	glfwSwapBuffers(w->window);
+	end_trace_frame(trace);
+
+	memcpy(w->drawn_planes, planes, sizeof(w->drawn_planes));
+	w->drawn_orientation = w->shown.orientation;
+	memcpy(w->drawn_centres_window, w->shown.centres_window, sizeof(w->drawn_centres_window));
+	w->dirty = 0;
+	w->resized = w->new_frame = w->new_data = w->new_contrast = w->new_slab = w->new_overlay = w->new_roi = false;
+	w->new_labels = false;
+	return uploaded;
+}
+
+
+
+// On the render thread, expects the window's context to be current
+void delete_window_drawing(struct view_window *w)
+{
+	stop_trace(&w->trace);
+	delete_recorder(&w->recorder);
+	delete_framebuffer(&w->framebuffer);
+	delete_view_buffer(&w->view);
+	delete_contrast(&w->contrast);
+	delete_slab(&w->slab);
+	if (w->volume->sliced) delete_slices(&w->slices);
+	delete_roi_plot(&w->plot);
+	glDeleteProgram(w->program);
+	for (int i = 0; i < 2; i++) glDeleteShader(w->shaders[i]);
+	return;
+}
+
+
+
+// On the input thread, once the render thread is done with the window
+void delete_view_window(struct view_window *w)
+{
+	glfwDestroyWindow(w->window);
+	delete_snapshot(&w->snapshot);
+	delete_roi(&w->roi);
+	return;
+}
+
+
+
+// Draws the windows, whose contexts are current only on this thread.
+// The input thread adds windows and asks to close them, and wakes it when there is a new state or event.
+struct render_thread {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool woken, quit;
+	struct view_window *windows[MAX_OPEN_WINDOWS]; // Changed by the input thread only, with the lock
+	int nwindows;
+	struct shared_volume *volumes; // Per viewer
+	int nvolumes;
+	bool failed; // A window couldn't be set up
+};
+
+
+
+void wake_render_thread(struct render_thread *render)
+{
+	pthread_mutex_lock(&render->lock);
+	render->woken = true;
+	pthread_cond_signal(&render->cond);
+	pthread_mutex_unlock(&render->lock);
+	return;
+}
+
+
+
+// Timeout in seconds, negative to wait until woken
+void wait_render_thread(struct render_thread *render, double timeout)
+{
+	pthread_mutex_lock(&render->lock);
+	if (timeout < 0) {
+		while (!render->woken) pthread_cond_wait(&render->cond, &render->lock);
+	}
+	else if (!render->woken) {
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		double seconds = until.tv_sec + 1e-9 * until.tv_nsec + timeout;
+		until.tv_sec = seconds;
+		until.tv_nsec = 1e9 * (seconds - until.tv_sec);
+		pthread_cond_timedwait(&render->cond, &render->lock, &until);
+	}
+	render->woken = false;
+	pthread_mutex_unlock(&render->lock);
+	return;
+}
+
+
+
+// Sets up opened windows and deletes closed ones with the last of a volume, returns the windows to draw
+int update_render_windows(struct render_thread *render, struct view_window *windows[MAX_OPEN_WINDOWS])
+{
+	struct view_window *opening[MAX_OPEN_WINDOWS], *closing[MAX_OPEN_WINDOWS];
+	int nwindows = 0, nopening = 0, nclosing = 0;
+	pthread_mutex_lock(&render->lock);
+	for (int i = 0; i < render->nwindows; i++) {
+		struct view_window *w = render->windows[i];
+		if (w->stage == WINDOW_OPENING) opening[nopening++] = w;
+		else if (w->stage == WINDOW_CLOSED) continue;
+		else if (w->closing) closing[nclosing++] = w;
+		else windows[nwindows++] = w;
+	}
+	pthread_mutex_unlock(&render->lock);
+
+	// Windows closed while opening are deleted next time, those which can't be set up at once
+	for (int i = 0; i < nopening; i++) {
+		struct view_window *w = opening[i];
+		bool ok = setup_window_drawing(w);
+		set_viewer_started(w->viewer, ok);
+		if (!ok) glfwMakeContextCurrent(NULL);
+		pthread_mutex_lock(&render->lock);
+		if (!ok) {
+			w->stage = WINDOW_CLOSED;
+			render->failed = true;
+			pthread_mutex_unlock(&render->lock);
+			glfwPostEmptyEvent();
+			continue;
 		}
+		w->stage = WINDOW_OPEN;
+		if (!w->closing) windows[nwindows++] = w;
+		else render->woken = true;
+		pthread_mutex_unlock(&render->lock);
+	}
+	for (int i = 0; i < nclosing; i++) {
+		struct view_window *w = closing[i];
+		struct shared_volume *volume = w->volume;
+		glfwMakeContextCurrent(w->window);
+		delete_window_drawing(w);
+		if (volume->nwindows == 1) delete_shared_volume(volume);
+		volume->nwindows--;
+		glfwMakeContextCurrent(NULL);
+		pthread_mutex_lock(&render->lock);
+		w->stage = WINDOW_CLOSED;
+		pthread_mutex_unlock(&render->lock);
+		glfwPostEmptyEvent();
+	}
+	return nwindows;
+}
+
 
-		// Draw: TODO: when do I have to redraw, also don't swapp buffers in that case
-		for (int i = 0; i <= 8; i += 4) {
-			glUniform1i(uniform_ratio_axis, plane_axes[i / 4][ratio_axis]);
-			glDrawArrays(GL_TRIANGLE_FAN, i, 4);
+
+void* render_loop(void *arg)
+{
+	struct render_thread *render = arg;
+	struct view_window *windows[MAX_OPEN_WINDOWS];
+	while (true) {
+		int nwindows = update_render_windows(render, windows);
+		pthread_mutex_lock(&render->lock);
+		bool quit = render->quit;
+		pthread_mutex_unlock(&render->lock);
+		if (quit) break;
+
+		for (int i = 0; i < nwindows; i++) take_view_state(windows[i]);
+
+		// Frames and changes of the volumes, in the context of any window since objects are shared
+		double timeout = -1;
+		for (int v = 0; v < render->nvolumes; v++) {
+			struct shared_volume *volume = &render->volumes[v];
+			if (volume->nwindows == 0 || nwindows == 0) continue;
+			struct change shown[3 * MAX_OPEN_WINDOWS];
+			int nshown = 0;
+			for (int i = 0; i < nwindows; i++) {
+				if (windows[i]->volume != volume) continue;
+				shown_boxes(windows[i], &shown[nshown]);
+				nshown += 3;
+			}
+			bool new_frame, new_labels;
+			bool new_data = update_shared_volume(volume, shown, nshown, &new_frame, &new_labels);
+			if (new_data || new_labels) {
+				for (int i = 0; i < nwindows; i++) {
+					if (windows[i]->volume != volume) continue;
+					windows[i]->new_labels |= new_labels;
+					if (!new_data) continue;
+					windows[i]->new_data = true;
+					windows[i]->new_frame |= new_frame;
+					if (!new_frame) invalidate_roi(&windows[i]->roi);
+				}
+			}
+			double t = cine_timeout(&volume->cine);
+			if (t >= 0 && (timeout < 0 || t < timeout)) timeout = t;
+			if (volume->npending > 0) timeout = 0;
 		}
 
-		// Crosses
-		glUseProgram(cross_program);
-		glBindVertexArray(crosses_vertex_array);
-		glUniform1i(cross_vertical, 0);
-		glDrawArraysInstanced(GL_LINES, 0, 2, 3);
-		glUniform1i(cross_vertical, 1);
-		glDrawArraysInstanced(GL_LINES, 2, 2, 3);
+		// Draw, or wait until something needs to be drawn
+		bool drawn = false;
+		for (int i = 0; i < nwindows; i++) {
+			struct view_window *w = windows[i];
+			if (!needs_drawing(w)) {
+				trace_stage(&w->trace, TRACE_WAIT);
+				// Frames read back while recording are collected without drawing
+				double t = recorder_timeout(&w->recorder);
+				if (t >= 0) {
+					glfwMakeContextCurrent(w->window);
+					collect_recorded(&w->recorder, false);
+					t = recorder_timeout(&w->recorder);
+					if (t >= 0 && (timeout < 0 || t < timeout)) timeout = t;
+				}
+				continue;
+			}
+			glfwMakeContextCurrent(w->window);
+			if (draw_view_window(w)) {
+				for (int j = 0; j < nwindows; j++) {
+					if (j != i && windows[j]->volume == w->volume) windows[j]->check_bricks = true;
+				}
+			}
+			drawn = true;
+		}
+		if (drawn) {
+			// Keys which are held apply once per drawn frame
+			glfwPostEmptyEvent();
+			continue;
+		}
+		wait_render_thread(render, timeout);
+	}
+	return NULL;
+}
+
 
-		// Flush and swap
-		glFlush();
-		glfwSwapBuffers(window);
+
+// Windows of all listed viewers are served by one event loop on this thread and drawn by one render thread,
+// they share one set of GL objects: each viewer's volume is uploaded once, however many windows show it.
+// Viewers can join while it runs (list_viewer()), those which quit leave once their windows are closed.
+// With grid_view, the windows of the first viewer show all viewers side by side, the others open none.
+// Runs until all windows are closed and no viewer waits for one, glfwInit() must have been called on this thread.
+// Returns false if a window couldn't be opened or set up, the viewers' started tells which (set_viewer_started()).
+bool poirot(struct viewer_list *list, int width, int height)
+{
+	struct render_thread render = { .nvolumes = MAX_VIEWERS };
+	render.volumes = calloc(MAX_VIEWERS, sizeof(struct shared_volume)); // Per slot of the list
+	pthread_mutex_init(&render.lock, NULL);
+	pthread_cond_init(&render.cond, NULL);
+	pthread_create(&render.thread, NULL, render_loop, &render);
+	struct view_window **windows = render.windows;
+	bool traced = false; // Only the first window writes the trace
+	bool failed = false;
+	int nlinks = 1; // Link 1 is that of link_all
+	struct viewer *viewers[MAX_VIEWERS];
+	pthread_mutex_lock(&list->lock);
+	list->running = true;
+	for (int v = 0; v < MAX_VIEWERS; v++) {
+		if (list->viewers[v] != NULL) set_viewer_open(list->viewers[v], true);
 	}
+	pthread_mutex_unlock(&list->lock);
 
-	// Clean up
-	glfwDestroyWindow(window);
+	while (true) {
+		pthread_mutex_lock(&list->lock);
+		memcpy(viewers, list->viewers, sizeof(viewers));
+		pthread_mutex_unlock(&list->lock);
+		int nviewers = 0;
+		for (int v = 0; v < MAX_VIEWERS; v++) nviewers += viewers[v] != NULL;
 
-	return;
+		// Windows asked for by the viewers
+		for (int v = 0; v < (grid_view ? 1 : MAX_VIEWERS); v++) {
+			if (viewers[v] == NULL || viewer_should_quit(viewers[v])) continue;
+			uint64_t linked;
+			int n = take_new_windows(viewers[v], &linked);
+			for (int i = 0; i < n; i++) {
+				if (render.nwindows == MAX_OPEN_WINDOWS) {
+					printf("Error: can't open more than %d windows\n", MAX_OPEN_WINDOWS);
+					break;
+				}
+				struct view_window *w = malloc(sizeof(struct view_window));
+				GLFWwindow *share = render.nwindows > 0 ? windows[0]->window : NULL;
+				if (!setup_view_window(
+					w, &list->viewers[v], grid_view ? nviewers : 1, &render.volumes[v], share, width, height, traced ? NULL : trace_path
+				)) {
+					free(w);
+					set_viewer_started(viewers[v], false);
+					failed = true;
+					break;
+				}
+				// A linked window joins the link of the viewer's windows, which get a new one if they have none
+				w->link = link_all;
+				if (i < 64 && linked >> i & 1) {
+					for (int j = 0; j < render.nwindows; j++) {
+						if (windows[j]->viewer == viewers[v] && windows[j]->link != 0) w->link = windows[j]->link;
+					}
+					if (w->link == 0) w->link = ++nlinks;
+					for (int j = 0; j < render.nwindows; j++) {
+						if (windows[j]->viewer == viewers[v]) windows[j]->link = w->link;
+					}
+				}
+				traced = true;
+				pthread_mutex_lock(&render.lock);
+				windows[render.nwindows++] = w;
+				pthread_mutex_unlock(&render.lock);
+			}
+		}
+
+		// Windows which the render thread is done with
+		for (int i = 0; i < render.nwindows; i++) {
+			struct view_window *w = windows[i];
+			pthread_mutex_lock(&render.lock);
+			bool closed = w->stage == WINDOW_CLOSED;
+			if (closed) windows[i--] = windows[--render.nwindows];
+			pthread_mutex_unlock(&render.lock);
+			if (!closed) continue;
+			delete_view_window(w);
+			free(w);
+		}
+
+		// Viewers which quit leave once their windows are closed, their volume is deleted by then
+		for (int v = 0; v < MAX_VIEWERS; v++) {
+			struct viewer *viewer = viewers[v];
+			if (viewer == NULL) continue;
+			int n = 0;
+			for (int i = 0; i < render.nwindows; i++) n += windows[i]->viewer == viewer;
+			pthread_mutex_lock(&viewer->lock);
+			viewer->nwindows = n;
+			bool leaving = n == 0 && viewer->quit;
+			if (leaving) viewer->open = false;
+			pthread_mutex_unlock(&viewer->lock);
+			if (!leaving) continue;
+			set_viewer_started(viewer, false);
+			pthread_mutex_lock(&list->lock);
+			list->viewers[v] = NULL;
+			pthread_cond_broadcast(&list->cond);
+			pthread_mutex_unlock(&list->lock);
+		}
+
+		// Unless a viewer joined since the windows were taken
+		if (render.nwindows == 0) {
+			bool waiting = false;
+			pthread_mutex_lock(&list->lock);
+			for (int v = 0; v < (grid_view ? 1 : MAX_VIEWERS); v++) {
+				struct viewer *viewer = list->viewers[v];
+				if (viewer == NULL) continue;
+				pthread_mutex_lock(&viewer->lock);
+				waiting |= viewer->new_windows > 0 && !viewer->quit;
+				pthread_mutex_unlock(&viewer->lock);
+			}
+			if (!waiting) stop_viewer_list(list);
+			pthread_mutex_unlock(&list->lock);
+			if (!waiting) break;
+			continue;
+		}
+
+		// Input, the other windows of a link follow a window whose view moved
+		for (int i = 0; i < render.nwindows; i++) {
+			struct view_window *w = windows[i];
+			if (w->closing) continue;
+			float planes[3][4][3];
+			memcpy(planes, w->state.planes, sizeof(planes));
+			if (poll_view_window(w)) {
+				pthread_mutex_lock(&render.lock);
+				w->closing = true;
+				pthread_mutex_unlock(&render.lock);
+				continue;
+			}
+			if (w->link == 0 || memcmp(planes, w->state.planes, sizeof(planes)) == 0) continue;
+			for (int j = 0; j < render.nwindows; j++) {
+				struct view_window *other = windows[j];
+				if (other == w || other->link != w->link || other->closing) continue;
+				follow_view(
+					w->state.planes, &w->state.orientation,
+					other->state.planes, other->centres, other->state.centres_window, &other->state.orientation
+				);
+			}
+		}
+		for (int i = 0; i < render.nwindows; i++) {
+			if (!windows[i]->closing) publish_view_state(windows[i]);
+		}
+
+		// Also for events which weren't input, e.g. a frame of the cine or a change of the viewer
+		wake_render_thread(&render);
+		glfwWaitEvents();
+	}
+
+	pthread_mutex_lock(&render.lock);
+	render.quit = true;
+	render.woken = true;
+	pthread_cond_signal(&render.cond);
+	pthread_mutex_unlock(&render.lock);
+	pthread_join(render.thread, NULL);
+	pthread_mutex_destroy(&render.lock);
+	pthread_cond_destroy(&render.cond);
+	free(render.volumes);
+	return !failed && !render.failed;
 }
 
 
@@ -292,8 +1101,156 @@ void poirot_done()
 
 
 
+#include "headless.c"
+
+#ifndef POIROT_NO_MAIN
+bool is_number(const char *s)
+{
+	if (*s == '\0') return false;
+	for (; *s != '\0'; s++) if (*s < '0' || *s > '9') return false;
+	return true;
+}
+
+
+
 int main(int argc, char* argv[])
 {
+	int opt;
+	int dtype = DTYPE_FLOAT32;
+	const char *views_path = NULL;
+	const char *export_directory = ".";
+	int windows_per_volume = 1;
+	bool live = false;
+	const char *pack_path = NULL;
+	const char *labels_path = NULL;
+	#if defined(WITH_ZSTD)
+		int codec = CODEC_ZSTD;
+	#elif defined(WITH_LZ4)
+		int codec = CODEC_LZ4;
+	#else
+		int codec = CODEC_NONE;
+	#endif
+	int filter = FILTER_NONE;
+	while ((opt = getopt(argc, argv, "b:t:x:o:T:w:lLsRp:c:m:P:g")) != -1) {
+		switch (opt) {
+			case 'b':
+				texture_budget = (size_t)atol(optarg) << 20;
+				break;
+			case 't':
+				dtype = -1;
+				for (int i = 0; i < NUM_DTYPES; i++) {
+					if (strcmp(optarg, dtype_names[i]) == 0) dtype = i;
+				}
+				if (dtype == -1) {
+					printf("Error: unknown data type %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'x':
+				views_path = optarg;
+				break;
+			case 'o':
+				export_directory = optarg;
+				record_directory = optarg;
+				break;
+			case 'R':
+				record_raw = true;
+				break;
+			case 'T':
+				trace_path = optarg;
+				break;
+			case 'w':
+				windows_per_volume = fmax(1, atoi(optarg));
+				break;
+			case 'l':
+				link_all = true;
+				break;
+			case 'L':
+				live = true;
+				break;
+			case 's':
+				slice_only = true;
+				break;
+			case 'p':
+				pack_path = optarg;
+				break;
+			case 'c':
+				if (!parse_codec(optarg, &codec, &filter)) {
+					printf("Error: unknown codec %s, need none, lz4 or zstd, optionally after delta+\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'g':
+				grid_view = true;
+				break;
+			case 'm':
+				labels_path = optarg;
+				break;
+			case 'P':
+				load_label_palette(optarg);
+				break;
+			default:
+				optind = argc;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	// A raw file is followed by its size, otherwise every argument is a file
+	bool raw = (argc == 4 || argc == 5) && is_number(argv[1]);
+	int nvolumes = raw ? 1 : argc;
+	if (nvolumes < 1 || nvolumes > MAX_VIEWERS || ((views_path != NULL || pack_path != NULL) && nvolumes > 1)) {
+		printf(
+			"Usage: poirot [-b budget_MiB] [-w windows] [-l] [-L] [-s] [-g] [-T trace.json] [-o directory] [-R] [-m labels] [-P palette.txt] file.npy|file.nii|file.pcv ...\n"
+			"       poirot [-b budget_MiB] [-w windows] [-l] [-L] [-s] [-g] [-T trace.json] [-o directory] [-R] [-m labels] [-P palette.txt] [-t dtype] file.raw size_x size_y size_z [nframes]\n"
+			"       poirot [-b budget_MiB] -x views.txt [-o directory] file.npy|file.nii|file.pcv\n"
+			"       poirot [-b budget_MiB] -x views.txt [-o directory] [-t dtype] file.raw size_x size_y size_z [nframes]\n"
+			"       poirot -p packed.pcv [-c [delta+]none|lz4|zstd] file.npy|file.nii|file.pcv\n"
+			"       poirot -p packed.pcv [-c [delta+]none|lz4|zstd] [-t dtype] file.raw size_x size_y size_z [nframes]\n"
+		);
+		exit(EXIT_FAILURE);
+	}
+	struct volume volumes[nvolumes];
+	struct chunked_image chunked[nvolumes];
+	struct chunked_image *chunks[nvolumes]; // NULL if not chunked
+	void *images[nvolumes];
+	for (int v = 0; v < nvolumes; v++) {
+		volumes[v] = (struct volume) { .dtype = dtype, .nframes = 1 };
+		if (raw) {
+			for (int i = 0; i < 3; i++) volumes[v].size[i] = atoi(argv[1 + i]);
+			if (argc == 5) volumes[v].nframes = atoi(argv[4]);
+		}
+		open_volume(argv[v], &volumes[v]);
+		chunks[v] = NULL;
+		if (volumes[v].format == VOLUME_CHUNKED) {
+			if (live) {
+				printf("Error: chunked volumes can't be watched, %s\n", argv[v]);
+				exit(EXIT_FAILURE);
+			}
+			chunks[v] = &chunked[v];
+			images[v] = open_chunked_image(chunks[v], &volumes[v]);
+		}
+		else images[v] = map_volume(&volumes[v]);
+	}
+
+	if (views_path != NULL || pack_path != NULL) {
+		struct volume *volume = &volumes[0];
+		ptrdiff_t strides[4];
+		contiguous_strides(volume->dtype, volume->size, strides);
+		if (views_path != NULL) {
+			load_box(chunks[0], 0, NULL, NULL);
+			export_views(images[0], volume->dtype, volume->size, strides, views_path, export_directory, window_width, window_height);
+			release_box(chunks[0], 0, NULL, NULL);
+		}
+		else {
+			load_box(chunks[0], -1, NULL, NULL);
+			pack_chunked(pack_path, images[0], volume->dtype, volume->size, strides, volume->nframes, codec, filter);
+			release_box(chunks[0], -1, NULL, NULL);
+		}
+		if (chunks[0] != NULL) close_chunked_image(chunks[0]);
+		close_volume(volume);
+		return 0;
+	}
+
 	if (!glfwInit()) {
 		printf("Error: could not initialise GLFW");
 		exit(EXIT_FAILURE);
@@ -303,10 +1260,64 @@ int main(int argc, char* argv[])
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwSetErrorCallback(error_callback);
 
-	poirot(800, 600);
+	// Raw label maps have the image's size, 1 or 2 bytes per voxel by their length
+	struct volume label_volume = { .dtype = DTYPE_UINT8, .nframes = 1 };
+	void *labels = NULL;
+	if (labels_path != NULL) {
+		if (nvolumes > 1 && !grid_view) {
+			printf("Error: a label map needs a single volume or a grid\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(label_volume.size, volumes[0].size, sizeof(label_volume.size));
+		open_volume(labels_path, &label_volume);
+		size_t voxels = (size_t)volumes[0].size[0] * volumes[0].size[1] * volumes[0].size[2];
+		if (label_volume.format == VOLUME_RAW && label_volume.length == 2 * voxels) label_volume.dtype = DTYPE_UINT16;
+		if (label_volume.format == VOLUME_CHUNKED || !is_label_dtype(label_volume.dtype)) {
+			printf("Error: label maps need uint8, int16 or uint16 voxels and can't be chunked, %s\n", labels_path);
+			exit(EXIT_FAILURE);
+		}
+		if (memcmp(label_volume.size, volumes[0].size, sizeof(label_volume.size)) != 0 || label_volume.nframes != 1) {
+			printf("Error: label map %s needs one frame of %d x %d x %d voxels\n",
+				labels_path, volumes[0].size[0], volumes[0].size[1], volumes[0].size[2]
+			);
+			exit(EXIT_FAILURE);
+		}
+		labels = map_volume(&label_volume);
+	}
+
+	struct viewer viewers[nvolumes];
+	struct viewer_list list;
+	setup_viewer_list(&list);
+	struct watch watches[nvolumes];
+	struct watch label_watch;
+	for (int v = 0; v < nvolumes; v++) {
+		struct volume *volume = &volumes[v];
+		setup_viewer(&viewers[v], images[v], volume->dtype, volume->size, NULL, volume->nframes);
+		viewers[v].chunks = chunks[v];
+		viewers[v].new_windows = windows_per_volume;
+		list_viewer(&list, &viewers[v]);
+		if (live && !start_watch(&watches[v], &viewers[v], volume->path, watch_interval, false)) exit(1);
+	}
+	if (grid_view && nvolumes > 1) check_grid(list.viewers, nvolumes);
+	if (labels != NULL) {
+		set_viewer_labels(&viewers[0], labels, label_volume.dtype, NULL);
+		if (live && !start_watch(&label_watch, &viewers[0], labels_path, watch_interval, true)) exit(1);
+	}
+	bool ok = poirot(&list, 800, 600);
 
 	poirot_done();
+	if (labels != NULL) {
+		if (live) stop_watch(&label_watch);
+		close_volume(&label_volume);
+	}
+	for (int v = 0; v < nvolumes; v++) {
+		if (live) stop_watch(&watches[v]);
+		delete_viewer(&viewers[v]);
+		if (chunks[v] != NULL) close_chunked_image(chunks[v]);
+		close_volume(&volumes[v]);
+	}
+	delete_viewer_list(&list);
 
-	return 0;
+	return ok ? 0 : EXIT_FAILURE;
 }
-
+#endif
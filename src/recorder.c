@@ -0,0 +1,170 @@
+// Recording of a window (F2), e.g. while cine plays: every drawn frame is read into a ring of pixel pack buffers
+// without waiting, and a fence per slot tells when the GPU has copied it, usually a frame or two later.
+// Then the pixels are handed to an image writer (image_writer.c), whose threads write numbered PNGs or one raw RGB video.
+// Frames which find the ring or the writer's queue full are dropped and counted instead of holding up the render loop.
+#ifndef RECORD_RING_SIZE
+	#define RECORD_RING_SIZE 4
+#endif
+
+struct recorder {
+	bool requested;     // By the input thread
+	bool recording;
+	bool raw;
+	char prefix[4096];  // Of the files, directory/record_NN
+	int width, height;  // Of the raw video, frames of other sizes are dropped
+	int fd;
+	GLuint buffers[RECORD_RING_SIZE];
+	size_t buffer_bytes[RECORD_RING_SIZE];
+	GLsync fences[RECORD_RING_SIZE];
+	int slot_width[RECORD_RING_SIZE], slot_height[RECORD_RING_SIZE];
+	int head, count;    // Slots being read back, oldest first
+	long frames, queued; // Drawn while recording and handed to the writer, which numbers them
+	struct image_writer writer;
+};
+
+const char *record_directory = "."; // Set with -o
+bool record_raw = false;            // -R, one raw video instead of PNGs
+int recordings = 0;                 // Of all windows, numbers the files
+
+
+
+// F2 on the input thread, previous is the key's state
+void handle_record_keys(GLFWwindow *window, bool *recording, bool *previous)
+{
+	bool state = key_down(window, GLFW_KEY_F2);
+	if (state && !*previous) *recording = !*recording;
+	*previous = state;
+	return;
+}
+
+
+
+// Slots whose copy is done are handed to the writer, all of them if wait
+void collect_recorded(struct recorder *recorder, bool wait)
+{
+	while (recorder->count > 0) {
+		int s = recorder->head;
+		GLenum status = glClientWaitSync(recorder->fences[s], 0, wait ? GL_TIMEOUT_IGNORED : 0);
+		if (status == GL_TIMEOUT_EXPIRED) break;
+		glDeleteSync(recorder->fences[s]);
+		int width = recorder->slot_width[s];
+		int height = recorder->slot_height[s];
+		size_t bytes = (size_t)3 * width * height;
+		unsigned char *pixels = malloc(bytes);
+		const void *mapped = glMapNamedBufferRange(recorder->buffers[s], 0, bytes, GL_MAP_READ_BIT);
+		memcpy(pixels, mapped, bytes);
+		glUnmapNamedBuffer(recorder->buffers[s]);
+
+		char path[4096 + 16];
+		snprintf(path, sizeof(path), "%s_%05ld.png", recorder->prefix, recorder->queued);
+		off_t offset = bytes * recorder->queued;
+		if (try_queue_image(&recorder->writer, recorder->raw ? NULL : path, pixels, width, height, recorder->fd, offset)) {
+			recorder->queued++;
+		}
+		else free(pixels);
+		recorder->head = (s + 1) % RECORD_RING_SIZE;
+		recorder->count--;
+	}
+	return;
+}
+
+
+
+// Seconds until slots should be collected, negative if none are pending
+double recorder_timeout(struct recorder *recorder)
+{
+	return recorder->count > 0 ? 0.002 : -1;
+}
+
+
+
+void start_recording(struct recorder *recorder, int width, int height)
+{
+	recorder->raw = record_raw;
+	snprintf(recorder->prefix, sizeof(recorder->prefix), "%s/record_%02d", record_directory, recordings++);
+	recorder->width = width;
+	recorder->height = height;
+	recorder->fd = -1;
+	if (recorder->raw) {
+		char path[4096 + 16];
+		snprintf(path, sizeof(path), "%s.rgb", recorder->prefix);
+		recorder->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (recorder->fd == -1) {
+			printf("Error: could not create %s\n", path);
+			return;
+		}
+		printf("Recording %d x %d RGB video to %s\n", width, height, path);
+	}
+	else printf("Recording to %s_*.png\n", recorder->prefix);
+	recorder->frames = 0;
+	recorder->queued = 0;
+	setup_image_writer(&recorder->writer);
+	recorder->recording = true;
+	return;
+}
+
+
+
+// Waits until all frames are written
+void stop_recording(struct recorder *recorder)
+{
+	if (!recorder->recording) return;
+	collect_recorded(recorder, true);
+	delete_image_writer(&recorder->writer);
+	if (recorder->fd != -1) close(recorder->fd);
+	recorder->recording = false;
+	printf("Recorded %ld frames, %ld dropped", recorder->queued, recorder->frames - recorder->queued);
+	if (recorder->raw) {
+		printf(", play with ffplay -f rawvideo -pixel_format rgb24 -video_size %dx%d %s.rgb", recorder->width, recorder->height, recorder->prefix);
+	}
+	printf("\n");
+	return;
+}
+
+
+
+// On the render thread, in the window's context
+void set_recording(struct recorder *recorder, bool recording, int width, int height)
+{
+	if (recording == recorder->requested) return;
+	recorder->requested = recording;
+	if (recording) start_recording(recorder, width, height);
+	else stop_recording(recorder);
+	return;
+}
+
+
+
+// After drawing into the back buffer of the default framebuffer, before swapping
+void record_frame(struct recorder *recorder, int width, int height)
+{
+	collect_recorded(recorder, false);
+	if (!recorder->recording) return;
+	recorder->frames++;
+	bool resized = recorder->raw && (width != recorder->width || height != recorder->height);
+	if (recorder->count == RECORD_RING_SIZE || resized) return;
+	int s = (recorder->head + recorder->count) % RECORD_RING_SIZE;
+	size_t bytes = (size_t)3 * width * height;
+	if (recorder->buffers[s] == 0) glCreateBuffers(1, &recorder->buffers[s]);
+	if (recorder->buffer_bytes[s] < bytes) {
+		glNamedBufferData(recorder->buffers[s], bytes, NULL, GL_STREAM_READ);
+		recorder->buffer_bytes[s] = bytes;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, recorder->buffers[s]);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	recorder->fences[s] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	recorder->slot_width[s] = width;
+	recorder->slot_height[s] = height;
+	recorder->count++;
+	return;
+}
+
+
+
+void delete_recorder(struct recorder *recorder)
+{
+	stop_recording(recorder);
+	glDeleteBuffers(RECORD_RING_SIZE, recorder->buffers);
+	return;
+}
@@ -0,0 +1,864 @@
+#include <pthread.h>
+
+// Statistics of a region of interest and time curves, computed on the CPU from the image by a worker thread.
+// The region is a box dragged on a plane with B held, as thick as the slab, or a mask painted with D held.
+// Mean, standard deviation, minimum and maximum of every frame are reduced in parallel over layers of z,
+// with partial results in lanes so that the loops vectorise. Frames follow one another in the image, so the time curve
+// of a voxel strides through all of them: T plots the curve under the cursor and, if it fits into time_cache_budget,
+// copies the image with time innermost in the background, from which curves are read at once and the statistics
+// of all frames are reduced in one pass. Plots are drawn into the empty quarter of the window.
+// Complex values count by their magnitude.
+#ifndef ROI_BRUSH
+	#define ROI_BRUSH 4 // Radius in voxels
+#endif
+#define ROI_LANES 8
+#define NUM_ROI_KEYS 4
+#define MAX_ROI_LINES 16
+
+enum roi_shape { ROI_NONE, ROI_BOX, ROI_MASK };
+enum roi_statistic { ROI_MEAN, ROI_STD, ROI_MIN, ROI_MAX, NUM_ROI_STATISTICS };
+
+// Part of the view state, drawn by the render thread
+struct roi_view {
+	bool curves;
+	bool outline;             // Of the box
+	float lower[3], upper[3]; // View coordinates
+};
+
+// Input thread
+struct roi_input {
+	char previous[NUM_ROI_KEYS];
+	char plane; // Drawn on, -1 while the button is released
+	float start[3];
+	struct orientation orientation; // Of the outline, which is dropped when turning the planes
+};
+
+struct roi {
+	const char *image;
+	struct chunked_image *chunks; // NULL unless the image is decoded on demand
+	int dtype;
+	int size[3];
+	ptrdiff_t strides[4];
+	int nframes;
+	bool started;
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	// Set by the input thread
+	char shape;
+	int lower[3], upper[3];   // Voxels, of the box or around the mask
+	unsigned char *mask;      // Per voxel of a frame, allocated when first painted
+	unsigned int generation;  // Of the region
+	int cursor[3];            // Voxel
+	bool curves;
+	bool report;              // Print the statistics when done
+	bool cache_tried;
+	bool quit;
+	// Results of the worker
+	float *statistics;        // NUM_ROI_STATISTICS per frame
+	int nstatistics;          // Frames done
+	unsigned int done_generation;
+	double count;             // Voxels in the region
+	float *curve;
+	int curve_voxel[3];       // -1 if none
+	bool new_results;
+	// Time innermost, filled along z by the worker
+	float *cache;
+	int cached;               // Slices
+	unsigned int cache_generation; // Of the image, slices filled from an older one are dropped
+};
+
+// A copy of the region, which the input thread may change while it is reduced
+struct roi_region {
+	char shape;
+	int lower[3], upper[3];
+	const unsigned char *mask; // Painted while reading it, the generation tells
+	unsigned int generation;
+};
+
+struct roi_task {
+	struct roi *roi;
+	const struct roi_region *region;
+	int frame; // -1 for all frames, from the cache
+	int z_begin, z_end;
+	float *buffer;
+	double *sum, *squares; // Per frame
+	float *min, *max;
+	double count;
+};
+
+// Render thread
+struct roi_line {
+	int first, count;
+	int plane; // Scissored to, -1 for none
+	float colour[4];
+};
+
+struct roi_plot {
+	GLuint program, shaders[2], buffer, vertex_array;
+	GLint uniform_colour;
+	float *points;
+};
+
+
+
+void setup_roi(
+	struct roi *roi, const char *image, struct chunked_image *chunks, int dtype, int size[3], const ptrdiff_t strides[4], int nframes
+) {
+	memset(roi, 0, sizeof(struct roi));
+	roi->image = image;
+	roi->chunks = chunks;
+	roi->dtype = dtype;
+	memcpy(roi->size, size, sizeof(roi->size));
+	memcpy(roi->strides, strides, sizeof(roi->strides));
+	roi->nframes = nframes;
+	roi->statistics = malloc(sizeof(float) * NUM_ROI_STATISTICS * nframes);
+	roi->curve = malloc(sizeof(float) * nframes);
+	for (int i = 0; i < 3; i++) roi->curve_voxel[i] = -1;
+	pthread_mutex_init(&roi->lock, NULL);
+	pthread_cond_init(&roi->cond, NULL);
+	return;
+}
+
+
+
+// Tasks to split n layers into, one per thread of the shared workers (workers.c) and the caller
+int roi_tasks(int n)
+{
+	return fmax(1, fmin(shared_workers()->nthreads + 1, n));
+}
+
+
+
+// Complex values as their magnitude, out needs space for two floats per value
+void load_roi_row(int dtype, const char *in, ptrdiff_t stride, float *restrict out, int n)
+{
+	load_row(dtype, in, stride, out, n);
+	if (dtype_channels[dtype] == 2) for (int i = 0; i < n; i++) out[i] = hypotf(out[2 * i], out[2 * i + 1]);
+	return;
+}
+
+
+
+// Weighted by 0 or 1, lanes are independent so that the compiler can keep them in vector registers
+void reduce_row(const float *restrict values, const float *restrict weights, int n, double *sum, double *squares, float *min, float *max, double *count)
+{
+	float lane_sum[ROI_LANES] = {0}, lane_squares[ROI_LANES] = {0}, lane_count[ROI_LANES] = {0};
+	float lane_min[ROI_LANES], lane_max[ROI_LANES];
+	for (int l = 0; l < ROI_LANES; l++) {
+		lane_min[l] = INFINITY;
+		lane_max[l] = -INFINITY;
+	}
+	int i = 0;
+	for (; i + ROI_LANES <= n; i += ROI_LANES) {
+		for (int l = 0; l < ROI_LANES; l++) {
+			float v = values[i + l], w = weights[i + l];
+			lane_sum[l] += w * v;
+			lane_squares[l] += w * v * v;
+			lane_count[l] += w;
+			lane_min[l] = w != 0 && v < lane_min[l] ? v : lane_min[l];
+			lane_max[l] = w != 0 && v > lane_max[l] ? v : lane_max[l];
+		}
+	}
+	for (; i < n; i++) {
+		float v = values[i], w = weights[i];
+		lane_sum[0] += w * v;
+		lane_squares[0] += w * v * v;
+		lane_count[0] += w;
+		lane_min[0] = w != 0 && v < lane_min[0] ? v : lane_min[0];
+		lane_max[0] = w != 0 && v > lane_max[0] ? v : lane_max[0];
+	}
+	for (int l = 0; l < ROI_LANES; l++) {
+		*sum += lane_sum[l];
+		*squares += lane_squares[l];
+		*count += lane_count[l];
+		*min = fmin(*min, lane_min[l]);
+		*max = fmax(*max, lane_max[l]);
+	}
+	return;
+}
+
+
+
+void* reduce_layers(void *arg)
+{
+	struct roi_task *task = arg;
+	struct roi *roi = task->roi;
+	const struct roi_region *region = task->region;
+	const ptrdiff_t *strides = roi->strides;
+	int *size = roi->size;
+	int n = region->upper[0] - region->lower[0];
+	int nframes = task->frame == -1 ? roi->nframes : 1;
+	float *values = task->buffer, *weights = task->buffer + 2 * n;
+	for (int f = 0; f < nframes; f++) {
+		task->sum[f] = task->squares[f] = 0;
+		task->min[f] = INFINITY;
+		task->max[f] = -INFINITY;
+	}
+	task->count = 0;
+	for (int z = task->z_begin; z < task->z_end; z++) {
+		for (int y = region->lower[1]; y < region->upper[1]; y++) {
+			size_t first = region->lower[0] + size[0] * ((size_t)y + size[1] * z);
+			if (region->shape == ROI_MASK) for (int x = 0; x < n; x++) weights[x] = region->mask[first + x];
+			else for (int x = 0; x < n; x++) weights[x] = 1;
+			if (task->frame != -1) {
+				const char *row = roi->image + task->frame * strides[3] + region->lower[0] * strides[0] + y * strides[1] + z * strides[2];
+				load_roi_row(roi->dtype, row, strides[0], values, n);
+				reduce_row(values, weights, n, task->sum, task->squares, task->min, task->max, &task->count);
+				continue;
+			}
+			// Time innermost, vectorised over frames
+			double *restrict sum = task->sum, *restrict squares = task->squares;
+			float *restrict min = task->min, *restrict max = task->max;
+			for (int x = 0; x < n; x++) {
+				if (weights[x] == 0) continue;
+				const float *restrict curve = roi->cache + (first + x) * nframes;
+				for (int f = 0; f < nframes; f++) {
+					float v = curve[f];
+					sum[f] += v;
+					squares[f] += v * v;
+					min[f] = v < min[f] ? v : min[f];
+					max[f] = v > max[f] ? v : max[f];
+				}
+				task->count++;
+			}
+		}
+	}
+	return NULL;
+}
+
+
+
+// Of one frame or, if frame is -1, of all frames from the cache. Layers of z are split into one task per thread
+// of the shared workers, each task reduces its layers into its own sums which are added up here.
+void reduce_region(struct roi *roi, const struct roi_region *region, int frame, float *statistics, double *count)
+{
+	int z_begin = region->lower[2];
+	int n = region->upper[2] - z_begin;
+	int ntasks = roi_tasks(n);
+	int nframes = frame == -1 ? roi->nframes : 1;
+	int width = region->upper[0] - region->lower[0];
+	if (frame != -1) load_box(roi->chunks, frame, region->lower, region->upper);
+	struct roi_task tasks[ntasks];
+	for (int t = 0; t < ntasks; t++) {
+		tasks[t] = (struct roi_task) { roi, region, frame, z_begin + t * n / ntasks, z_begin + (t + 1) * n / ntasks };
+		tasks[t].buffer = malloc(sizeof(float) * 3 * width);
+		tasks[t].sum = malloc(sizeof(double) * 2 * nframes);
+		tasks[t].squares = tasks[t].sum + nframes;
+		tasks[t].min = malloc(sizeof(float) * 2 * nframes);
+		tasks[t].max = tasks[t].min + nframes;
+	}
+	run_tasks(shared_workers(), reduce_layers, tasks, sizeof(struct roi_task), ntasks);
+	if (frame != -1) release_box(roi->chunks, frame, region->lower, region->upper);
+
+	*count = 0;
+	for (int t = 0; t < ntasks; t++) *count += tasks[t].count;
+	for (int f = 0; f < nframes; f++) {
+		double sum = 0, squares = 0;
+		float min = INFINITY, max = -INFINITY;
+		for (int t = 0; t < ntasks; t++) {
+			sum += tasks[t].sum[f];
+			squares += tasks[t].squares[f];
+			min = fmin(min, tasks[t].min[f]);
+			max = fmax(max, tasks[t].max[f]);
+		}
+		float *s = statistics + NUM_ROI_STATISTICS * f;
+		if (*count == 0) {
+			memset(s, 0, sizeof(float) * NUM_ROI_STATISTICS);
+			continue;
+		}
+		double mean = sum / *count;
+		s[ROI_MEAN] = mean;
+		s[ROI_STD] = sqrt(fmax(0, squares / *count - mean * mean));
+		s[ROI_MIN] = min;
+		s[ROI_MAX] = max;
+	}
+	for (int t = 0; t < ntasks; t++) {
+		free(tasks[t].buffer);
+		free(tasks[t].sum);
+		free(tasks[t].min);
+	}
+	return;
+}
+
+
+
+void* fill_cache_layers(void *arg)
+{
+	struct roi_task *task = arg;
+	struct roi *roi = task->roi;
+	const ptrdiff_t *strides = roi->strides;
+	int *size = roi->size;
+	int nframes = roi->nframes;
+	for (int z = task->z_begin; z < task->z_end; z++) {
+		for (int y = 0; y < size[1]; y++) {
+			const char *row = roi->image + y * strides[1] + z * strides[2];
+			for (int f = 0; f < nframes; f++) load_roi_row(roi->dtype, row + f * strides[3], strides[0], task->buffer + 2 * f * size[0], size[0]);
+			float *out = roi->cache + size[0] * ((size_t)y + size[1] * z) * nframes;
+			for (int x = 0; x < size[0]; x++) {
+				for (int f = 0; f < nframes; f++) out[x * nframes + f] = task->buffer[2 * f * size[0] + x];
+			}
+		}
+	}
+	return NULL;
+}
+
+
+
+// One slice per task on the shared workers
+void fill_cache(struct roi *roi, int z_begin, int z_end)
+{
+	int ntasks = z_end - z_begin;
+	int lower[3] = {0, 0, z_begin};
+	int upper[3] = {roi->size[0], roi->size[1], z_end};
+	load_box(roi->chunks, -1, lower, upper);
+	struct roi_task tasks[ntasks];
+	for (int t = 0; t < ntasks; t++) {
+		tasks[t] = (struct roi_task) { .roi = roi, .z_begin = z_begin + t, .z_end = z_begin + t + 1 };
+		tasks[t].buffer = malloc(sizeof(float) * 2 * roi->size[0] * roi->nframes);
+	}
+	run_tasks(shared_workers(), fill_cache_layers, tasks, sizeof(struct roi_task), ntasks);
+	release_box(roi->chunks, -1, lower, upper);
+	for (int t = 0; t < ntasks; t++) free(tasks[t].buffer);
+	return;
+}
+
+
+
+// From the cache if its slice is done, otherwise one voxel from every frame
+void read_curve(struct roi *roi, const int voxel[3], int cached, float *curve)
+{
+	int nframes = roi->nframes;
+	if (voxel[2] < cached) {
+		size_t i = voxel[0] + roi->size[0] * ((size_t)voxel[1] + roi->size[1] * voxel[2]);
+		memcpy(curve, roi->cache + i * nframes, sizeof(float) * nframes);
+		return;
+	}
+	const ptrdiff_t *strides = roi->strides;
+	int upper[3] = {voxel[0] + 1, voxel[1] + 1, voxel[2] + 1};
+	load_box(roi->chunks, -1, voxel, upper);
+	const char *v = roi->image + voxel[0] * strides[0] + voxel[1] * strides[1] + voxel[2] * strides[2];
+	for (int f = 0; f < nframes; f++) {
+		float value[2] = {0, 0};
+		load_roi_row(roi->dtype, v + f * strides[3], strides[0], value, 1);
+		curve[f] = value[0];
+	}
+	release_box(roi->chunks, -1, voxel, upper);
+	return;
+}
+
+
+
+// Expects the lock to be held
+void print_roi_statistics(struct roi *roi)
+{
+	if (roi->nframes > 1) {
+		printf("Region of %.0f voxels, statistics of %d frames are plotted\n", roi->count, roi->nframes);
+		return;
+	}
+	float *s = roi->statistics;
+	printf(
+		"Region of %.0f voxels: mean %g, std %g, min %g, max %g\n",
+		roi->count, s[ROI_MEAN], s[ROI_STD], s[ROI_MIN], s[ROI_MAX]
+	);
+	return;
+}
+
+
+
+// Work is done in small steps so that the curve under the cursor goes first, then statistics frame by frame,
+// then slices of the cache. Statistics which the region changed under are computed again.
+void* roi_worker(void *arg)
+{
+	struct roi *roi = arg;
+	int nframes = roi->nframes;
+	float *statistics = malloc(sizeof(float) * NUM_ROI_STATISTICS * nframes);
+	float *curve = malloc(sizeof(float) * nframes);
+	pthread_mutex_lock(&roi->lock);
+	while (!roi->quit) {
+		bool want_curve = roi->curves && memcmp(roi->curve_voxel, roi->cursor, sizeof(roi->cursor)) != 0;
+		bool want_statistics = roi->shape != ROI_NONE && (roi->done_generation != roi->generation || roi->nstatistics < nframes);
+		bool want_cache = roi->cache != NULL && roi->cached < roi->size[2];
+		if (!want_curve && !want_statistics && !want_cache) {
+			pthread_cond_wait(&roi->cond, &roi->lock);
+			continue;
+		}
+		int cached = roi->cached;
+		unsigned int cache_generation = roi->cache_generation;
+
+		if (want_curve) {
+			int voxel[3];
+			memcpy(voxel, roi->cursor, sizeof(voxel));
+			pthread_mutex_unlock(&roi->lock);
+			read_curve(roi, voxel, cached, curve);
+			pthread_mutex_lock(&roi->lock);
+			if (roi->cache_generation != cache_generation) continue;
+			memcpy(roi->curve, curve, sizeof(float) * nframes);
+			memcpy(roi->curve_voxel, voxel, sizeof(voxel));
+			roi->new_results = true;
+			glfwPostEmptyEvent();
+			continue;
+		}
+
+		if (want_statistics) {
+			if (roi->done_generation != roi->generation) {
+				roi->nstatistics = 0;
+				roi->done_generation = roi->generation;
+			}
+			struct roi_region region = { roi->shape, {0}, {0}, roi->mask, roi->generation };
+			memcpy(region.lower, roi->lower, sizeof(region.lower));
+			memcpy(region.upper, roi->upper, sizeof(region.upper));
+			int frame = roi->nstatistics;
+			bool all = cached == roi->size[2] && nframes > 1;
+			pthread_mutex_unlock(&roi->lock);
+			double count;
+			reduce_region(roi, &region, all ? -1 : frame, all ? statistics : statistics + NUM_ROI_STATISTICS * frame, &count);
+			pthread_mutex_lock(&roi->lock);
+			if (region.generation != roi->generation) continue;
+			int first = all ? 0 : frame;
+			roi->nstatistics = all ? nframes : frame + 1;
+			memcpy(
+				roi->statistics + NUM_ROI_STATISTICS * first, statistics + NUM_ROI_STATISTICS * first,
+				sizeof(float) * NUM_ROI_STATISTICS * (roi->nstatistics - first)
+			);
+			roi->count = count;
+			roi->new_results = true;
+			if (roi->nstatistics == nframes && roi->report) {
+				print_roi_statistics(roi);
+				roi->report = false;
+			}
+			glfwPostEmptyEvent();
+			continue;
+		}
+
+		int z_end = fmin(roi->size[2], cached + roi_tasks(roi->size[2]));
+		pthread_mutex_unlock(&roi->lock);
+		fill_cache(roi, cached, z_end);
+		pthread_mutex_lock(&roi->lock);
+		// Unless the data changed meanwhile
+		if (roi->cache_generation == cache_generation) roi->cached = z_end;
+	}
+	pthread_mutex_unlock(&roi->lock);
+	free(statistics);
+	free(curve);
+	return NULL;
+}
+
+
+
+// Expects the lock to be held
+void wake_roi(struct roi *roi)
+{
+	if (!roi->started) {
+		pthread_create(&roi->worker, NULL, roi_worker, roi);
+		roi->started = true;
+	}
+	pthread_cond_signal(&roi->cond);
+	return;
+}
+
+
+
+void set_roi_box(struct roi *roi, const int lower[3], const int upper[3])
+{
+	pthread_mutex_lock(&roi->lock);
+	for (int i = 0; i < 3; i++) {
+		roi->lower[i] = fmax(0, fmin(roi->size[i] - 1, lower[i]));
+		roi->upper[i] = fmax(roi->lower[i] + 1, fmin(roi->size[i], upper[i]));
+	}
+	roi->shape = ROI_BOX;
+	roi->generation++;
+	wake_roi(roi);
+	pthread_mutex_unlock(&roi->lock);
+	return;
+}
+
+
+
+// Marks the voxels within radius of centre and half a voxel of the plane through it, in voxels
+void paint_roi_mask(struct roi *roi, const float centre[3], const float normal[3], float radius)
+{
+	int *size = roi->size;
+	pthread_mutex_lock(&roi->lock);
+	if (roi->mask == NULL) roi->mask = calloc((size_t)size[0] * size[1] * size[2], 1);
+	if (roi->shape != ROI_MASK) {
+		memset(roi->mask, 0, (size_t)size[0] * size[1] * size[2]);
+		for (int i = 0; i < 3; i++) {
+			roi->lower[i] = size[i];
+			roi->upper[i] = 0;
+		}
+	}
+	int lower[3], upper[3];
+	for (int i = 0; i < 3; i++) {
+		lower[i] = fmax(0, floor(centre[i] - radius));
+		upper[i] = fmin(size[i], ceil(centre[i] + radius));
+	}
+	bool painted = false;
+	for (int z = lower[2]; z < upper[2]; z++) {
+		for (int y = lower[1]; y < upper[1]; y++) {
+			for (int x = lower[0]; x < upper[0]; x++) {
+				float d[3] = {x + 0.5 - centre[0], y + 0.5 - centre[1], z + 0.5 - centre[2]};
+				float distance = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+				float height = d[0] * normal[0] + d[1] * normal[1] + d[2] * normal[2];
+				if (distance > radius * radius || fabs(height) > 0.5) continue;
+				roi->mask[x + size[0] * ((size_t)y + size[1] * z)] = 1;
+				int voxel[3] = {x, y, z};
+				for (int i = 0; i < 3; i++) {
+					roi->lower[i] = fmin(roi->lower[i], voxel[i]);
+					roi->upper[i] = fmax(roi->upper[i], voxel[i] + 1);
+				}
+				painted = true;
+			}
+		}
+	}
+	if (painted) {
+		roi->shape = ROI_MASK;
+		roi->generation++;
+		wake_roi(roi);
+	}
+	pthread_mutex_unlock(&roi->lock);
+	return;
+}
+
+
+
+// The button was released, statistics are printed when done
+void finish_roi(struct roi *roi)
+{
+	pthread_mutex_lock(&roi->lock);
+	if (roi->shape != ROI_NONE && roi->done_generation == roi->generation && roi->nstatistics == roi->nframes) {
+		print_roi_statistics(roi);
+	}
+	else roi->report = true;
+	pthread_mutex_unlock(&roi->lock);
+	return;
+}
+
+
+
+void clear_roi(struct roi *roi)
+{
+	pthread_mutex_lock(&roi->lock);
+	roi->shape = ROI_NONE;
+	roi->generation++;
+	roi->nstatistics = 0;
+	roi->report = false;
+	roi->new_results = true;
+	pthread_mutex_unlock(&roi->lock);
+	return;
+}
+
+
+
+// The cache is allocated the first time, if it fits into the budget
+void show_roi_curves(struct roi *roi, bool curves)
+{
+	pthread_mutex_lock(&roi->lock);
+	roi->curves = curves;
+	if (curves && roi->nframes == 1) printf("Time curves need more than one frame\n");
+	if (curves && roi->nframes > 1 && !roi->cache_tried) {
+		roi->cache_tried = true;
+		size_t bytes = sizeof(float) * roi->size[0] * roi->size[1] * roi->size[2] * roi->nframes;
+		if (bytes <= time_cache_budget) roi->cache = malloc(bytes);
+		if (roi->cache == NULL) {
+			printf("Time curves are read from the frames, caching them needs %zu MiB\n", bytes >> 20);
+		}
+	}
+	if (curves) wake_roi(roi);
+	pthread_mutex_unlock(&roi->lock);
+	return;
+}
+
+
+
+void set_roi_cursor(struct roi *roi, const int voxel[3])
+{
+	pthread_mutex_lock(&roi->lock);
+	if (memcmp(roi->cursor, voxel, sizeof(roi->cursor)) != 0) {
+		memcpy(roi->cursor, voxel, sizeof(roi->cursor));
+		if (roi->curves) wake_roi(roi);
+	}
+	pthread_mutex_unlock(&roi->lock);
+	return;
+}
+
+
+
+// The image changed, everything is read again
+void invalidate_roi(struct roi *roi)
+{
+	pthread_mutex_lock(&roi->lock);
+	roi->generation++;
+	for (int i = 0; i < 3; i++) roi->curve_voxel[i] = -1;
+	roi->cached = 0;
+	roi->cache_generation++;
+	if (roi->started) pthread_cond_signal(&roi->cond);
+	pthread_mutex_unlock(&roi->lock);
+	return;
+}
+
+
+
+// B with the left mouse button drags a box on a plane, D paints a mask, X clears the region and T shows time curves.
+// Returns true if the left mouse button was used for the region, then it doesn't move the cursor.
+bool handle_roi_input(
+	GLFWwindow *window, struct roi_input *input, struct roi *roi, struct roi_view *view,
+	float mouse_window[2], bool left_button, float planes[3][4][3], const struct orientation *orientation, int thickness
+) {
+	const int keys[NUM_ROI_KEYS] = {GLFW_KEY_B, GLFW_KEY_D, GLFW_KEY_X, GLFW_KEY_T};
+	char held[NUM_ROI_KEYS], pressed[NUM_ROI_KEYS];
+	for (int i = 0; i < NUM_ROI_KEYS; i++) {
+		held[i] = key_down(window, keys[i]);
+		pressed[i] = held[i] && !input->previous[i];
+		input->previous[i] = held[i];
+	}
+	if (pressed[2]) {
+		clear_roi(roi);
+		view->outline = false;
+	}
+	if (pressed[3]) {
+		view->curves = !view->curves;
+		show_roi_curves(roi, view->curves);
+	}
+	if (view->outline && memcmp(&input->orientation, orientation, sizeof(struct orientation)) != 0) view->outline = false;
+
+	if (!left_button || !(held[0] || held[1])) {
+		if (input->plane != -1) finish_roi(roi);
+		input->plane = -1;
+		return false;
+	}
+	char plane = input->plane != -1 ? input->plane : current_plane(mouse_window[0], mouse_window[1]);
+	if (plane == -1) return true;
+
+	// View coordinates under the mouse, on the plane which it was pressed on
+	float in_plane[2], q[3];
+	int n = plane_axes[plane][2];
+	window2tex(plane, mouse_window, in_plane, planes[plane][0], planes[plane][2]);
+	for (int i = 0; i < 2; i++) q[plane_axes[plane][i]] = fmax(0, fmin(1, in_plane[i]));
+	q[n] = planes[plane][0][n];
+	// Voxels per unit of view coordinate along the normal, as in update_slab()
+	float length = 0;
+	for (int i = 0; i < 3; i++) length += pow(orientation->basis[i][n] * roi->size[i], 2);
+	length = sqrt(length);
+
+	if (held[0]) {
+		if (input->plane == -1) memcpy(input->start, q, sizeof(q));
+		for (int i = 0; i < 3; i++) {
+			view->lower[i] = fmin(input->start[i], q[i]);
+			view->upper[i] = fmax(input->start[i], q[i]);
+		}
+		float half = 0.5 * fmax(1, thickness) / length;
+		view->lower[n] = q[n] - half;
+		view->upper[n] = q[n] + half;
+		view->outline = true;
+		input->orientation = *orientation;
+		// Voxels around the box, it is oblique in texture coordinates if the planes are
+		int lower[3], upper[3];
+		for (int i = 0; i < 3; i++) {
+			lower[i] = roi->size[i];
+			upper[i] = 0;
+		}
+		for (int c = 0; c < 8; c++) {
+			float corner[3], tex[3];
+			for (int i = 0; i < 3; i++) corner[i] = c & (1 << i) ? view->upper[i] : view->lower[i];
+			orient(orientation, corner, tex);
+			for (int i = 0; i < 3; i++) {
+				lower[i] = fmin(lower[i], round(tex[i] * roi->size[i]));
+				upper[i] = fmax(upper[i], round(tex[i] * roi->size[i]));
+			}
+		}
+		set_roi_box(roi, lower, upper);
+	}
+	else {
+		// The plane's normal in voxels is the axis scaled by the inverse of the size
+		float tex[3], centre[3], normal[3], norm = 0;
+		orient(orientation, q, tex);
+		for (int i = 0; i < 3; i++) {
+			centre[i] = tex[i] * roi->size[i];
+			normal[i] = orientation->basis[i][n] / roi->size[i];
+			norm += normal[i] * normal[i];
+		}
+		for (int i = 0; i < 3; i++) normal[i] /= sqrt(norm);
+		paint_roi_mask(roi, centre, normal, ROI_BRUSH);
+		view->outline = false;
+	}
+	input->plane = plane;
+	return true;
+}
+
+
+
+void setup_roi_input(struct roi_input *input)
+{
+	memset(input, 0, sizeof(struct roi_input));
+	input->plane = -1;
+	return;
+}
+
+
+
+void setup_roi_plot(struct roi_plot *plot, int nframes)
+{
+	setup_plot_shaders(&plot->program, plot->shaders);
+	plot->uniform_colour = glGetUniformLocation(plot->program, "line_colour");
+	glCreateBuffers(1, &plot->buffer);
+	glGenVertexArrays(1, &plot->vertex_array);
+	// Outlines, axes, the frame and six curves
+	plot->points = malloc(sizeof(float) * 2 * (32 + 6 * nframes));
+	return;
+}
+
+
+
+// Render thread, returns true if there are new results to draw
+bool take_roi_results(struct roi *roi)
+{
+	pthread_mutex_lock(&roi->lock);
+	bool new_results = roi->new_results;
+	roi->new_results = false;
+	pthread_mutex_unlock(&roi->lock);
+	return new_results;
+}
+
+
+
+// Into the bound framebuffer: the box's outline where the slices cross it, and statistics and the curve under
+// the cursor over frames in the lower right quarter, the displayed frame is marked
+void draw_roi_plot(struct roi_plot *plot, struct roi *roi, const struct roi_view *view, float planes[3][4][3], int frame, int width, int height)
+{
+	struct roi_line lines[MAX_ROI_LINES];
+	int nlines = 0, npoints = 0;
+	float *points = plot->points;
+
+	if (view->outline) {
+		for (int p = 0; p < 3; p++) {
+			int n = plane_axes[p][2];
+			float slice = planes[p][0][n];
+			if (slice < view->lower[n] || slice > view->upper[n]) continue;
+			float bounds[2][2], window[2][2];
+			for (int i = 0; i < 2; i++) {
+				bounds[0][i] = view->lower[plane_axes[p][i]];
+				bounds[1][i] = view->upper[plane_axes[p][i]];
+			}
+			for (int b = 0; b < 2; b++) tex2window(p, bounds[b], window[b], planes[p][0], planes[p][2]);
+			const int corners[5][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}, {0, 0}};
+			lines[nlines] = (struct roi_line) { npoints, 5, p, {1.0, 0.8, 0.2, 1.0} };
+			for (int c = 0; c < 5; c++) {
+				points[2 * npoints]     = window[corners[c][0]][0];
+				points[2 * npoints + 1] = window[corners[c][1]][1];
+				npoints++;
+			}
+			nlines++;
+		}
+	}
+
+	pthread_mutex_lock(&roi->lock);
+	int nframes = roi->nframes;
+	int nstatistics = roi->shape == ROI_NONE ? 0 : roi->nstatistics;
+	bool curve = view->curves && roi->curve_voxel[0] != -1;
+	if (nframes > 1 && (nstatistics > 0 || curve)) {
+		const float x0 = 0.06, x1 = 0.94, y0 = -0.94, y1 = -0.06;
+		float lower = INFINITY, upper = -INFINITY;
+		for (int f = 0; f < nstatistics; f++) {
+			float *s = roi->statistics + NUM_ROI_STATISTICS * f;
+			lower = fmin(lower, s[ROI_MIN]);
+			upper = fmax(upper, s[ROI_MAX]);
+		}
+		for (int f = 0; curve && f < nframes; f++) {
+			lower = fmin(lower, roi->curve[f]);
+			upper = fmax(upper, roi->curve[f]);
+		}
+		float scale = upper > lower ? (y1 - y0) / (upper - lower) : 0;
+		float offset = upper > lower ? y0 - lower * scale : 0.5 * (y0 + y1);
+
+		const float axes[3][2] = {{x0, y1}, {x0, y0}, {x1, y0}};
+		const float grey[4] = {0.4, 0.4, 0.4, 1.0};
+		lines[nlines] = (struct roi_line) { npoints, 3, -1 };
+		memcpy(lines[nlines++].colour, grey, sizeof(grey));
+		for (int i = 0; i < 3; i++, npoints++) memcpy(&points[2 * npoints], axes[i], sizeof(axes[i]));
+		float x = x0 + (x1 - x0) * frame / (nframes - 1);
+		lines[nlines] = (struct roi_line) { npoints, 2, -1 };
+		memcpy(lines[nlines++].colour, grey, sizeof(grey));
+		for (int i = 0; i < 2; i++, npoints++) {
+			points[2 * npoints] = x;
+			points[2 * npoints + 1] = i == 0 ? y0 : y1;
+		}
+
+		// Minimum, maximum, mean minus and plus std, mean
+		const float colours[5][4] = {
+			{0.5, 0.5, 0.5, 1.0}, {0.5, 0.5, 0.5, 1.0}, {0.2, 0.6, 1.0, 1.0}, {0.2, 0.6, 1.0, 1.0}, {1.0, 1.0, 1.0, 1.0}
+		};
+		for (int c = 0; c < 5 && nstatistics > 0; c++) {
+			lines[nlines] = (struct roi_line) { npoints, nstatistics, -1 };
+			memcpy(lines[nlines++].colour, colours[c], sizeof(colours[c]));
+			for (int f = 0; f < nstatistics; f++, npoints++) {
+				float *s = roi->statistics + NUM_ROI_STATISTICS * f;
+				float value = (
+					c == 0 ? s[ROI_MIN] : c == 1 ? s[ROI_MAX] :
+					c == 2 ? s[ROI_MEAN] - s[ROI_STD] : c == 3 ? s[ROI_MEAN] + s[ROI_STD] : s[ROI_MEAN]
+				);
+				points[2 * npoints] = x0 + (x1 - x0) * f / (nframes - 1);
+				points[2 * npoints + 1] = offset + scale * value;
+			}
+		}
+		if (curve) {
+			lines[nlines++] = (struct roi_line) { npoints, nframes, -1, {0.0, 1.0, 0.0, 1.0} };
+			for (int f = 0; f < nframes; f++, npoints++) {
+				points[2 * npoints] = x0 + (x1 - x0) * f / (nframes - 1);
+				points[2 * npoints + 1] = offset + scale * roi->curve[f];
+			}
+		}
+	}
+	pthread_mutex_unlock(&roi->lock);
+	if (nlines == 0) return;
+
+	glNamedBufferData(plot->buffer, sizeof(float) * 2 * npoints, points, GL_STREAM_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, plot->buffer);
+	glUseProgram(plot->program);
+	glBindVertexArray(plot->vertex_array);
+	for (int l = 0; l < nlines; l++) {
+		// Outlines stay within their plane
+		int p = lines[l].plane;
+		if (p != -1) {
+			const float *v = &three_planes_vertices[8 * p];
+			int lower[2] = {(v[0] + 1) / 2 * width, (v[1] + 1) / 2 * height};
+			int upper[2] = {(v[4] + 1) / 2 * width, (v[5] + 1) / 2 * height};
+			glEnable(GL_SCISSOR_TEST);
+			glScissor(lower[0], lower[1], upper[0] - lower[0], upper[1] - lower[1]);
+		}
+		glUniform4fv(plot->uniform_colour, 1, lines[l].colour);
+		glDrawArrays(GL_LINE_STRIP, lines[l].first, lines[l].count);
+		glDisable(GL_SCISSOR_TEST);
+	}
+	return;
+}
+
+
+
+void delete_roi_plot(struct roi_plot *plot)
+{
+	glDeleteProgram(plot->program);
+	for (int i = 0; i < 2; i++) glDeleteShader(plot->shaders[i]);
+	glDeleteBuffers(1, &plot->buffer);
+	glDeleteVertexArrays(1, &plot->vertex_array);
+	free(plot->points);
+	return;
+}
+
+
+
+void delete_roi(struct roi *roi)
+{
+	pthread_mutex_lock(&roi->lock);
+	roi->quit = true;
+	if (roi->started) pthread_cond_signal(&roi->cond);
+	pthread_mutex_unlock(&roi->lock);
+	if (roi->started) pthread_join(roi->worker, NULL);
+	pthread_mutex_destroy(&roi->lock);
+	pthread_cond_destroy(&roi->cond);
+	free(roi->statistics);
+	free(roi->curve);
+	free(roi->mask);
+	free(roi->cache);
+	return;
+}
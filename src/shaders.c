@@ -1,27 +1,251 @@
 
 
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+
+// Reads the volume either from a single texture, through the brick cache (texture.c) or from the three slices (slices.c),
+// of which shaders drawing a plane take the plane's layer even if its slice moved and isn't uploaded yet.
+// In grid windows, the volume of the cell is read from the layers of the 2D array of all cells (grid.c).
+// Complex volumes have the real and imaginary part in two channels, complex_part picks what is shown.
+#define VOLUME_SAMPLING_SOURCE "\
+	#define BRICK_SIZE " TO_STRING(BRICK_SIZE) "                                            \n\
+	layout (binding = 0) uniform sampler3D tex;                                             \n\
+	layout (binding = 1) uniform usampler3D bricks;                                         \n\
+	layout (binding = 4) uniform sampler2DArray slices;                                     \n\
+	layout (binding = 7) uniform sampler2DArray cells;                                      \n\
+	uniform bool bricked;                                                                   \n\
+	uniform bool gridded;                                                                   \n\
+	int cell = 0;                                                                           \n\
+	uniform bool sliced;                                                                    \n\
+	uniform ivec3 slices_shown;                                                             \n\
+	int slice_layer = -1;                                                                   \n\
+	uniform bool is_complex;                                                                \n\
+	uniform int complex_part;                                                               \n\
+	uniform ivec3 size;                                                                     \n\
+	uniform float scale;                                                                    \n\
+	vec2 volume_texel(vec3 p, float lod) {                                                  \n\
+		if (gridded) {                                                                  \n\
+			if (p.z < 0.0 || p.z >= 1.0) return vec2(0.0);                          \n\
+			float layer = float(cell * size.z + int(p.z * float(size.z)));          \n\
+			return textureLod(cells, vec3(p.xy, layer), 0.0).rg;                    \n\
+		}                                                                               \n\
+		if (!bricked && !sliced) return textureLod(tex, p, lod).rg;                     \n\
+		if (any(lessThan(p, vec3(0.0))) || any(greaterThanEqual(p, vec3(1.0)))) return vec2(0.0); \n\
+		ivec3 voxel = ivec3(p * vec3(size));                                            \n\
+		if (sliced) {                                                                   \n\
+			int layer = slice_layer;                                                \n\
+			if (layer == -1) layer = (                                              \n\
+				voxel.z == slices_shown[0] ? 0 :                                \n\
+				voxel.y == slices_shown[1] ? 1 :                                \n\
+				voxel.x == slices_shown[2] ? 2 : -1                             \n\
+			);                                                                      \n\
+			if (layer == -1) return vec2(0.0);                                      \n\
+			ivec2 texel = layer == 0 ? voxel.xy : (layer == 1 ? voxel.xz : voxel.yz); \n\
+			return texelFetch(slices, ivec3(texel, layer), 0).rg;                   \n\
+		}                                                                               \n\
+		uvec4 slot = texelFetch(bricks, voxel / BRICK_SIZE, 0);                         \n\
+		if (slot.a == 0u) return vec2(0.0);                                             \n\
+		return texelFetch(tex, ivec3(slot.rgb) * BRICK_SIZE + voxel % BRICK_SIZE, 0).rg; \n\
+	}                                                                                       \n\
+	float volume_value(vec3 p, float lod) {                                                 \n\
+		vec2 v = volume_texel(p, lod);                                                  \n\
+		if (!is_complex) return v.x * scale;                                            \n\
+		if (complex_part == 1) return v == vec2(0.0) ? 0.0 : atan(v.y, v.x);            \n\
+		if (complex_part == 2) return v.x;                                              \n\
+		if (complex_part == 3) return v.y;                                              \n\
+		return length(v);                                                               \n\
+	}                                                                                       \n\
+"
+
+// Label map and its palette (labels.c), 256 labels per row of the palette.
+// Outside of the volume there is no label, label 0 is never drawn.
+#define LABEL_SAMPLING_SOURCE "\
+	layout (binding = 5) uniform usampler3D labels;                                         \n\
+	layout (binding = 6) uniform sampler2D palette;                                         \n\
+	uniform bool has_labels;                                                                \n\
+	uniform int label_mode;                                                                 \n\
+	uint label_at(vec3 p) {                                                                 \n\
+		if (any(lessThan(p, vec3(0.0))) || any(greaterThanEqual(p, vec3(1.0)))) return 0u; \n\
+		return texelFetch(labels, ivec3(p * vec3(size)), 0).r;                          \n\
+	}                                                                                       \n\
+	vec4 label_colour(uint label) {                                                         \n\
+		return texelFetch(palette, ivec2(label % 256u, label / 256u), 0);               \n\
+	}                                                                                       \n\
+"
+
+// Lower and upper bound of the display range, computed by the contrast shader (contrast.c)
+#ifndef HISTOGRAM_BINS
+	#define HISTOGRAM_BINS 1024
+#endif
+#define CONTRAST_BUFFER_SOURCE "\
+	#define HISTOGRAM_BINS " TO_STRING(HISTOGRAM_BINS) "                                     \n\
+	layout (std430, binding = 0) buffer contrast_buffer {                                   \n\
+		uint min_key;                                                                   \n\
+		uint max_key;                                                                   \n\
+		float lower;                                                                    \n\
+		float upper;                                                                    \n\
+		uint histogram[HISTOGRAM_BINS];                                                 \n\
+	};                                                                                      \n\
+"
+
+// Projections of the slabs around the three slices, one layer per plane, computed by the slab shader (slab.c).
+// Texel (0, 0) is at the lower corner of the plane in view coordinates, the plane's extent is [0, 1] in both.
+#define SLAB_SAMPLING_SOURCE "\
+	layout (binding = 3) uniform sampler2DArray slabs;                                      \n\
+	uniform int slab_mode;                                                                  \n\
+	uniform ivec2 slab_extent[3];                                                           \n\
+	float slab_value(vec2 st, int p) {                                                      \n\
+		if (any(lessThan(st, vec2(0.0))) || any(greaterThan(st, vec2(1.0)))) return 0.0; \n\
+		ivec2 texel = min(ivec2(st * vec2(slab_extent[p])), slab_extent[p] - 1);        \n\
+		return texelFetch(slabs, ivec3(texel, p), 0).r;                                 \n\
+	}                                                                                       \n\
+"
+
+// Per plane state, written by update_view_buffer() (drawing.c)
+#define VIEW_BUFFER_SOURCE "\
+	#define PLANE_VERTICES " TO_STRING(PLANE_VERTICES) "                                    \n\
+	struct plane_state {                                                                    \n\
+		vec4 corners[4];                                                                \n\
+		vec4 rect;                                                                      \n\
+		vec4 centre;                                                                    \n\
+		float ratio;                                                                    \n\
+		int axis;                                                                       \n\
+		float lod;                                                                      \n\
+		float padding;                                                                  \n\
+	};                                                                                      \n\
+	layout (std430, binding = 1) readonly buffer view_buffer {                              \n\
+		plane_state planes[3];                                                          \n\
+	};                                                                                      \n\
+"
+
+
+
+void set_volume_uniforms(GLuint program, bool bricked, int dtype, int size[3])
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "bricked"), bricked);
+	glUniform1i(glGetUniformLocation(program, "is_complex"), dtype_channels[dtype] == 2);
+	glUniform3iv(glGetUniformLocation(program, "size"), 1, size);
+	glUniform1f(glGetUniformLocation(program, "scale"), texture_formats[dtype].scale);
+	return;
+}
+
+
+
+// Planes and crosses in one program, the cross is drawn on top of its plane.
+// Texture coordinates are view coordinates mapped by the orientation (drawing.c).
+// Every instance draws into one cell of a grid of columns x rows, row by row from the top (grid.c).
 void setup_plane_shaders(GLuint* program, GLuint shaders[2]) {
 	const char *vertex_shader_source = "\
 		#version 450 core                                                          \n\
-		layout (location = 0) in vec2 position;                                    \n\
-		layout (location = 1) in vec3 in_tex_coordinate;                           \n\
-		uniform float ratio;                                                       \n\
-		uniform int axis;                                                          \n\
+	"
+	VIEW_BUFFER_SOURCE
+	"\
+		const int quad[6] = int[6](0, 1, 2, 0, 2, 3);                             \n\
+		const ivec2 in_plane[3] = ivec2[3](ivec2(0, 1), ivec2(0, 2), ivec2(2, 1)); \n\
+		uniform vec2 pixel;                                                        \n\
+		uniform mat3 basis;                                                        \n\
+		uniform vec3 origin;                                                       \n\
+		uniform ivec2 grid;                                                        \n\
 		out vec3 tex_coordinate;                                                   \n\
+		out vec2 slab_coordinate;                                                  \n\
+		flat out int plane;                                                        \n\
+		flat out int cross;                                                        \n\
+		flat out int instance;                                                     \n\
+		vec4 in_cell(vec2 position) {                                              \n\
+			vec2 offset = vec2(instance % grid.x, grid.y - 1 - instance / grid.x); \n\
+			return vec4((position + 1.0 + 2.0 * offset) / vec2(grid) - 1.0, 0.0, 1.0); \n\
+		}                                                                          \n\
 		void main() {                                                              \n\
-			gl_Position = vec4(position, 0.0, 1.0);                            \n\
-			tex_coordinate = in_tex_coordinate;                                \n\
-			tex_coordinate[axis] = (tex_coordinate[axis] - 0.5) * ratio + 0.5; \n\
+			instance = gl_InstanceID;                                          \n\
+			plane = gl_VertexID / PLANE_VERTICES;                              \n\
+			int v = gl_VertexID % PLANE_VERTICES;                              \n\
+			int c = quad[v % 6];                                               \n\
+			vec2 corner = vec2(c == 1 || c == 2 ? 1.0 : 0.0, c >= 2 ? 1.0 : 0.0); \n\
+			vec4 rect = planes[plane].rect;                                    \n\
+			vec4 centre = planes[plane].centre;                                \n\
+			tex_coordinate = vec3(0.0);                                        \n\
+			slab_coordinate = vec2(0.0);                                       \n\
+			cross = v < 6 ? 0 : 1;                                             \n\
+			if (v < 6) {                                                       \n\
+				int axis = planes[plane].axis;                             \n\
+				gl_Position = in_cell(mix(rect.xy, rect.zw, corner));      \n\
+				tex_coordinate = planes[plane].corners[c].xyz;             \n\
+				tex_coordinate[axis] = (tex_coordinate[axis] - 0.5) * planes[plane].ratio + 0.5; \n\
+				slab_coordinate = vec2(tex_coordinate[in_plane[plane].x], tex_coordinate[in_plane[plane].y]); \n\
+				tex_coordinate = origin + basis * tex_coordinate;          \n\
+				return;                                                    \n\
+			}                                                                  \n\
+			// Lines are two pixels wide and hidden if outside of the plane    \n\
+			vec2 half_size = 0.5 * (rect.zw - rect.xy);                        \n\
+			vec2 position;                                                     \n\
+			if (v >= 12) {                                                     \n\
+				if (abs(centre[0] - centre[2]) > half_size.x) {            \n\
+					gl_Position = vec4(2.0, 0.0, 0.0, 1.0);            \n\
+					return;                                            \n\
+				}                                                          \n\
+				position.x = centre[0] + (2.0 * corner.x - 1.0) * pixel.x; \n\
+				position.y = centre[3] + (2.0 * corner.y - 1.0) * half_size.y; \n\
+			}                                                                  \n\
+			else {                                                             \n\
+				if (abs(centre[1] - centre[3]) > half_size.y) {            \n\
+					gl_Position = vec4(2.0, 0.0, 0.0, 1.0);            \n\
+					return;                                            \n\
+				}                                                          \n\
+				position.x = centre[2] + (2.0 * corner.x - 1.0) * half_size.x; \n\
+				position.y = centre[1] + (2.0 * corner.y - 1.0) * pixel.y; \n\
+			}                                                                  \n\
+			gl_Position = in_cell(position);                                   \n\
 		}                                                                          \n\
 	";
 	const char *fragment_shader_source = "\
-		#version 450 core                              \n\
-		uniform sampler3D tex;                         \n\
-		in vec3 tex_coordinate;                        \n\
-		out vec4 colour;                               \n\
-		void main(void) {                              \n\
-			colour = texture(tex, tex_coordinate); \n\
-		}                                              \n\
+		#version 450 core                                   \n\
+	"
+	VOLUME_SAMPLING_SOURCE
+	LABEL_SAMPLING_SOURCE
+	SLAB_SAMPLING_SOURCE
+	CONTRAST_BUFFER_SOURCE
+	VIEW_BUFFER_SOURCE
+	"\
+		layout (binding = 2) uniform sampler1D colormap;                \n\
+		uniform bool auto_contrast;                                     \n\
+		uniform vec2 window;                                            \n\
+		in vec3 tex_coordinate;                                         \n\
+		in vec2 slab_coordinate;                                        \n\
+		flat in int plane;                                              \n\
+		flat in int cross;                                              \n\
+		flat in int instance;                                           \n\
+		out vec4 colour;                                                \n\
+		void main(void) {                                               \n\
+			vec3 dx = dFdx(tex_coordinate);                         \n\
+			vec3 dy = dFdy(tex_coordinate);                         \n\
+			if (cross != 0) {                                       \n\
+				colour = vec4(0.0, 1.0, 0.0, 1.0);              \n\
+				return;                                         \n\
+			}                                                       \n\
+			float value;                                            \n\
+			if (slab_mode != 0) value = slab_value(slab_coordinate, plane); \n\
+			else {                                                  \n\
+				slice_layer = plane;                            \n\
+				cell = instance;                                \n\
+				value = volume_value(tex_coordinate, planes[plane].lod); \n\
+			}                                                       \n\
+			vec2 range = auto_contrast ? vec2(lower, upper) : window; \n\
+			value = (value - range[0]) / max(range[1] - range[0], 1e-30); \n\
+			colour = texture(colormap, clamp(value, 0.0, 1.0));     \n\
+			if (!has_labels || label_mode == 0) return;             \n\
+			uint label = label_at(tex_coordinate);                  \n\
+			vec4 c = label_colour(label);                           \n\
+			if (label == 0u || c.a == 0.0) return;                  \n\
+			// Opaque where a neighbouring pixel has another label  \n\
+			if (                                                    \n\
+				label_at(tex_coordinate + dx) != label ||       \n\
+				label_at(tex_coordinate - dx) != label ||       \n\
+				label_at(tex_coordinate + dy) != label ||       \n\
+				label_at(tex_coordinate - dy) != label          \n\
+			) colour = vec4(c.rgb, 1.0);                            \n\
+			else if (label_mode == 1) colour.rgb = mix(colour.rgb, c.rgb, c.a); \n\
+		}                                                               \n\
 	";
 	shaders[0] = glMakeShader(GL_VERTEX_SHADER, &vertex_shader_source);
 	shaders[1] = glMakeShader(GL_FRAGMENT_SHADER, &fragment_shader_source);
@@ -31,53 +255,179 @@ void setup_plane_shaders(GLuint* program, GLuint shaders[2]) {
 
 
 
-void setup_cross_shaders(GLuint* program, GLuint shaders[2]) {
-	// TODO: make centre a uniform? can't remember but seems like centre[2:3] are limits, and only centre[0:1] are updated
+// Reduction over the displayed part of the three slices, run in three passes:
+// min/max, histogram between min and max, and bounds from min/max or percentiles of the histogram
+void setup_contrast_shaders(GLuint* program, GLuint shaders[1]) {
+	const char *compute_shader_source = "\
+		#version 450 core                                                                 \n\
+		layout (local_size_x = 16, local_size_y = 16) in;                                 \n\
+	"
+	VOLUME_SAMPLING_SOURCE
+	SLAB_SAMPLING_SOURCE
+	CONTRAST_BUFFER_SOURCE
+	"\
+		uniform int pass;                                                                 \n\
+		uniform vec3 origin[3];                                                           \n\
+		uniform vec3 edges[6];                                                            \n\
+		uniform vec2 slab_origin[3];                                                      \n\
+		uniform vec2 slab_edges[6];                                                       \n\
+		uniform ivec2 samples[3];                                                         \n\
+		uniform vec2 percentiles;                                                         \n\
+		shared uint shared_min, shared_max;                                               \n\
+		shared uint shared_histogram[HISTOGRAM_BINS];                                     \n\
+		uint to_key(float f) {                                                            \n\
+			uint u = floatBitsToUint(f);                                              \n\
+			return (u & 0x80000000u) != 0u ? ~u : u | 0x80000000u;                    \n\
+		}                                                                                 \n\
+		float from_key(uint u) {                                                          \n\
+			return uintBitsToFloat((u & 0x80000000u) != 0u ? u & 0x7FFFFFFFu : ~u);   \n\
+		}                                                                                 \n\
+		void main() {                                                                     \n\
+			uint local = gl_LocalInvocationIndex;                                     \n\
+			if (pass == 2) {                                                          \n\
+				if (local != 0u) return;                                          \n\
+				float low = from_key(min_key);                                    \n\
+				float high = from_key(max_key);                                   \n\
+				lower = low;                                                      \n\
+				upper = high;                                                     \n\
+				if (percentiles == vec2(0.0, 1.0)) return;                        \n\
+				uint total = 0u;                                                  \n\
+				for (int i = 0; i < HISTOGRAM_BINS; i++) total += histogram[i];   \n\
+				uint count = 0u;                                                  \n\
+				bool found_lower = false;                                         \n\
+				for (int i = 0; i < HISTOGRAM_BINS; i++) {                        \n\
+					count += histogram[i];                                    \n\
+					float bound = low + (high - low) * float(i + 1) / float(HISTOGRAM_BINS); \n\
+					if (!found_lower && float(count) >= percentiles[0] * float(total)) { \n\
+						lower = bound;                                    \n\
+						found_lower = true;                               \n\
+					}                                                         \n\
+					if (float(count) >= percentiles[1] * float(total)) {      \n\
+						upper = bound;                                    \n\
+						break;                                            \n\
+					}                                                         \n\
+				}                                                                 \n\
+				return;                                                           \n\
+			}                                                                         \n\
+			int p = int(gl_WorkGroupID.z);                                            \n\
+			uvec2 id = gl_GlobalInvocationID.xy;                                      \n\
+			bool inside = id.x < uint(samples[p].x) && id.y < uint(samples[p].y);     \n\
+			vec2 st = (vec2(id) + 0.5) / vec2(samples[p]);                            \n\
+			vec3 position = origin[p] + st.x * edges[2*p] + st.y * edges[2*p+1];      \n\
+			inside = inside && all(greaterThanEqual(position, vec3(0.0))) && all(lessThan(position, vec3(1.0))); \n\
+			float value;                                                              \n\
+			if (slab_mode != 0) value = slab_value(slab_origin[p] + st.x * slab_edges[2*p] + st.y * slab_edges[2*p+1], p); \n\
+			else {                                                                    \n\
+				slice_layer = p;                                                  \n\
+				value = volume_value(position, 0.0);                              \n\
+			}                                                                         \n\
+			if (pass == 0) {                                                          \n\
+				if (local == 0u) {                                                \n\
+					shared_min = 0xFFFFFFFFu;                                 \n\
+					shared_max = 0u;                                          \n\
+				}                                                                 \n\
+				barrier();                                                        \n\
+				if (inside) {                                                     \n\
+					atomicMin(shared_min, to_key(value));                     \n\
+					atomicMax(shared_max, to_key(value));                     \n\
+				}                                                                 \n\
+				barrier();                                                        \n\
+				if (local == 0u) {                                                \n\
+					atomicMin(min_key, shared_min);                           \n\
+					atomicMax(max_key, shared_max);                           \n\
+				}                                                                 \n\
+			}                                                                         \n\
+			else {                                                                    \n\
+				uint threads = gl_WorkGroupSize.x * gl_WorkGroupSize.y;           \n\
+				for (uint i = local; i < HISTOGRAM_BINS; i += threads) shared_histogram[i] = 0u; \n\
+				barrier();                                                        \n\
+				if (inside) {                                                     \n\
+					float low = from_key(min_key);                            \n\
+					float high = from_key(max_key);                           \n\
+					float bin = (value - low) / max(high - low, 1e-30) * float(HISTOGRAM_BINS); \n\
+					atomicAdd(shared_histogram[clamp(int(bin), 0, HISTOGRAM_BINS - 1)], 1u); \n\
+				}                                                                 \n\
+				barrier();                                                        \n\
+				for (uint i = local; i < HISTOGRAM_BINS; i += threads) {          \n\
+					if (shared_histogram[i] != 0u) atomicAdd(histogram[i], shared_histogram[i]); \n\
+				}                                                                 \n\
+			}                                                                         \n\
+		}                                                                                 \n\
+	";
+	shaders[0] = glMakeShader(GL_COMPUTE_SHADER, &compute_shader_source);
+	*program = glMakeProgram(shaders, 1);
+	return;
+}
+
+
+
+// Maximum, minimum or mean along the normal of each plane, over samples one voxel apart centred on the slice.
+// Texel (i, j) of a plane's layer is at origin + st.x * edges[0] + st.y * edges[1] (texture coordinates).
+void setup_slab_shaders(GLuint* program, GLuint shaders[1]) {
+	const char *compute_shader_source = "\
+		#version 450 core                                                                 \n\
+		layout (local_size_x = 16, local_size_y = 16) in;                                 \n\
+	"
+	VOLUME_SAMPLING_SOURCE
+	"\
+		layout (binding = 3, r32f) uniform writeonly image2DArray slab_image;             \n\
+		uniform int mode;                                                                 \n\
+		uniform int layer;                                                                \n\
+		uniform ivec2 extent;                                                             \n\
+		uniform vec3 origin;                                                              \n\
+		uniform vec3 edges[2];                                                            \n\
+		uniform vec3 step;                                                                \n\
+		uniform int samples;                                                              \n\
+		void main() {                                                                     \n\
+			ivec2 id = ivec2(gl_GlobalInvocationID.xy);                               \n\
+			if (any(greaterThanEqual(id, extent))) return;                            \n\
+			vec2 st = (vec2(id) + 0.5) / vec2(extent);                                \n\
+			vec3 centre = origin + st.x * edges[0] + st.y * edges[1];                 \n\
+			float result = mode == 1 ? -3.4e38 : mode == 2 ? 3.4e38 : 0.0;           \n\
+			int count = 0;                                                            \n\
+			for (int k = 0; k < samples; k++) {                                       \n\
+				vec3 position = centre + (float(k) - 0.5 * float(samples - 1)) * step; \n\
+				if (any(lessThan(position, vec3(0.0))) || any(greaterThanEqual(position, vec3(1.0)))) continue; \n\
+				float value = volume_value(position, 0.0);                        \n\
+				if (mode == 1)      result = max(result, value);                  \n\
+				else if (mode == 2) result = min(result, value);                  \n\
+				else                result += value;                              \n\
+				count++;                                                          \n\
+			}                                                                         \n\
+			if (count == 0) result = 0.0;                                             \n\
+			else if (mode == 3) result /= float(count);                               \n\
+			imageStore(slab_image, ivec3(id, layer), vec4(result));                   \n\
+		}                                                                                 \n\
+	";
+	shaders[0] = glMakeShader(GL_COMPUTE_SHADER, &compute_shader_source);
+	*program = glMakeProgram(shaders, 1);
+	return;
+}
+
+
+
+
+// Lines in window coordinates, e.g. the time curves of roi.c, points are read from a buffer by gl_VertexID
+void setup_plot_shaders(GLuint* program, GLuint shaders[2]) {
 	const char *vertex_shader_source = "\
 		#version 450 core                                               \n\
-		layout (location = 0) in vec2 in_position;                      \n\
-		layout (location = 1) in vec4 centre;                           \n\
-		uniform bool vertical;                                          \n\
-		out vec2 position;                                              \n\
-		out vec2 offset;                                                \n\
+		layout (std430, binding = 4) readonly buffer plot_buffer {      \n\
+			vec2 points[];                                          \n\
+		};                                                              \n\
 		void main() {                                                   \n\
-			if (vertical) {                                         \n\
-				if (abs(centre[0] - centre[2]) > 0.48) {        \n\
-					gl_Position = vec4(2.0, 0.0, 0.0, 1.0); \n\
-					return;                                 \n\
-				}                                               \n\
-				offset[0] = centre[0];                          \n\
-				offset[1] = centre[3];                          \n\
-			}                                                       \n\
-			else {                                                  \n\
-				if (abs(centre[1] - centre[3]) > 0.48) {        \n\
-					gl_Position = vec4(2.0, 0.0, 0.0, 1.0); \n\
-					return;                                 \n\
-				}                                               \n\
-				offset[0] = centre[2];                          \n\
-				offset[1] = centre[1];                          \n\
-			}                                                       \n\
-			gl_Position = vec4(in_position + offset, 0.0, 1.0);     \n\
-			position = gl_Position.xy;                              \n\
+			gl_Position = vec4(points[gl_VertexID], 0.0, 1.0);      \n\
 		}                                                               \n\
 	";
-
 	const char *fragment_shader_source = "\
-		#version 450 core                                       \n\
-		in vec2 position;                                       \n\
-		in vec2 offset;                                         \n\
-		out vec4 colour;                                        \n\
-		void main(void) {                                       \n\
-			if (                                            \n\
-				abs(position[0] - offset[0]) <= 0.48 && \n\
-				abs(position[1] - offset[1]) <= 0.48    \n\
-			)	colour = vec4(0.0, 1.0, 0.0, 1.0);      \n\
-			else discard;                                   \n\
-		}                                                       \n\
+		#version 450 core                                               \n\
+		uniform vec4 line_colour;                                       \n\
+		out vec4 colour;                                                \n\
+		void main(void) {                                               \n\
+			colour = line_colour;                                   \n\
+		}                                                               \n\
 	";
 	shaders[0] = glMakeShader(GL_VERTEX_SHADER, &vertex_shader_source);
 	shaders[1] = glMakeShader(GL_FRAGMENT_SHADER, &fragment_shader_source);
 	*program = glMakeProgram(shaders, 2);
 	return;
 }
-
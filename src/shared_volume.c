@@ -0,0 +1,230 @@
+// A volume on the GPU, shared by all windows which show it, their contexts share objects.
+// Uploads happen in whichever context is current and are fenced, other contexts wait for the fence
+// on the GPU and bind the textures again before drawing, so that they see the new content.
+// Changes of the caller (or found by watch.c) which cross the displayed slices are uploaded first,
+// at most max_change_bytes per frame, the rest is kept pending for the next frames.
+// The volume of a grid window is that of all its cells (grid.c), whose changes are uploaded at once and whose frames
+// come through the cine ring like those of a single volume.
+
+struct shared_volume {
+	struct viewer *viewer;      // Of the first cell
+	struct viewer **cells;
+	int ncells;
+	int nwindows; // Showing it, it is deleted with the last
+	bool gridded;               // More than one cell, all in the layers of texture
+	bool bricked;
+	struct brick_cache bricks;
+	bool sliced;                // Nothing is uploaded here, windows upload their slices (slices.c)
+	GLuint texture;
+	struct mip_builder mipmaps; // Kept to update changed regions
+	int mip_frame;              // Of which the mipmaps' pyramid is, its chunks stay loaded
+	struct cine cine;
+	struct labels labels;
+	GLsync fence;               // After the last upload
+	struct change changes[MAX_CHANGES];
+	struct change pending[MAX_CHANGES]; // Of the displayed frame, not uploaded yet
+	int npending;
+};
+
+
+
+// Returns false if the volume can't be put on the GPU, nothing is left to delete then
+bool setup_shared_volume(struct shared_volume *volume, struct viewer *cells[], int ncells)
+{
+	memset(volume, 0, sizeof(struct shared_volume));
+	struct viewer *viewer = cells[0];
+	volume->viewer = viewer;
+	volume->cells = cells;
+	volume->ncells = ncells;
+	char *image = viewer->image;
+	int dtype = viewer->dtype;
+	int *size = viewer->size;
+	ptrdiff_t *strides = viewer->strides;
+
+	volume->gridded = ncells > 1;
+	volume->sliced = slice_only && !volume->gridded;
+	// Volumes that don't fit into the budget are streamed in bricks
+	volume->bricked = !volume->sliced && !volume->gridded && needs_bricks(dtype, size, texture_budget);
+	if (volume->gridded) {
+		volume->texture = setup_grid_texture(cells, ncells);
+		if (volume->texture == 0) return false;
+		upload_grid_frame(volume->texture, cells, ncells, 0);
+	}
+	else if (volume->bricked) setup_brick_cache(&volume->bricks, image, dtype, size, strides, texture_budget, viewer->chunks);
+	else if (!volume->sliced) {
+		// Level 0 is uploaded while the other levels are built
+		load_box(viewer->chunks, 0, NULL, NULL);
+		start_mipmaps(&volume->mipmaps, image, strides, dtype, size);
+		volume->texture = setup_texture(image, dtype, size, strides, volume->mipmaps.layout.levels);
+		upload_mipmaps(&volume->mipmaps, volume->texture);
+	}
+	setup_cine(&volume->cine, cells, ncells, volume->texture);
+	return true;
+}
+
+
+
+// After uploading, before another context draws
+void fence_shared_volume(struct shared_volume *volume)
+{
+	if (volume->fence != NULL) glDeleteSync(volume->fence);
+	volume->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+	return;
+}
+
+
+
+// In the current context, before the volume is sampled
+void bind_shared_volume(struct shared_volume *volume)
+{
+	if (volume->fence != NULL) glWaitSync(volume->fence, 0, GL_TIMEOUT_IGNORED);
+	if (volume->gridded) glBindTextureUnit(7, volume->texture);
+	else if (volume->bricked) {
+		glBindTextureUnit(0, volume->bricks.atlas);
+		glBindTextureUnit(1, volume->bricks.indirection);
+	}
+	else glBindTextureUnit(0, volume->texture);
+	bind_labels(&volume->labels);
+	return;
+}
+
+
+
+bool boxes_overlap(const struct change *a, const struct change *b)
+{
+	for (int i = 0; i < 3; i++) {
+		if (a->upper[i] <= b->lower[i] || b->upper[i] <= a->lower[i]) return false;
+	}
+	return true;
+}
+
+
+
+void add_pending_change(struct shared_volume *volume, const struct change *change)
+{
+	if (volume->npending < MAX_CHANGES) {
+		volume->pending[volume->npending++] = *change;
+		return;
+	}
+	// Merged into one box around all
+	struct change *merged = &volume->pending[0];
+	for (int c = 1; c < volume->npending; c++) {
+		for (int i = 0; i < 3; i++) {
+			merged->lower[i] = fmin(merged->lower[i], volume->pending[c].lower[i]);
+			merged->upper[i] = fmax(merged->upper[i], volume->pending[c].upper[i]);
+		}
+	}
+	for (int i = 0; i < 3; i++) {
+		merged->lower[i] = fmin(merged->lower[i], change->lower[i]);
+		merged->upper[i] = fmax(merged->upper[i], change->upper[i]);
+	}
+	volume->npending = 1;
+	return;
+}
+
+
+
+// Pending changes crossing the shown boxes (voxels) first, each is uploaded in slabs of z as far as the budget allows
+bool upload_pending_changes(struct shared_volume *volume, const struct change shown[], int nshown)
+{
+	if (volume->npending == 0) return false;
+	struct change *pending = volume->pending;
+	int crossing = 0;
+	for (int c = 0; c < volume->npending; c++) {
+		for (int s = 0; s < nshown; s++) {
+			if (!boxes_overlap(&pending[c], &shown[s])) continue;
+			struct change swap = pending[crossing];
+			pending[crossing++] = pending[c];
+			pending[c] = swap;
+			break;
+		}
+	}
+
+	size_t budget = max_change_bytes;
+	int c = 0;
+	while (c < volume->npending && budget > 0) {
+		struct change *change = &pending[c];
+		size_t slice = dtype_size[volume->viewer->dtype] * (change->upper[0] - change->lower[0]) * (change->upper[1] - change->lower[1]);
+		int depth = fmax(1, fmin(change->upper[2] - change->lower[2], budget / slice));
+		int upper[3] = {change->upper[0], change->upper[1], change->lower[2] + depth};
+		update_mipmaps(&volume->mipmaps, volume->texture, change->lower, upper);
+		budget -= fmin(budget, slice * depth);
+		change->lower[2] += depth;
+		if (change->lower[2] == change->upper[2]) c++;
+	}
+	// Keep the order, crossing changes stay in front
+	volume->npending -= c;
+	memmove(pending, pending + c, sizeof(struct change) * volume->npending);
+	return true;
+}
+
+
+
+// Switches frames and re-uploads what the caller changed in the displayed frame, prefetched frames are dropped.
+// Shown are the boxes (voxels) which the windows display, changes crossing them are uploaded first.
+// Returns true if the windows need to be redrawn for new data, new_labels if for a changed label map.
+bool update_shared_volume(struct shared_volume *volume, const struct change shown[], int nshown, bool *new_frame, bool *new_labels)
+{
+	struct viewer *viewer = volume->viewer;
+	struct cine *cine = &volume->cine;
+	*new_frame = update_cine(cine);
+	if (*new_frame && volume->bricked) {
+		set_brick_image(&volume->bricks, viewer->image + cine->frame * viewer->strides[3], cine->frame);
+	}
+	if (*new_frame) volume->npending = 0; // The new frame is uploaded whole
+
+	bool changed = *new_frame;
+	int n = 0;
+	if (volume->gridded) changed |= update_grid(volume->texture, volume->cells, volume->ncells, cine, volume->changes);
+	else n = take_changes(viewer, volume->changes);
+	struct change everything = { -1, {0, 0, 0}, {viewer->size[0], viewer->size[1], viewer->size[2]} };
+	if (n == -1) {
+		volume->changes[0] = everything;
+		n = 1;
+	}
+	if (n > 0) reload_cine(cine);
+	for (int c = 0; c < n; c++) {
+		struct change *change = &volume->changes[c];
+		if (change->frame != -1 && change->frame != cine->frame) continue;
+		if (volume->bricked) {
+			invalidate_bricks(&volume->bricks, change->lower, change->upper);
+			changed = true;
+		}
+		else if (volume->sliced) changed = true;
+		else {
+			if (volume->mip_frame != cine->frame) {
+				// The pyramid is of another frame, so all of it is rebuilt
+				release_box(viewer->chunks, volume->mip_frame, NULL, NULL);
+				load_box(viewer->chunks, cine->frame, NULL, NULL);
+				set_mip_image(&volume->mipmaps, viewer->image + cine->frame * viewer->strides[3], viewer->strides);
+				volume->mip_frame = cine->frame;
+				volume->npending = 0;
+				change = &everything;
+			}
+			add_pending_change(volume, change);
+		}
+	}
+	if (!volume->bricked && !volume->sliced && !volume->gridded) changed |= upload_pending_changes(volume, shown, nshown);
+	*new_labels = update_labels(&volume->labels, viewer);
+	if (changed || *new_labels) fence_shared_volume(volume);
+	return changed;
+}
+
+
+
+void delete_shared_volume(struct shared_volume *volume)
+{
+	stop_cine(&volume->cine);
+	if (volume->gridded) glDeleteTextures(1, &volume->texture);
+	else if (volume->bricked) delete_brick_cache(&volume->bricks);
+	else if (!volume->sliced) {
+		glDeleteTextures(1, &volume->texture);
+		delete_mip_builder(&volume->mipmaps);
+		release_box(volume->viewer->chunks, volume->mip_frame, NULL, NULL);
+	}
+	delete_labels(&volume->labels);
+	if (volume->fence != NULL) glDeleteSync(volume->fence);
+	return;
+}
+
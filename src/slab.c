@@ -0,0 +1,215 @@
+// Thick slabs: each plane shows the maximum, minimum or mean over a number of voxels along its normal, around the slice.
+// The projections are computed on the GPU into one layer per plane (shaders.c) at about one texel per voxel of the plane,
+// covering the whole plane, so that zooming and panning reuse them. A layer is only computed again if its slice,
+// the orientation, the settings or the data change, moving the cursor within a plane recomputes the other two.
+#ifndef MAX_SLAB_SIZE
+	#define MAX_SLAB_SIZE 2048 // Texels per axis of a layer
+#endif
+#ifndef MAX_SLAB_THICKNESS
+	#define MAX_SLAB_THICKNESS 1024 // Voxels
+#endif
+#define NUM_SLAB_KEYS 3
+
+enum slab_mode { SLAB_OFF, SLAB_MAX, SLAB_MIN, SLAB_MEAN, NUM_SLAB_MODES }; // As in the slab shader
+const char *slab_mode_names[NUM_SLAB_MODES] = {"off", "maximum", "minimum", "mean"};
+
+// Chosen on the input thread
+struct slab_settings {
+	char mode;
+	int thickness; // Voxels
+};
+
+struct slab {
+	char mode;
+	int thickness;
+	int size[3];
+	int layer_size; // Texels per axis, the same for all layers
+	int extent[3][2]; // Used by each plane
+	GLuint program, shaders[1], texture; // Set up when first switched on
+	GLint uniform_mode, uniform_layer, uniform_extent, uniform_origin, uniform_edges, uniform_step, uniform_samples, uniform_part;
+	bool bricked;
+	int dtype;
+	char part; // Of complex values, see struct contrast
+	// As computed
+	float slices[3];
+	struct orientation orientation;
+	bool stale[3];
+};
+
+
+
+void setup_slab(struct slab *slab, bool bricked, int dtype, int size[3])
+{
+	memset(slab, 0, sizeof(struct slab));
+	slab->bricked = bricked;
+	slab->dtype = dtype;
+	memcpy(slab->size, size, sizeof(slab->size));
+	int largest = fmax(size[0], fmax(size[1], size[2]));
+	slab->layer_size = fmin(MAX_SLAB_SIZE, largest);
+	return;
+}
+
+
+
+void setup_slab_settings(struct slab_settings *settings)
+{
+	settings->mode = SLAB_OFF;
+	settings->thickness = 16;
+	return;
+}
+
+
+
+// S cycles through off, maximum, minimum and mean, Page Up/Down make the slab thicker/thinner.
+// Returns true if the settings changed.
+bool handle_slab_keys(GLFWwindow *window, struct slab_settings *settings, char previous[NUM_SLAB_KEYS])
+{
+	const int keys[NUM_SLAB_KEYS] = {GLFW_KEY_S, GLFW_KEY_PAGE_UP, GLFW_KEY_PAGE_DOWN};
+	char pressed[NUM_SLAB_KEYS];
+	for (int i = 0; i < NUM_SLAB_KEYS; i++) {
+		char state = key_down(window, keys[i]);
+		pressed[i] = state && !previous[i];
+		previous[i] = state;
+	}
+	struct slab_settings old = *settings;
+	if (pressed[0]) settings->mode = (settings->mode + 1) % NUM_SLAB_MODES;
+	if (pressed[1]) settings->thickness = fmin(MAX_SLAB_THICKNESS, ceil(settings->thickness * 1.25));
+	if (pressed[2]) settings->thickness = fmax(1, floor(settings->thickness / 1.25));
+	if (pressed[1] || pressed[2]) printf("Slab thickness %d voxels\n", settings->thickness);
+	return memcmp(&old, settings, sizeof(old)) != 0;
+}
+
+
+
+void set_slab_uniforms(struct slab *slab, GLuint program)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "slab_mode"), slab->mode);
+	glUniform2iv(glGetUniformLocation(program, "slab_extent"), 3, &slab->extent[0][0]);
+	return;
+}
+
+
+
+// On the render thread, returns true if the slab changed
+bool apply_slab_settings(struct slab *slab, const struct slab_settings *settings)
+{
+	if (settings->mode == slab->mode && settings->thickness == slab->thickness) return false;
+	if (settings->mode != SLAB_OFF && slab->texture == 0) {
+		setup_slab_shaders(&slab->program, slab->shaders);
+		set_volume_uniforms(slab->program, slab->bricked, slab->dtype, slab->size);
+		slab->uniform_mode    = glGetUniformLocation(slab->program, "mode");
+		slab->uniform_layer   = glGetUniformLocation(slab->program, "layer");
+		slab->uniform_extent  = glGetUniformLocation(slab->program, "extent");
+		slab->uniform_origin  = glGetUniformLocation(slab->program, "origin");
+		slab->uniform_edges   = glGetUniformLocation(slab->program, "edges");
+		slab->uniform_step    = glGetUniformLocation(slab->program, "step");
+		slab->uniform_samples = glGetUniformLocation(slab->program, "samples");
+		slab->uniform_part    = glGetUniformLocation(slab->program, "complex_part");
+
+		glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &slab->texture);
+		glTextureStorage3D(slab->texture, 1, GL_R32F, slab->layer_size, slab->layer_size, 3);
+		glBindTextureUnit(3, slab->texture);
+		glBindImageTexture(3, slab->texture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32F);
+	}
+	if (settings->mode != slab->mode) printf("Slab %s\n", slab_mode_names[(int)settings->mode]);
+	slab->mode = settings->mode;
+	slab->thickness = settings->thickness;
+	for (int p = 0; p < 3; p++) slab->stale[p] = true;
+	return true;
+}
+
+
+
+// Voxels along the normal which the planes reach into, for update_bricks()
+int slab_thickness(const struct slab *slab)
+{
+	return slab->mode == SLAB_OFF ? 0 : slab->thickness;
+}
+
+
+
+// The data changed, e.g. a frame or bricks were uploaded
+void invalidate_slab(struct slab *slab)
+{
+	for (int p = 0; p < 3; p++) slab->stale[p] = true;
+	return;
+}
+
+
+
+void set_slab_part(struct slab *slab, char part)
+{
+	if (part == slab->part) return;
+	slab->part = part;
+	invalidate_slab(slab);
+	return;
+}
+
+
+
+// Computes the layers of planes whose slice or orientation changed, planes in view coordinates.
+// Returns true if any was computed.
+bool update_slab(struct slab *slab, float planes[3][4][3], const struct orientation *orientation)
+{
+	if (slab->mode == SLAB_OFF) return false;
+	bool new_orientation = memcmp(&slab->orientation, orientation, sizeof(struct orientation)) != 0;
+	bool computed = false;
+	for (int p = 0; p < 3; p++) {
+		int n = plane_axes[p][2];
+		float slice = planes[p][0][n];
+		if (!slab->stale[p] && !new_orientation && slice == slab->slices[p]) continue;
+
+		// Texture coordinates of the plane's lower corner and edges over its whole extent in view coordinates
+		float q[3], origin[3], edges[2][3], normal[3];
+		q[plane_axes[p][0]] = 0;
+		q[plane_axes[p][1]] = 0;
+		q[n] = slice;
+		orient(orientation, q, origin);
+		for (int e = 0; e < 2; e++) {
+			float corner[3];
+			q[plane_axes[p][e]] = 1;
+			orient(orientation, q, corner);
+			q[plane_axes[p][e]] = 0;
+			float voxels = 0;
+			for (int i = 0; i < 3; i++) {
+				edges[e][i] = corner[i] - origin[i];
+				voxels += pow(edges[e][i] * slab->size[i], 2);
+			}
+			slab->extent[p][e] = fmax(1, fmin(slab->layer_size, round(sqrt(voxels))));
+		}
+		// One voxel along the normal
+		float length = 0;
+		for (int i = 0; i < 3; i++) length += pow(orientation->basis[i][n] * slab->size[i], 2);
+		for (int i = 0; i < 3; i++) normal[i] = orientation->basis[i][n] / sqrt(length);
+
+		glUseProgram(slab->program);
+		glUniform1i(slab->uniform_mode, slab->mode);
+		glUniform1i(slab->uniform_layer, p);
+		glUniform2iv(slab->uniform_extent, 1, slab->extent[p]);
+		glUniform3fv(slab->uniform_origin, 1, origin);
+		glUniform3fv(slab->uniform_edges, 2, &edges[0][0]);
+		glUniform3fv(slab->uniform_step, 1, normal);
+		glUniform1i(slab->uniform_samples, slab->thickness);
+		glUniform1i(slab->uniform_part, slab->part);
+		glDispatchCompute((slab->extent[p][0] + 15) / 16, (slab->extent[p][1] + 15) / 16, 1);
+
+		slab->slices[p] = slice;
+		slab->stale[p] = false;
+		computed = true;
+	}
+	slab->orientation = *orientation;
+	if (computed) glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	return computed;
+}
+
+
+
+void delete_slab(struct slab *slab)
+{
+	if (slab->texture == 0) return;
+	glDeleteProgram(slab->program);
+	glDeleteShader(slab->shaders[0]);
+	glDeleteTextures(1, &slab->texture);
+	return;
+}
@@ -0,0 +1,276 @@
+#include <pthread.h>
+
+// Slice-only mode (-s) for a quick look at volumes which take long to upload: the image stays in host memory (or its mapping)
+// and only the three axis aligned slices through the cursor are copied into the layers of a 2D array texture, layer p for plane p.
+// A worker extracts slices which moved, or whose frame or data changed, with rows gathered in parallel, and the render loop
+// uploads them. Until then a plane shows its previous slice. Layers are in order of the axes, so that rows are written contiguously,
+// the slice in x is the slow one since every voxel is a row of the image apart.
+
+enum slice_state { SLICE_WANTED, SLICE_EXTRACTING, SLICE_READY, SLICE_UPLOADED };
+
+// Which slice a layer holds, voxel along the plane's normal
+struct slice_key {
+	const char *image; // Of the frame
+	int frame;
+	int slice;
+	unsigned int generation;
+};
+
+struct slices {
+	int dtype;
+	int size[3];
+	ptrdiff_t strides[3];
+	struct chunked_image *chunks; // NULL unless the image is decoded on demand
+	GLuint texture;
+	char *extracted[3]; // Per layer, rows along its first axis
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool quit;
+	// Under the lock
+	struct slice_key want[3], extracting[3];
+	char state[3];
+	unsigned int generation; // Incremented when the data changed
+	// Render thread
+	int shown[3]; // Uploaded, -1 if none
+};
+
+struct slice_rows {
+	struct slices *slices;
+	int layer;
+	const char *in; // The slice
+	int begin, end;
+};
+
+const int slice_axes[3][2] = {{0, 1}, {0, 2}, {1, 2}}; // In-plane axes of the layers, rows are along the first
+
+
+
+// n elements of bytes each, stride apart, e.g. along y for the slice in x, where every element is a cache miss
+void gather_row(size_t bytes, const char *in, ptrdiff_t stride, char *restrict out, int n)
+{
+	if (stride == (ptrdiff_t)bytes) {
+		memcpy(out, in, bytes * n);
+		return;
+	}
+	switch (bytes) {
+		case 1:
+			for (int i = 0; i < n; i++) out[i] = in[i * stride];
+			break;
+		case 2:
+			for (int i = 0; i < n; i++) ((uint16_t *)out)[i] = *(const uint16_t *)(in + i * stride);
+			break;
+		case 4:
+			for (int i = 0; i < n; i++) ((uint32_t *)out)[i] = *(const uint32_t *)(in + i * stride);
+			break;
+		case 8:
+			for (int i = 0; i < n; i++) ((uint64_t *)out)[i] = *(const uint64_t *)(in + i * stride);
+			break;
+	}
+	return;
+}
+
+
+
+void* gather_slice_rows(void *arg)
+{
+	struct slice_rows *rows = arg;
+	struct slices *slices = rows->slices;
+	int a = slice_axes[rows->layer][0];
+	int b = slice_axes[rows->layer][1];
+	size_t bytes = dtype_size[slices->dtype];
+	size_t row_bytes = bytes * slices->size[a];
+	char *out = slices->extracted[rows->layer];
+	for (int r = rows->begin; r < rows->end; r++) {
+		gather_row(bytes, rows->in + r * slices->strides[b], slices->strides[a], out + r * row_bytes, slices->size[a]);
+	}
+	return NULL;
+}
+
+
+
+// In parallel over rows on the shared workers (workers.c), so that the strided reads of many rows are in flight at once
+void extract_slice(struct slices *slices, int layer, const struct slice_key *key)
+{
+	int n = slices->size[slice_axes[layer][1]];
+	int normal = plane_axes[layer][2];
+	const char *in = key->image + key->slice * slices->strides[normal];
+	int lower[3] = {0, 0, 0};
+	int upper[3] = {slices->size[0], slices->size[1], slices->size[2]};
+	lower[normal] = key->slice;
+	upper[normal] = key->slice + 1;
+	load_box(slices->chunks, key->frame, lower, upper);
+	struct worker_pool *workers = shared_workers();
+	int ntasks = fmax(1, fmin(workers->nthreads + 1, n));
+	struct slice_rows rows[ntasks];
+	for (int t = 0; t < ntasks; t++) rows[t] = (struct slice_rows) { slices, layer, in, t * n / ntasks, (t + 1) * n / ntasks };
+	run_tasks(workers, gather_slice_rows, rows, sizeof(struct slice_rows), ntasks);
+	release_box(slices->chunks, key->frame, lower, upper);
+	return;
+}
+
+
+
+bool same_slice(const struct slice_key *a, const struct slice_key *b)
+{
+	return a->image == b->image && a->slice == b->slice && a->generation == b->generation;
+}
+
+
+
+void* slice_worker(void *arg)
+{
+	struct slices *slices = arg;
+	pthread_mutex_lock(&slices->lock);
+	while (!slices->quit) {
+		int layer = -1;
+		for (int p = 0; p < 3; p++) {
+			if (slices->state[p] == SLICE_WANTED) {
+				layer = p;
+				break;
+			}
+		}
+		if (layer == -1) {
+			pthread_cond_wait(&slices->cond, &slices->lock);
+			continue;
+		}
+		struct slice_key key = slices->want[layer];
+		slices->extracting[layer] = key;
+		slices->state[layer] = SLICE_EXTRACTING;
+		pthread_mutex_unlock(&slices->lock);
+		extract_slice(slices, layer, &key);
+		pthread_mutex_lock(&slices->lock);
+		slices->state[layer] = SLICE_READY;
+		glfwPostEmptyEvent();
+	}
+	pthread_mutex_unlock(&slices->lock);
+	return NULL;
+}
+
+
+
+// On the render thread, in the window's context. Returns false if the slices are larger than textures can be.
+bool setup_slices(struct slices *slices, int dtype, int size[3], const ptrdiff_t strides[3], struct chunked_image *chunks)
+{
+	memset(slices, 0, sizeof(struct slices));
+	slices->dtype = dtype;
+	slices->chunks = chunks;
+	memcpy(slices->size, size, sizeof(slices->size));
+	memcpy(slices->strides, strides, sizeof(slices->strides));
+	GLint max_size;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	int width = fmax(size[0], size[1]);
+	int height = fmax(size[1], size[2]);
+	if (width > max_size || height > max_size) {
+		printf("Error: slices of %d x %d voxels are larger than textures can be (%d)\n", width, height, max_size);
+		return false;
+	}
+	glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &slices->texture);
+	glTextureStorage3D(slices->texture, 1, texture_formats[dtype].internal_format, width, height, 3);
+	glClearTexImage(slices->texture, 0, texture_formats[dtype].format, texture_formats[dtype].type, NULL);
+	glBindTextureUnit(4, slices->texture);
+	for (int p = 0; p < 3; p++) {
+		slices->extracted[p] = malloc(dtype_size[dtype] * size[slice_axes[p][0]] * size[slice_axes[p][1]]);
+		slices->want[p].slice = -1;
+		slices->state[p] = SLICE_UPLOADED;
+		slices->shown[p] = -1;
+	}
+	pthread_mutex_init(&slices->lock, NULL);
+	pthread_cond_init(&slices->cond, NULL);
+	pthread_create(&slices->worker, NULL, slice_worker, slices);
+	return true;
+}
+
+
+
+// The slices through voxel of the frame's image, those which differ from the wanted ones are extracted again
+void request_slices(struct slices *slices, const char *image, int frame, const int voxel[3])
+{
+	pthread_mutex_lock(&slices->lock);
+	for (int p = 0; p < 3; p++) {
+		struct slice_key key = { image, frame, voxel[plane_axes[p][2]], slices->generation };
+		if (same_slice(&key, &slices->want[p])) continue;
+		slices->want[p] = key;
+		// One which is being extracted is wanted again once it's uploaded
+		if (slices->state[p] == SLICE_UPLOADED) slices->state[p] = SLICE_WANTED;
+		pthread_cond_signal(&slices->cond);
+	}
+	pthread_mutex_unlock(&slices->lock);
+	return;
+}
+
+
+
+// The data changed, the next request extracts all slices again
+void invalidate_slices(struct slices *slices)
+{
+	pthread_mutex_lock(&slices->lock);
+	slices->generation++;
+	pthread_mutex_unlock(&slices->lock);
+	return;
+}
+
+
+
+bool slices_ready(struct slices *slices)
+{
+	pthread_mutex_lock(&slices->lock);
+	bool ready = false;
+	for (int p = 0; p < 3; p++) ready |= slices->state[p] == SLICE_READY;
+	pthread_mutex_unlock(&slices->lock);
+	return ready;
+}
+
+
+
+// Returns true if any slice was uploaded, slices wanted meanwhile are extracted next
+bool upload_slices(struct slices *slices)
+{
+	const struct texture_format *f = &texture_formats[slices->dtype];
+	bool uploaded = false;
+	pthread_mutex_lock(&slices->lock);
+	for (int p = 0; p < 3; p++) {
+		if (slices->state[p] != SLICE_READY) continue;
+		if (!uploaded) {
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+		}
+		glTextureSubImage3D(
+			slices->texture, 0, 0, 0, p, slices->size[slice_axes[p][0]], slices->size[slice_axes[p][1]], 1,
+			f->format, f->type, slices->extracted[p]
+		);
+		slices->shown[p] = slices->extracting[p].slice;
+		bool moved = !same_slice(&slices->extracting[p], &slices->want[p]);
+		slices->state[p] = moved ? SLICE_WANTED : SLICE_UPLOADED;
+		if (moved) pthread_cond_signal(&slices->cond);
+		uploaded = true;
+	}
+	pthread_mutex_unlock(&slices->lock);
+	return uploaded;
+}
+
+
+
+void set_slice_uniforms(struct slices *slices, GLuint program)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "sliced"), true);
+	glUniform3iv(glGetUniformLocation(program, "slices_shown"), 1, slices->shown);
+	return;
+}
+
+
+
+void delete_slices(struct slices *slices)
+{
+	pthread_mutex_lock(&slices->lock);
+	slices->quit = true;
+	pthread_cond_signal(&slices->cond);
+	pthread_mutex_unlock(&slices->lock);
+	pthread_join(slices->worker, NULL);
+	pthread_mutex_destroy(&slices->lock);
+	pthread_cond_destroy(&slices->cond);
+	glDeleteTextures(1, &slices->texture);
+	for (int p = 0; p < 3; p++) free(slices->extracted[p]);
+	return;
+}
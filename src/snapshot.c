@@ -0,0 +1,56 @@
+#include <stdatomic.h>
+
+// The latest state handed from one thread to another without locks, e.g. the view from the input thread
+// to the render thread. It's a double buffer with a third slot in the middle: the writer fills its slot and
+// swaps it with the middle one, the reader swaps its slot with the middle one if that is new.
+// Neither waits for the other, the reader gets the last state published and may skip those in between.
+#define SNAPSHOT_NEW 4 // Flag in middle, published but not taken yet
+
+struct snapshot {
+	char *slots[3];
+	size_t size;
+	atomic_int middle;
+	int write, read; // Slots of the writer and reader
+};
+
+
+
+void setup_snapshot(struct snapshot *snapshot, size_t size)
+{
+	snapshot->size = size;
+	for (int i = 0; i < 3; i++) snapshot->slots[i] = calloc(1, size);
+	snapshot->write = 0;
+	atomic_init(&snapshot->middle, 1);
+	snapshot->read = 2;
+	return;
+}
+
+
+
+// Writer only
+void publish_snapshot(struct snapshot *snapshot, const void *state)
+{
+	memcpy(snapshot->slots[snapshot->write], state, snapshot->size);
+	snapshot->write = atomic_exchange(&snapshot->middle, snapshot->write | SNAPSHOT_NEW) & ~SNAPSHOT_NEW;
+	return;
+}
+
+
+
+// Reader only, returns NULL if nothing was published since the last call.
+// The state stays valid until the next call.
+const void* take_snapshot(struct snapshot *snapshot)
+{
+	if (!(atomic_load(&snapshot->middle) & SNAPSHOT_NEW)) return NULL;
+	snapshot->read = atomic_exchange(&snapshot->middle, snapshot->read) & ~SNAPSHOT_NEW;
+	return snapshot->slots[snapshot->read];
+}
+
+
+
+void delete_snapshot(struct snapshot *snapshot)
+{
+	for (int i = 0; i < 3; i++) free(snapshot->slots[i]);
+	return;
+}
+
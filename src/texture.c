@@ -1,10 +1,84 @@
-GLuint setup_texture(float *image, int size[3])
+// Data is uploaded in its native type, normalised integer formats are scaled back in the shader.
+// Complex volumes are two channels, real and imaginary, with COMPLEX_HALF in half precision on the GPU.
+struct texture_format {
+	GLenum internal_format, format, type;
+	float scale;
+};
+
+const struct texture_format texture_formats[NUM_DTYPES] = {
+	[DTYPE_UINT8]   = {GL_R8,       GL_RED, GL_UNSIGNED_BYTE,  255.0  },
+	[DTYPE_INT16]   = {GL_R16_SNORM, GL_RED, GL_SHORT,         32767.0},
+	[DTYPE_UINT16]  = {GL_R16,      GL_RED, GL_UNSIGNED_SHORT, 65535.0},
+	[DTYPE_FLOAT16] = {GL_R16F,     GL_RED, GL_HALF_FLOAT,     1.0    },
+	[DTYPE_FLOAT32] = {GL_R32F,     GL_RED, GL_FLOAT,          1.0    },
+#ifdef COMPLEX_HALF
+	[DTYPE_COMPLEX64] = {GL_RG16F,  GL_RG,  GL_FLOAT,          1.0    }
+#else
+	[DTYPE_COMPLEX64] = {GL_RG32F,  GL_RG,  GL_FLOAT,          1.0    }
+#endif
+};
+
+
+
+// Largest copy made for strides which GL can't unpack
+#ifndef MAX_STAGING_BYTES
+	#define MAX_STAGING_BYTES ((size_t)16 << 20)
+#endif
+
+
+
+// Into the texture bound to target, straight from the image if possible, otherwise gathered in slabs of z.
+// Pixels are in format f, e.g. integers for labels (labels.c), slices of 2D arrays are layers (grid.c).
+void upload_box_as(
+	GLenum target, const struct texture_format *f, int level, const int offset[3], const int extent[3], const char *image,
+	const ptrdiff_t strides[3], int dtype
+) {
+	if (unpackable_strides(dtype, strides)) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, strides[1] / strides[0]);
+		glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, strides[2] / strides[1]);
+		glTexSubImage3D(
+			target, level, offset[0], offset[1], offset[2], extent[0], extent[1], extent[2],
+			f->format, f->type, image
+		);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+		return;
+	}
+	size_t slice_bytes = dtype_size[dtype] * extent[0] * extent[1];
+	int depth = fmax(1, fmin(extent[2], MAX_STAGING_BYTES / slice_bytes));
+	char *staging = malloc(slice_bytes * depth);
+	for (int z = 0; z < extent[2]; z += depth) {
+		int slab[3] = {extent[0], extent[1], fmin(depth, extent[2] - z)};
+		copy_box(dtype, image + z * strides[2], strides, slab, staging);
+		glTexSubImage3D(
+			target, level, offset[0], offset[1], offset[2] + z, slab[0], slab[1], slab[2],
+			f->format, f->type, staging
+		);
+	}
+	free(staging);
+	return;
+}
+
+
+
+void upload_box(int level, const int offset[3], const int extent[3], const char *image, const ptrdiff_t strides[3], int dtype)
 {
+	upload_box_as(GL_TEXTURE_3D, &texture_formats[dtype], level, offset, extent, image, strides, dtype);
+	return;
+}
+
+
+
+// Only level 0 is uploaded, the others are filled by upload_mipmaps()
+GLuint setup_texture(void *image, int dtype, int size[3], const ptrdiff_t strides[3], int levels)
+{
+	const struct texture_format *f = &texture_formats[dtype];
 	GLuint texture;
 	glActiveTexture(GL_TEXTURE0);
 	glGenTextures(1, &texture);
 	glBindTexture(GL_TEXTURE_3D, texture);
-	glTexStorage3D(GL_TEXTURE_3D, 1, GL_R32F, size[0], size[1], size[2]);
+	glTexStorage3D(GL_TEXTURE_3D, levels, f->internal_format, size[0], size[1], size[2]);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
 	long rst_coordinates[3] = {GL_TEXTURE_WRAP_R, GL_TEXTURE_WRAP_S, GL_TEXTURE_WRAP_T};
@@ -12,8 +86,369 @@ GLuint setup_texture(float *image, int size[3])
 	const float zeros[4] = {0.0, 0.0, 0.0, 0.0};
 	glTexParameterfv(GL_TEXTURE_3D, GL_TEXTURE_BORDER_COLOR, zeros);
 
-	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, size[0], size[1], size[2], GL_RED, GL_FLOAT, image);
+	const int zeros_offset[3] = {0, 0, 0};
+	upload_box(0, zeros_offset, size, image, strides, dtype);
 
 	return texture;
 }
 
+
+
+
+// Out-of-core volumes: the volume is split into bricks of BRICK_SIZE^3 voxels, only bricks crossed by
+// the three displayed slices are uploaded into slots of an atlas texture with a fixed memory budget.
+// The indirection texture holds for every brick the slot coordinates (rgb) and whether it is resident (a).
+#ifndef BRICK_SIZE
+	#define BRICK_SIZE 32
+#endif
+
+struct brick_cache {
+	char *image;
+	struct chunked_image *chunks; // NULL unless the image is decoded on demand
+	int image_frame;
+	int dtype;
+	int size[3];
+	ptrdiff_t strides[3];
+	int nbricks[3];     // Per axis of the volume
+	int nslots[3];      // Per axis of the atlas
+	int *slot;          // Per brick, -1 if not resident
+	unsigned int *need; // Per brick, frame in which it was last needed
+	int *brick;         // Per slot, -1 if empty
+	unsigned int *used; // Per slot, frame in which it was last needed
+	unsigned int frame;
+	int *missing;       // Needed bricks which are not resident, nearest to the cursor first
+	int nmissing;
+	GLuint atlas, indirection;
+};
+
+struct brick_distance {
+	float distance;
+	int brick;
+};
+
+
+
+int compare_brick_distance(const void *a, const void *b)
+{
+	float d = ((struct brick_distance *)a)->distance - ((struct brick_distance *)b)->distance;
+	return (d > 0) - (d < 0);
+}
+
+
+
+bool needs_bricks(int dtype, int size[3], size_t budget)
+{
+	GLint max_size;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+	size_t bytes = dtype_size[dtype] * size[0] * size[1] * size[2];
+	return bytes > budget || size[0] > max_size || size[1] > max_size || size[2] > max_size;
+}
+
+
+
+void setup_brick_cache(
+	struct brick_cache *cache, void *image, int dtype, int size[3], const ptrdiff_t strides[3], size_t budget,
+	struct chunked_image *chunks
+) {
+	cache->image = image;
+	cache->chunks = chunks;
+	cache->image_frame = 0;
+	cache->dtype = dtype;
+	for (int i = 0; i < 3; i++) cache->strides[i] = strides[i];
+	size_t total_bricks = 1;
+	for (int i = 0; i < 3; i++) {
+		cache->size[i] = size[i];
+		cache->nbricks[i] = (size[i] + BRICK_SIZE - 1) / BRICK_SIZE;
+		total_bricks *= cache->nbricks[i];
+	}
+
+	// Arrange slots in the atlas
+	GLint max_size;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+	int max_slots = max_size / BRICK_SIZE;
+	if (max_slots > 255) max_slots = 255; // Slot coordinates are stored as bytes
+	size_t total_slots = budget / (dtype_size[dtype] * BRICK_SIZE * BRICK_SIZE * BRICK_SIZE);
+	if (total_slots > total_bricks) total_slots = total_bricks;
+	if (total_slots < 1) total_slots = 1;
+	cache->nslots[0] = fmin(max_slots, fmax(1, floor(cbrt(total_slots))));
+	cache->nslots[1] = fmin(max_slots, fmax(1, floor(sqrt(total_slots / cache->nslots[0]))));
+	cache->nslots[2] = fmin(max_slots, fmax(1, total_slots / (cache->nslots[0] * cache->nslots[1])));
+	total_slots = cache->nslots[0] * cache->nslots[1] * cache->nslots[2];
+
+	cache->slot    = malloc(sizeof(int) * total_bricks);
+	cache->need    = calloc(total_bricks, sizeof(unsigned int));
+	cache->missing = malloc(sizeof(int) * total_bricks);
+	cache->brick   = malloc(sizeof(int) * total_slots);
+	cache->used    = calloc(total_slots, sizeof(unsigned int));
+	for (size_t i = 0; i < total_bricks; i++) cache->slot[i] = -1;
+	for (size_t i = 0; i < total_slots; i++) cache->brick[i] = -1;
+	cache->frame = 0;
+	cache->nmissing = 0;
+
+	glActiveTexture(GL_TEXTURE0);
+	glGenTextures(1, &cache->atlas);
+	glBindTexture(GL_TEXTURE_3D, cache->atlas);
+	glTexStorage3D(
+		GL_TEXTURE_3D, 1, texture_formats[dtype].internal_format,
+		cache->nslots[0] * BRICK_SIZE,
+		cache->nslots[1] * BRICK_SIZE,
+		cache->nslots[2] * BRICK_SIZE
+	);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glActiveTexture(GL_TEXTURE1);
+	glGenTextures(1, &cache->indirection);
+	glBindTexture(GL_TEXTURE_3D, cache->indirection);
+	glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA8UI, cache->nbricks[0], cache->nbricks[1], cache->nbricks[2]);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glClearTexImage(cache->indirection, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+	glActiveTexture(GL_TEXTURE0);
+	return;
+}
+
+
+
+// Determines which bricks are crossed by the visible part of the slices, corners as displayed (displayed_corners()).
+// Missing bricks are uploaded nearest to the cursor first. With a thickness in voxels, bricks within half of it
+// along the normal count as crossed, for slabs (slab.c).
+void update_bricks(struct brick_cache *cache, float corners[3][4][3], float cursor[3], int thickness)
+{
+	cache->frame++;
+	int *nb = cache->nbricks;
+
+	struct brick_distance *missing = malloc(sizeof(struct brick_distance) * nb[0] * nb[1] * nb[2]);
+	int nmissing = 0;
+
+	for (int p = 0; p < 3; p++) {
+		// In voxels, a brick is crossed if it touches the plane and its projections onto the edges overlap them
+		float origin[3], edges[2][3], normal[3];
+		int lower[3], upper[3];
+		for (int i = 0; i < 3; i++) {
+			origin[i] = corners[p][0][i] * cache->size[i];
+			edges[0][i] = (corners[p][1][i] - corners[p][0][i]) * cache->size[i];
+			edges[1][i] = (corners[p][3][i] - corners[p][0][i]) * cache->size[i];
+			float lo = origin[i], hi = origin[i];
+			for (int c = 1; c < 4; c++) {
+				lo = fmin(lo, corners[p][c][i] * cache->size[i]);
+				hi = fmax(hi, corners[p][c][i] * cache->size[i]);
+			}
+			lower[i] = fmax(0,        floor((lo - 0.5 * thickness) / BRICK_SIZE));
+			upper[i] = fmin(nb[i] - 1, floor((hi + 0.5 * thickness) / BRICK_SIZE));
+		}
+		for (int i = 0; i < 3; i++) normal[i] = edges[0][(i+1)%3] * edges[1][(i+2)%3] - edges[0][(i+2)%3] * edges[1][(i+1)%3];
+		// Pointing to larger coordinates, so that a slice on the border of two bricks is in the upper one as when sampled
+		int largest = 0;
+		for (int i = 1; i < 3; i++) if (fabs(normal[i]) > fabs(normal[largest])) largest = i;
+		if (normal[largest] < 0) for (int i = 0; i < 3; i++) normal[i] = -normal[i];
+		float reach[3] = {0, 0, 0}, lengths[2] = {0, 0}; // Half of a brick projected onto the normal and edges
+		float length = 0;
+		for (int i = 0; i < 3; i++) {
+			reach[0] += 0.5 * BRICK_SIZE * fabs(normal[i]);
+			length += normal[i] * normal[i];
+			for (int e = 0; e < 2; e++) {
+				reach[1+e] += 0.5 * BRICK_SIZE * fabs(edges[e][i]);
+				lengths[e] += edges[e][i] * edges[e][i];
+			}
+		}
+		reach[0] += 0.5 * thickness * sqrt(length);
+
+		for (int z = lower[2]; z <= upper[2]; z++) {
+			for (int y = lower[1]; y <= upper[1]; y++) {
+				for (int x = lower[0]; x <= upper[0]; x++) {
+					int brick_coords[3] = {x, y, z};
+					float offset[3], along[3] = {0, 0, 0};
+					for (int i = 0; i < 3; i++) {
+						offset[i] = (brick_coords[i] + 0.5) * BRICK_SIZE - origin[i];
+						along[0] += normal[i] * offset[i];
+						along[1] += edges[0][i] * offset[i];
+						along[2] += edges[1][i] * offset[i];
+					}
+					if (along[0] <= -reach[0] || along[0] > reach[0]) continue;
+					if (along[1] + reach[1] <= 0 || along[1] - reach[1] > lengths[0]) continue;
+					if (along[2] + reach[2] <= 0 || along[2] - reach[2] > lengths[1]) continue;
+
+					int b = x + nb[0] * (y + nb[1] * z);
+					if (cache->need[b] == cache->frame) continue;
+					cache->need[b] = cache->frame;
+					int s = cache->slot[b];
+					if (s != -1) {
+						cache->used[s] = cache->frame;
+						continue;
+					}
+					float distance = 0;
+					for (int i = 0; i < 3; i++) {
+						float d = (brick_coords[i] + 0.5) * BRICK_SIZE - cursor[i] * cache->size[i];
+						distance += d * d;
+					}
+					missing[nmissing++] = (struct brick_distance){distance, b};
+				}
+			}
+		}
+	}
+
+	qsort(missing, nmissing, sizeof(struct brick_distance), compare_brick_distance);
+	for (int i = 0; i < nmissing; i++) cache->missing[i] = missing[i].brick;
+	cache->nmissing = nmissing;
+	free(missing);
+	return;
+}
+
+
+
+// Uploads at most max_uploads of the missing bricks, returns the number of bricks still missing.
+// If the budget is exhausted, bricks furthest from the cursor stay missing and are drawn as zero.
+int upload_bricks(struct brick_cache *cache, int max_uploads)
+{
+	int total_slots = cache->nslots[0] * cache->nslots[1] * cache->nslots[2];
+	int *nb = cache->nbricks;
+	int *ns = cache->nslots;
+	int *size = cache->size;
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_3D, cache->atlas);
+
+	// Chunks of the bricks to upload are decoded together, in parallel, and released after uploading
+	int nload = fmin(cache->nmissing, max_uploads);
+	int (*lower)[3] = NULL, (*upper)[3] = NULL;
+	if (cache->chunks != NULL && nload > 0) {
+		lower = malloc(sizeof(int[3]) * nload);
+		upper = malloc(sizeof(int[3]) * nload);
+		for (int m = 0; m < nload; m++) {
+			int b = cache->missing[m];
+			int brick[3] = {b % nb[0], (b / nb[0]) % nb[1], b / (nb[0] * nb[1])};
+			for (int i = 0; i < 3; i++) {
+				lower[m][i] = brick[i] * BRICK_SIZE;
+				upper[m][i] = fmin(size[i], lower[m][i] + BRICK_SIZE);
+			}
+		}
+		load_boxes(cache->chunks, cache->image_frame, lower, upper, nload);
+	}
+
+	int uploaded = 0;
+	while (uploaded < cache->nmissing && uploaded < max_uploads) {
+		int b = cache->missing[uploaded];
+
+		// Least recently used slot which isn't needed now
+		int s = -1;
+		unsigned int oldest = cache->frame;
+		for (int i = 0; i < total_slots; i++) {
+			if (cache->brick[i] == -1) {
+				s = i;
+				break;
+			}
+			if (cache->used[i] < oldest) {
+				oldest = cache->used[i];
+				s = i;
+			}
+		}
+		if (s == -1) {
+			cache->nmissing = uploaded; // Budget exhausted
+			break;
+		}
+
+		// Evict
+		GLubyte texel[4] = {0, 0, 0, 0};
+		int evicted = cache->brick[s];
+		if (evicted != -1) {
+			cache->slot[evicted] = -1;
+			glTextureSubImage3D(
+				cache->indirection, 0,
+				evicted % nb[0], (evicted / nb[0]) % nb[1], evicted / (nb[0] * nb[1]),
+				1, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, texel
+			);
+		}
+
+		// Upload straight from the image, which can be a mapped file
+		int offset[3] = {b % nb[0], (b / nb[0]) % nb[1], b / (nb[0] * nb[1])};
+		int slot[3] = {s % ns[0], (s / ns[0]) % ns[1], s / (ns[0] * ns[1])};
+		int extent[3];
+		for (int i = 0; i < 3; i++) {
+			offset[i] *= BRICK_SIZE;
+			extent[i] = fmin(BRICK_SIZE, size[i] - offset[i]);
+		}
+		char *brick = cache->image;
+		for (int i = 0; i < 3; i++) brick += offset[i] * cache->strides[i];
+		for (int i = 0; i < 3; i++) slot[i] *= BRICK_SIZE;
+		upload_box(0, slot, extent, brick, cache->strides, cache->dtype);
+		for (int i = 0; i < 3; i++) slot[i] /= BRICK_SIZE;
+		for (int i = 0; i < 3; i++) texel[i] = slot[i];
+		texel[3] = 1;
+		glTextureSubImage3D(
+			cache->indirection, 0,
+			offset[0] / BRICK_SIZE, offset[1] / BRICK_SIZE, offset[2] / BRICK_SIZE,
+			1, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, texel
+		);
+		cache->slot[b] = s;
+		cache->brick[s] = b;
+		cache->used[s] = cache->frame;
+		uploaded++;
+	}
+	if (lower != NULL) {
+		release_boxes(cache->chunks, cache->image_frame, lower, upper, nload);
+		free(lower);
+		free(upper);
+	}
+
+	cache->nmissing -= uploaded;
+	memmove(cache->missing, cache->missing + uploaded, sizeof(int) * cache->nmissing);
+	return cache->nmissing;
+}
+
+
+
+// Evicts all bricks, e.g. when switching frames, image is that of the frame
+void set_brick_image(struct brick_cache *cache, void *image, int frame)
+{
+	cache->image = image;
+	cache->image_frame = frame;
+	size_t total_bricks = cache->nbricks[0] * cache->nbricks[1] * cache->nbricks[2];
+	int total_slots = cache->nslots[0] * cache->nslots[1] * cache->nslots[2];
+	for (size_t i = 0; i < total_bricks; i++) cache->slot[i] = -1;
+	for (int i = 0; i < total_slots; i++) cache->brick[i] = -1;
+	cache->nmissing = 0;
+	glClearTexImage(cache->indirection, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+	return;
+}
+
+
+
+// Evicts the bricks overlapping the box from lower to upper (exclusive), e.g. if the image changed there
+void invalidate_bricks(struct brick_cache *cache, const int lower[3], const int upper[3])
+{
+	int *nb = cache->nbricks;
+	int first[3], last[3];
+	for (int i = 0; i < 3; i++) {
+		first[i] = fmax(0, lower[i] / BRICK_SIZE);
+		last[i] = fmin(nb[i] - 1, (upper[i] - 1) / BRICK_SIZE);
+	}
+	GLubyte texel[4] = {0, 0, 0, 0};
+	for (int z = first[2]; z <= last[2]; z++) {
+		for (int y = first[1]; y <= last[1]; y++) {
+			for (int x = first[0]; x <= last[0]; x++) {
+				int b = x + nb[0] * (y + nb[1] * z);
+				int s = cache->slot[b];
+				if (s == -1) continue;
+				cache->slot[b] = -1;
+				cache->brick[s] = -1;
+				glTextureSubImage3D(cache->indirection, 0, x, y, z, 1, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, texel);
+			}
+		}
+	}
+	return;
+}
+
+
+
+void delete_brick_cache(struct brick_cache *cache)
+{
+	glDeleteTextures(1, &cache->atlas);
+	glDeleteTextures(1, &cache->indirection);
+	free(cache->slot);
+	free(cache->need);
+	free(cache->brick);
+	free(cache->used);
+	free(cache->missing);
+	return;
+}
@@ -0,0 +1,261 @@
+// Tracing of the render thread: CPU time of each stage, GPU time of the draw, and the latency from sampling
+// the input which caused a redraw to the swap. The latency histogram is printed when quitting,
+// the events can be dumped in Chrome's trace format (chrome://tracing, ui.perfetto.dev).
+// Input is sampled on the input thread, the input stage here only takes the state it published.
+// F1 toggles an overlay with one bar per stage of the last frame, the full width is TRACE_OVERLAY_MS.
+// GPU times come from timestamp queries which are read a few frames later, so the loop doesn't stall.
+#ifndef TRACE_GPU_QUERIES
+	#define TRACE_GPU_QUERIES 4
+#endif
+#define TRACE_OVERLAY_MS 20.0
+#define MAX_TRACE_EVENTS (1 << 22)
+#define TRACE_BUCKETS 12 // Latency histogram, upper bounds 0.5 ms to 512 ms and one for anything above
+
+enum trace_stage { TRACE_WAIT, TRACE_INPUT, TRACE_UPDATE, TRACE_UPLOAD, TRACE_DRAW, TRACE_SWAP, TRACE_GPU, NUM_TRACE_STAGES };
+const char *trace_stage_names[NUM_TRACE_STAGES] = {"wait", "input", "update", "upload", "draw", "swap", "gpu"};
+const float trace_stage_colours[NUM_TRACE_STAGES][3] = {
+	{0.3, 0.3, 0.3}, {0.2, 0.6, 1.0}, {1.0, 0.8, 0.2}, {1.0, 0.4, 0.1}, {0.2, 0.9, 0.3}, {0.8, 0.3, 0.9}, {1.0, 0.2, 0.2}
+};
+
+struct trace_event {
+	char stage;
+	double start, duration; // Seconds, glfwGetTime()
+};
+
+struct trace {
+	const char *path; // Of the dump, NULL if none
+	int stage;
+	double stage_start;
+	double input_time; // Last sampling of the input
+	double frame_time[NUM_TRACE_STAGES];
+	double last_time[NUM_TRACE_STAGES]; // Of the last frame, for the overlay
+	double last_latency;
+	unsigned long histogram[TRACE_BUCKETS];
+	double latency_sum, latency_max;
+	struct trace_event *events;
+	size_t nevents;
+	bool overlay;
+	bool overlay_used; // The histogram is only reported if tracing was asked for
+	// GPU
+	GLuint queries[TRACE_GPU_QUERIES][2];
+	bool pending[TRACE_GPU_QUERIES];
+	int query;
+	double gpu_offset; // CPU minus GPU time in seconds
+};
+
+
+
+void setup_trace(struct trace *trace, const char *path)
+{
+	memset(trace, 0, sizeof(struct trace));
+	trace->path = path;
+	if (path != NULL) trace->events = malloc(sizeof(struct trace_event) * MAX_TRACE_EVENTS);
+	glGenQueries(2 * TRACE_GPU_QUERIES, &trace->queries[0][0]);
+	GLint64 gpu_time;
+	glGetInteger64v(GL_TIMESTAMP, &gpu_time);
+	trace->gpu_offset = glfwGetTime() - 1e-9 * gpu_time;
+	trace->stage = TRACE_WAIT;
+	trace->stage_start = glfwGetTime();
+	return;
+}
+
+
+
+void add_trace_event(struct trace *trace, int stage, double start, double duration)
+{
+	trace->frame_time[stage] += duration;
+	if (trace->events == NULL || trace->nevents == MAX_TRACE_EVENTS) return;
+	trace->events[trace->nevents++] = (struct trace_event) {stage, start, duration};
+	return;
+}
+
+
+
+// Ends the current stage and starts the next
+void trace_stage(struct trace *trace, int stage)
+{
+	double now = glfwGetTime();
+	add_trace_event(trace, trace->stage, trace->stage_start, now - trace->stage_start);
+	if (stage == TRACE_INPUT) trace->input_time = now;
+	trace->stage = stage;
+	trace->stage_start = now;
+	return;
+}
+
+
+
+void trace_gpu_begin(struct trace *trace)
+{
+	if (!trace->pending[trace->query]) glQueryCounter(trace->queries[trace->query][0], GL_TIMESTAMP);
+	return;
+}
+
+
+
+void trace_gpu_end(struct trace *trace)
+{
+	int q = trace->query;
+	if (trace->pending[q]) return; // Not read yet, this frame isn't measured
+	glQueryCounter(trace->queries[q][1], GL_TIMESTAMP);
+	trace->pending[q] = true;
+	trace->query = (q + 1) % TRACE_GPU_QUERIES;
+	return;
+}
+
+
+
+// Reads the GPU times which are available
+void read_gpu_trace(struct trace *trace)
+{
+	for (int i = 0; i < TRACE_GPU_QUERIES; i++) {
+		int q = (trace->query + i) % TRACE_GPU_QUERIES;
+		if (!trace->pending[q]) continue;
+		GLint available;
+		glGetQueryObjectiv(trace->queries[q][1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) break;
+		GLuint64 start, end;
+		glGetQueryObjectui64v(trace->queries[q][0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(trace->queries[q][1], GL_QUERY_RESULT, &end);
+		double duration = 1e-9 * (end - start);
+		add_trace_event(trace, TRACE_GPU, 1e-9 * start + trace->gpu_offset, duration);
+		trace->last_time[TRACE_GPU] = duration;
+		trace->frame_time[TRACE_GPU] = 0;
+		trace->pending[q] = false;
+	}
+	return;
+}
+
+
+
+// Called after the swap
+void end_trace_frame(struct trace *trace)
+{
+	trace_stage(trace, TRACE_WAIT);
+	read_gpu_trace(trace);
+	double latency = trace->stage_start - trace->input_time;
+	trace->last_latency = latency;
+	trace->latency_sum += latency;
+	trace->latency_max = fmax(trace->latency_max, latency);
+	int bucket = 0;
+	while (bucket < TRACE_BUCKETS - 1 && latency * 1e3 > 0.5 * (1 << bucket)) bucket++;
+	trace->histogram[bucket]++;
+	for (int s = 0; s < NUM_TRACE_STAGES; s++) {
+		if (s == TRACE_GPU) continue;
+		trace->last_time[s] = trace->frame_time[s];
+		trace->frame_time[s] = 0;
+	}
+	return;
+}
+
+
+
+// F1 on the input thread, previous is the key's state, returns true if the overlay was toggled
+bool handle_trace_keys(GLFWwindow *window, bool *overlay, bool *previous)
+{
+	bool state = key_down(window, GLFW_KEY_F1);
+	bool pressed = state && !*previous;
+	*previous = state;
+	if (pressed) *overlay = !*overlay;
+	return pressed;
+}
+
+
+
+// Returns true if the overlay was switched on or off
+bool set_trace_overlay(struct trace *trace, bool overlay)
+{
+	if (overlay == trace->overlay) return false;
+	trace->overlay = overlay;
+	if (overlay && !trace->overlay_used) {
+		trace->overlay_used = true;
+		printf("Overlay bars from the top, full width is %.0f ms:", TRACE_OVERLAY_MS);
+		for (int s = TRACE_INPUT; s < NUM_TRACE_STAGES; s++) printf(" %s", trace_stage_names[s]);
+		printf(" and latency\n");
+	}
+	return true;
+}
+
+
+
+// Bars are cleared rectangles, drawn into the bound framebuffer
+void draw_trace_overlay(struct trace *trace, int width, int height)
+{
+	if (!trace->overlay) return;
+	const int bar_height = 6, gap = 2, margin = 4;
+	float pixels_per_second = (width / 3) / (1e-3 * TRACE_OVERLAY_MS);
+	glEnable(GL_SCISSOR_TEST);
+	int row = 0;
+	for (int s = TRACE_INPUT; s <= NUM_TRACE_STAGES; s++, row++) {
+		double time = s < NUM_TRACE_STAGES ? trace->last_time[s] : trace->last_latency;
+		int length = fmin(width - 2 * margin, fmax(1, time * pixels_per_second));
+		int y = height - margin - (row + 1) * bar_height - row * gap;
+		glScissor(margin, y, length, bar_height);
+		if (s < NUM_TRACE_STAGES) glClearColor(trace_stage_colours[s][0], trace_stage_colours[s][1], trace_stage_colours[s][2], 1);
+		else glClearColor(1, 1, 1, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+	glDisable(GL_SCISSOR_TEST);
+	glClearColor(0, 0, 0, 1);
+	return;
+}
+
+
+
+void report_trace(struct trace *trace)
+{
+	unsigned long frames = 0;
+	for (int b = 0; b < TRACE_BUCKETS; b++) frames += trace->histogram[b];
+	if (frames == 0) return;
+	unsigned long most = 0;
+	for (int b = 0; b < TRACE_BUCKETS; b++) if (trace->histogram[b] > most) most = trace->histogram[b];
+	printf(
+		"Input to swap latency over %lu frames: mean %.2f ms, max %.2f ms\n",
+		frames, 1e3 * trace->latency_sum / frames, 1e3 * trace->latency_max
+	);
+	for (int b = 0; b < TRACE_BUCKETS; b++) {
+		if (b < TRACE_BUCKETS - 1) printf("  <= %6.1f ms ", 0.5 * (1 << b));
+		else printf("   > %6.1f ms ", 0.5 * (1 << (b - 1)));
+		int n = 40 * trace->histogram[b] / most;
+		for (int i = 0; i < n; i++) putchar('#');
+		printf(" %lu\n", trace->histogram[b]);
+	}
+	return;
+}
+
+
+
+// Chrome's trace event format, times in microseconds
+void dump_trace(struct trace *trace)
+{
+	FILE *file = fopen(trace->path, "w");
+	if (file == NULL) {
+		printf("Error: could not write %s\n", trace->path);
+		return;
+	}
+	fprintf(file, "{\"traceEvents\": [\n");
+	fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}},\n");
+	fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}");
+	for (size_t i = 0; i < trace->nevents; i++) {
+		struct trace_event *e = &trace->events[i];
+		fprintf(
+			file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.1f, \"dur\": %.1f}",
+			trace_stage_names[(int)e->stage], e->stage == TRACE_GPU ? 2 : 1, 1e6 * e->start, 1e6 * e->duration
+		);
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+	printf("Trace with %zu events written to %s\n", trace->nevents, trace->path);
+	return;
+}
+
+
+
+void stop_trace(struct trace *trace)
+{
+	if (trace->path != NULL || trace->overlay_used) report_trace(trace);
+	if (trace->path != NULL) dump_trace(trace);
+	free(trace->events);
+	glDeleteQueries(2 * TRACE_GPU_QUERIES, &trace->queries[0][0]);
+	return;
+}
+
@@ -0,0 +1,329 @@
+#include <pthread.h>
+
+// What is viewed: an image owned by the caller, which may be strided (e.g. a view of a numpy or Julia array)
+// and may change while it is viewed. Changes are reported as boxes per frame from any thread,
+// the render thread takes them and re-uploads only these regions.
+#ifndef MAX_CHANGES
+	#define MAX_CHANGES 64 // Queued regions, more are merged into one change of everything
+#endif
+
+struct change {
+	int frame; // -1 for all frames
+	int lower[3], upper[3]; // Voxels, upper is exclusive
+};
+
+struct viewer {
+	char *image;
+	int dtype;
+	int size[3];
+	ptrdiff_t strides[4]; // Bytes, see contiguous_strides()
+	int nframes;
+	struct chunked_image *chunks; // If the image is decoded on demand, see load_box()
+	pthread_mutex_t lock;
+	struct change changes[MAX_CHANGES];
+	int nchanges;
+	bool all_changed;
+	// Label map of the same size (labels.c), NULL if none, generation counts calls of set_viewer_labels()
+	char *labels;
+	int label_dtype;
+	ptrdiff_t label_strides[3];
+	unsigned int label_generation;
+	struct change label_changes[MAX_CHANGES];
+	int nlabel_changes;
+	bool all_labels_changed;
+	int new_windows; // To be opened by the event loop
+	uint64_t new_linked; // Bit i if the i-th of them links to the viewer's windows open by then, see add_windows()
+	int started;     // 1 once a window of it was set up for drawing, -1 if that failed, see set_viewer_started()
+	pthread_cond_t cond; // Signalled when started is set
+	bool quit;       // Asks the event loop to close the viewer's windows
+	bool open;       // The event loop runs, so empty events can be posted
+	int nwindows;    // Open in the event loop, counted by it
+};
+
+
+
+// Strides can be NULL if the image is contiguous
+void setup_viewer(struct viewer *viewer, void *image, int dtype, const int size[3], const ptrdiff_t strides[4], int nframes)
+{
+	memset(viewer, 0, sizeof(struct viewer));
+	viewer->image = image;
+	viewer->dtype = dtype;
+	for (int i = 0; i < 3; i++) viewer->size[i] = size[i];
+	viewer->nframes = nframes;
+	viewer->new_windows = 1;
+	contiguous_strides(dtype, viewer->size, viewer->strides);
+	if (strides != NULL) {
+		for (int i = 0; i < 4; i++) viewer->strides[i] = strides[i];
+	}
+	pthread_mutex_init(&viewer->lock, NULL);
+	pthread_cond_init(&viewer->cond, NULL);
+	return;
+}
+
+
+
+void delete_viewer(struct viewer *viewer)
+{
+	pthread_mutex_destroy(&viewer->lock);
+	pthread_cond_destroy(&viewer->cond);
+	return;
+}
+
+
+
+// Wakes the event loop, which wakes the render thread, needs the lock
+void wake_viewer(struct viewer *viewer)
+{
+	if (viewer->open) glfwPostEmptyEvent();
+	return;
+}
+
+
+
+// Clipped to the image, returns false if empty
+bool clip_change(struct viewer *viewer, struct change *change, const int lower[3], const int upper[3])
+{
+	for (int i = 0; i < 3; i++) {
+		change->lower[i] = lower == NULL ? 0 : fmax(0, lower[i]);
+		change->upper[i] = upper == NULL ? viewer->size[i] : fmin(viewer->size[i], upper[i]);
+		if (change->lower[i] >= change->upper[i]) return false;
+	}
+	return true;
+}
+
+
+
+// Lower and upper can be NULL for the whole frame, frame -1 means all frames
+void report_change(struct viewer *viewer, int frame, const int lower[3], const int upper[3])
+{
+	struct change change = { .frame = frame };
+	if (!clip_change(viewer, &change, lower, upper)) return;
+	if (frame < -1 || frame >= viewer->nframes) return;
+
+	pthread_mutex_lock(&viewer->lock);
+	if (viewer->nchanges == MAX_CHANGES) viewer->all_changed = true;
+	else viewer->changes[viewer->nchanges++] = change;
+	wake_viewer(viewer);
+	pthread_mutex_unlock(&viewer->lock);
+	return;
+}
+
+
+
+// The label map (strides NULL if contiguous) or NULL to remove it, from any thread
+void set_viewer_labels(struct viewer *viewer, void *labels, int dtype, const ptrdiff_t strides[3])
+{
+	pthread_mutex_lock(&viewer->lock);
+	viewer->labels = labels;
+	viewer->label_dtype = dtype;
+	ptrdiff_t contiguous[4];
+	contiguous_strides(dtype, viewer->size, contiguous);
+	for (int i = 0; i < 3; i++) viewer->label_strides[i] = strides == NULL ? contiguous[i] : strides[i];
+	viewer->label_generation++;
+	viewer->nlabel_changes = 0;
+	viewer->all_labels_changed = false;
+	wake_viewer(viewer);
+	pthread_mutex_unlock(&viewer->lock);
+	return;
+}
+
+
+
+// Like report_change() for the label map
+void report_label_change(struct viewer *viewer, const int lower[3], const int upper[3])
+{
+	struct change change = { .frame = -1 };
+	if (!clip_change(viewer, &change, lower, upper)) return;
+
+	pthread_mutex_lock(&viewer->lock);
+	if (viewer->nlabel_changes == MAX_CHANGES) viewer->all_labels_changed = true;
+	else viewer->label_changes[viewer->nlabel_changes++] = change;
+	wake_viewer(viewer);
+	pthread_mutex_unlock(&viewer->lock);
+	return;
+}
+
+
+
+bool has_changes(struct viewer *viewer)
+{
+	pthread_mutex_lock(&viewer->lock);
+	bool changed = viewer->nchanges > 0 || viewer->all_changed;
+	pthread_mutex_unlock(&viewer->lock);
+	return changed;
+}
+
+
+
+// Copies and clears the queue, returns the number of changes or -1 if everything changed
+int take_changes(struct viewer *viewer, struct change changes[MAX_CHANGES])
+{
+	pthread_mutex_lock(&viewer->lock);
+	int n = viewer->all_changed ? -1 : viewer->nchanges;
+	if (n > 0) memcpy(changes, viewer->changes, sizeof(struct change) * n);
+	viewer->nchanges = 0;
+	viewer->all_changed = false;
+	pthread_mutex_unlock(&viewer->lock);
+	return n;
+}
+
+
+
+// Like take_changes() for the label map
+int take_label_changes(struct viewer *viewer, struct change changes[MAX_CHANGES])
+{
+	pthread_mutex_lock(&viewer->lock);
+	int n = viewer->all_labels_changed ? -1 : viewer->nlabel_changes;
+	if (n > 0) memcpy(changes, viewer->label_changes, sizeof(struct change) * n);
+	viewer->nlabel_changes = 0;
+	viewer->all_labels_changed = false;
+	pthread_mutex_unlock(&viewer->lock);
+	return n;
+}
+
+
+
+bool viewer_should_quit(struct viewer *viewer)
+{
+	pthread_mutex_lock(&viewer->lock);
+	bool quit = viewer->quit;
+	pthread_mutex_unlock(&viewer->lock);
+	return quit;
+}
+
+
+
+// Linked windows follow the cursor and zoom of the viewer's other windows and these follow them
+void add_windows(struct viewer *viewer, int n, bool linked)
+{
+	pthread_mutex_lock(&viewer->lock);
+	for (int i = 0; i < n; i++, viewer->new_windows++) {
+		if (linked && viewer->new_windows < 64) viewer->new_linked |= (uint64_t)1 << viewer->new_windows;
+	}
+	wake_viewer(viewer);
+	pthread_mutex_unlock(&viewer->lock);
+	return;
+}
+
+
+
+// Linked has bit i set if the i-th window is linked
+int take_new_windows(struct viewer *viewer, uint64_t *linked)
+{
+	pthread_mutex_lock(&viewer->lock);
+	int n = viewer->new_windows;
+	*linked = viewer->new_linked;
+	viewer->new_windows = 0;
+	viewer->new_linked = 0;
+	pthread_mutex_unlock(&viewer->lock);
+	return n;
+}
+
+
+
+// Whether its first window could be opened and set up, later windows don't change it
+void set_viewer_started(struct viewer *viewer, bool ok)
+{
+	pthread_mutex_lock(&viewer->lock);
+	if (viewer->started == 0) viewer->started = ok ? 1 : -1;
+	pthread_cond_broadcast(&viewer->cond);
+	pthread_mutex_unlock(&viewer->lock);
+	return;
+}
+
+
+
+// Waits until set_viewer_started(), returns whether its first window is open
+bool wait_viewer_started(struct viewer *viewer)
+{
+	pthread_mutex_lock(&viewer->lock);
+	while (viewer->started == 0) pthread_cond_wait(&viewer->cond, &viewer->lock);
+	bool ok = viewer->started == 1;
+	pthread_mutex_unlock(&viewer->lock);
+	return ok;
+}
+
+
+
+void set_viewer_open(struct viewer *viewer, bool open)
+{
+	pthread_mutex_lock(&viewer->lock);
+	viewer->open = open;
+	pthread_mutex_unlock(&viewer->lock);
+	return;
+}
+
+
+
+
+// Viewers served by one event loop (poirot()), which they can join and leave while it runs
+#ifndef MAX_VIEWERS
+	#define MAX_VIEWERS 16
+#endif
+
+struct viewer_list {
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // Signalled when a viewer leaves or the event loop stops
+	struct viewer *viewers[MAX_VIEWERS]; // NULL if free, a viewer keeps its slot (and the loop's volume of it) while listed
+	bool running; // The event loop runs or is about to
+};
+
+
+
+void setup_viewer_list(struct viewer_list *list)
+{
+	memset(list, 0, sizeof(struct viewer_list));
+	pthread_mutex_init(&list->lock, NULL);
+	pthread_cond_init(&list->cond, NULL);
+	return;
+}
+
+
+
+void delete_viewer_list(struct viewer_list *list)
+{
+	pthread_mutex_destroy(&list->lock);
+	pthread_cond_destroy(&list->cond);
+	return;
+}
+
+
+
+// Returns the slot or -1 if the list is full, a running event loop opens its windows. Needs the lock.
+int list_viewer(struct viewer_list *list, struct viewer *viewer)
+{
+	for (int v = 0; v < MAX_VIEWERS; v++) {
+		if (list->viewers[v] != NULL) continue;
+		list->viewers[v] = viewer;
+		pthread_mutex_lock(&viewer->lock);
+		viewer->open = list->running;
+		wake_viewer(viewer);
+		pthread_mutex_unlock(&viewer->lock);
+		return v;
+	}
+	return -1;
+}
+
+
+
+// Returns the slot or -1 if it isn't listed, needs the lock
+int viewer_slot(struct viewer_list *list, struct viewer *viewer)
+{
+	for (int v = 0; v < MAX_VIEWERS; v++) if (list->viewers[v] == viewer) return v;
+	return -1;
+}
+
+
+
+// When the event loop stops, viewers still waiting for their first window failed, needs the lock
+void stop_viewer_list(struct viewer_list *list)
+{
+	for (int v = 0; v < MAX_VIEWERS; v++) {
+		if (list->viewers[v] == NULL) continue;
+		set_viewer_open(list->viewers[v], false);
+		set_viewer_started(list->viewers[v], false);
+	}
+	list->running = false;
+	pthread_cond_broadcast(&list->cond);
+	return;
+}
@@ -0,0 +1,318 @@
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum volume_format { VOLUME_RAW, VOLUME_NPY, VOLUME_NIFTI, VOLUME_CHUNKED };
+#define CHUNKED_HEADER_SIZE 56
+
+// Complex values are pairs of floats, real part first
+enum dtype { DTYPE_UINT8, DTYPE_INT16, DTYPE_UINT16, DTYPE_FLOAT16, DTYPE_FLOAT32, DTYPE_COMPLEX64, NUM_DTYPES };
+const size_t dtype_size[NUM_DTYPES]     = {1,       2,       2,        2,         4,         8          };
+const int dtype_channels[NUM_DTYPES]    = {1,       1,       1,        1,         1,         2          };
+const char *dtype_names[NUM_DTYPES]     = {"uint8", "int16", "uint16", "float16", "float32", "complex64"};
+const char *npy_descrs[NUM_DTYPES]      = {"'|u1'", "'<i2'", "'<u2'",  "'<f2'",   "'<f4'",   "'<c8'"    };
+const short nifti_datatypes[NUM_DTYPES] = {2,       4,       512,      -1,        16,        32         };
+
+struct volume {
+	const char *path;
+	int fd;
+	char format;
+	size_t offset; // Of the first voxel in the file
+	size_t length; // Of the file
+	void *map;     // NULL until map_volume() is called
+	int dtype;
+	int size[3];
+	int nframes;
+	int chunk[3]; // Voxels per chunk of chunked volumes, whose offset is that of the chunk index
+};
+
+
+
+bool has_extension(const char *path, const char *extension)
+{
+	size_t n = strlen(path);
+	size_t m = strlen(extension);
+	return n >= m && strcmp(path + n - m, extension) == 0;
+}
+
+
+
+void read_header(struct volume *volume, void *header, size_t length, off_t offset)
+{
+	if (pread(volume->fd, header, length, offset) != (ssize_t)length) {
+		printf("Error: could not read header of %s\n", volume->path);
+		exit(1);
+	}
+	return;
+}
+
+
+
+// Only the header is parsed, see https://numpy.org/doc/stable/reference/generated/numpy.lib.format.html
+void parse_npy_header(struct volume *volume)
+{
+	unsigned char preamble[12];
+	read_header(volume, preamble, sizeof(preamble), 0);
+	if (memcmp(preamble, "\x93NUMPY", 6) != 0) {
+		printf("Error: %s is not a .npy file\n", volume->path);
+		exit(1);
+	}
+	size_t header_length, header_start;
+	if (preamble[6] == 1) {
+		header_length = preamble[8] | (preamble[9] << 8);
+		header_start = 10;
+	}
+	else {
+		header_length = preamble[8] | (preamble[9] << 8) | (preamble[10] << 16) | ((size_t)preamble[11] << 24);
+		header_start = 12;
+	}
+	char *header = malloc(header_length + 1);
+	read_header(volume, header, header_length, header_start);
+	header[header_length] = '\0';
+	volume->offset = header_start + header_length;
+
+	char *descr = strstr(header, "'descr'");
+	char *fortran_order = strstr(header, "'fortran_order'");
+	char *shape = strstr(header, "'shape'");
+	if (descr == NULL || fortran_order == NULL || shape == NULL) {
+		printf("Error: invalid .npy header in %s\n", volume->path);
+		exit(1);
+	}
+
+	descr = strchr(descr + 7, '\'');
+	volume->dtype = -1;
+	for (int i = 0; i < NUM_DTYPES && descr != NULL; i++) {
+		if (strncmp(descr, npy_descrs[i], 5) == 0) volume->dtype = i;
+	}
+	if (volume->dtype == -1) {
+		printf("Error: unsupported data type in %s, need little endian uint8, int16, uint16, float16, float32 or complex64\n", volume->path);
+		exit(1);
+	}
+
+	// Shape is stored with the slowest axis first unless in Fortran order
+	int shape_values[4];
+	int ndims = 0;
+	char *c = strchr(shape, '(');
+	while (c != NULL && *c != ')' && ndims < 4) {
+		c++;
+		while (*c == ' ') c++;
+		if (*c == ')') break;
+		shape_values[ndims++] = strtol(c, &c, 10);
+		while (*c == ' ') c++;
+		if (*c != ',' && *c != ')') c = NULL;
+	}
+	if (c == NULL || *c != ')' || ndims < 2) {
+		printf("Error: need an array with 2 to 4 dimensions in %s\n", volume->path);
+		exit(1);
+	}
+	bool is_fortran_order = strncmp(fortran_order + 15, ": True", 6) == 0;
+	int dims[4] = {1, 1, 1, 1};
+	for (int i = 0; i < ndims; i++) dims[i] = shape_values[is_fortran_order ? i : ndims - 1 - i];
+	for (int i = 0; i < 3; i++) volume->size[i] = dims[i];
+	volume->nframes = dims[3];
+
+	free(header);
+	return;
+}
+
+
+
+// NIfTI-1 single file (.nii), see https://nifti.nimh.nih.gov/nifti-1
+void parse_nifti_header(struct volume *volume)
+{
+	unsigned char header[348];
+	read_header(volume, header, sizeof(header), 0);
+
+	int sizeof_hdr;
+	short dim[8], datatype;
+	float vox_offset;
+	memcpy(&sizeof_hdr, header,       sizeof(int));
+	memcpy(dim,         header + 40,  sizeof(dim));
+	memcpy(&datatype,   header + 70,  sizeof(short));
+	memcpy(&vox_offset, header + 108, sizeof(float));
+	if (sizeof_hdr != 348 || memcmp(header + 344, "n+1", 4) != 0) {
+		printf("Error: %s is not a little endian NIfTI-1 file\n", volume->path);
+		exit(1);
+	}
+	volume->dtype = -1;
+	for (int i = 0; i < NUM_DTYPES; i++) {
+		if (datatype == nifti_datatypes[i]) volume->dtype = i;
+	}
+	if (volume->dtype == -1) {
+		printf("Error: unsupported data type in %s, need uint8, int16, uint16, float32 or complex64\n", volume->path);
+		exit(1);
+	}
+	if (dim[0] < 2 || dim[0] > 4) {
+		printf("Error: need an image with 2 to 4 dimensions in %s\n", volume->path);
+		exit(1);
+	}
+	int dims[4] = {1, 1, 1, 1};
+	for (int i = 0; i < dim[0]; i++) dims[i] = dim[i+1];
+	for (int i = 0; i < 3; i++) volume->size[i] = dims[i];
+	volume->nframes = dims[3];
+	volume->offset = (size_t)vox_offset;
+	return;
+}
+
+
+
+// Poirot's chunked volumes (.pcv), decoded by chunks.c, the header is little endian: "POIROTCV", uint32 version 1, dtype,
+// size x, y, z and frames, chunk size x, y, z, reserved and uint64 offset of the chunk index
+void parse_chunked_header(struct volume *volume)
+{
+	unsigned char header[CHUNKED_HEADER_SIZE];
+	read_header(volume, header, sizeof(header), 0);
+	uint32_t fields[10];
+	uint64_t index_offset;
+	memcpy(fields, header + 8, sizeof(fields));
+	memcpy(&index_offset, header + 48, sizeof(index_offset));
+	if (memcmp(header, "POIROTCV", 8) != 0 || fields[0] != 1) {
+		printf("Error: %s is not a chunked volume of version 1\n", volume->path);
+		exit(1);
+	}
+	if (fields[1] >= NUM_DTYPES) {
+		printf("Error: unsupported data type in %s\n", volume->path);
+		exit(1);
+	}
+	volume->dtype = fields[1];
+	for (int i = 0; i < 3; i++) {
+		volume->size[i] = fields[2+i];
+		volume->chunk[i] = fields[6+i];
+		if (volume->size[i] < 1 || volume->chunk[i] < 1) {
+			printf("Error: invalid size in %s\n", volume->path);
+			exit(1);
+		}
+	}
+	volume->nframes = fields[5];
+	volume->offset = index_offset;
+	return;
+}
+
+
+
+// Strides are in bytes between neighbours along x, y, z and frames, images from files are contiguous
+void contiguous_strides(int dtype, int size[3], ptrdiff_t strides[4])
+{
+	strides[0] = dtype_size[dtype];
+	for (int i = 1; i < 4; i++) strides[i] = strides[i-1] * size[i-1];
+	return;
+}
+
+
+
+// Rows are contiguous and one slice is a whole number of rows, so GL can unpack the image without a copy
+bool unpackable_strides(int dtype, const ptrdiff_t strides[3])
+{
+	ptrdiff_t bytes = dtype_size[dtype];
+	return (
+		strides[0] == bytes &&
+		strides[1] > 0 && strides[1] % bytes == 0 &&
+		strides[2] > 0 && strides[2] % strides[1] == 0
+	);
+}
+
+
+
+// Gathers a box of a strided image into contiguous memory
+void copy_box(int dtype, const char *source, const ptrdiff_t strides[3], const int extent[3], char *destination)
+{
+	size_t bytes = dtype_size[dtype];
+	size_t row = bytes * extent[0];
+	if (strides[0] == (ptrdiff_t)bytes && strides[1] == (ptrdiff_t)row && strides[2] == (ptrdiff_t)row * extent[1]) {
+		memcpy(destination, source, row * extent[1] * extent[2]);
+		return;
+	}
+	for (int z = 0; z < extent[2]; z++) {
+		for (int y = 0; y < extent[1]; y++) {
+			const char *in = source + y * strides[1] + z * strides[2];
+			if (strides[0] == (ptrdiff_t)bytes) memcpy(destination, in, row);
+			else for (int x = 0; x < extent[0]; x++) memcpy(destination + x * bytes, in + x * strides[0], bytes);
+			destination += row;
+		}
+	}
+	return;
+}
+
+
+
+// Only reads the header, voxels are accessed through map_volume().
+// For raw files, dtype, size and nframes must be set by the caller.
+void open_volume(const char *path, struct volume *volume)
+{
+	volume->path = path;
+	volume->map = NULL;
+	volume->fd = open(path, O_RDONLY);
+	if (volume->fd == -1) {
+		printf("Error: could not open %s\n", path);
+		exit(1);
+	}
+	struct stat st;
+	fstat(volume->fd, &st);
+	volume->length = st.st_size;
+
+	if (has_extension(path, ".npy")) {
+		volume->format = VOLUME_NPY;
+		parse_npy_header(volume);
+	}
+	else if (has_extension(path, ".nii")) {
+		volume->format = VOLUME_NIFTI;
+		parse_nifti_header(volume);
+	}
+	else if (has_extension(path, ".nii.gz")) {
+		printf("Error: compressed NIfTI files can't be mapped, decompress %s first\n", path);
+		exit(1);
+	}
+	else if (has_extension(path, ".pcv")) {
+		volume->format = VOLUME_CHUNKED;
+		parse_chunked_header(volume);
+	}
+	else {
+		volume->format = VOLUME_RAW;
+		volume->offset = 0;
+		if (volume->size[0] <= 0 || volume->size[1] <= 0 || volume->size[2] <= 0 || volume->nframes <= 0) {
+			printf("Error: raw file %s requires a size\n", path);
+			exit(1);
+		}
+	}
+
+	size_t voxels = (size_t)volume->size[0] * volume->size[1] * volume->size[2] * volume->nframes;
+	if (volume->format == VOLUME_CHUNKED) voxels = 0; // The index is checked by open_chunked_image()
+	if (volume->offset + voxels * dtype_size[volume->dtype] > volume->length) {
+		printf("Error: %s is too short for a volume of size %d x %d x %d x %d\n",
+			path, volume->size[0], volume->size[1], volume->size[2], volume->nframes
+		);
+		exit(1);
+	}
+	return;
+}
+
+
+
+// Pages are read by the kernel on first access, no copy is made
+void* map_volume(struct volume *volume)
+{
+	if (volume->map == NULL) {
+		volume->map = mmap(NULL, volume->length, PROT_READ, MAP_PRIVATE, volume->fd, 0);
+		if (volume->map == MAP_FAILED) {
+			printf("Error: could not map %s\n", volume->path);
+			exit(1);
+		}
+	}
+	return (char *)volume->map + volume->offset;
+}
+
+
+
+void close_volume(struct volume *volume)
+{
+	if (volume->map != NULL) munmap(volume->map, volume->length);
+	close(volume->fd);
+	volume->map = NULL;
+	volume->fd = -1;
+	return;
+}
+
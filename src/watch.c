@@ -0,0 +1,256 @@
+#include <stdint.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+// Live updates of an image which another process keeps writing, e.g. a raw file or a shared memory segment
+// in /dev/shm refined by an iterative reconstruction. Blocks of WATCH_BLOCK^3 voxels are hashed every
+// watch_interval seconds and when inotify reports a write to the file, changed blocks are reported to the
+// viewer as one box per run of consecutive layers of blocks in z with changes, so that only these are uploaded again
+// (shared_volume.c). Boxes are merged so that they don't fill the viewer's queue (MAX_CHANGES, viewer.c).
+// Writes through a mapping of the file don't raise inotify events, they are found by hashing.
+// The viewer's label map (labels.c) is watched the same way by a watch of its own.
+#ifndef WATCH_BLOCK
+	#define WATCH_BLOCK 32
+#endif
+#define WATCH_BOXES 4 // Per frame, more are merged into one
+
+struct watch {
+	struct viewer *viewer;
+	bool labels;     // Watches the label map instead of the image
+	int nframes;
+	double interval; // Seconds
+	int nblocks[3];
+	uint64_t *hashes; // Per block of every frame
+	bool *changed;    // Per block of a frame
+	int inotify;      // -1 if only hashed periodically
+	int quit_pipe[2];
+	pthread_t thread;
+};
+
+struct watch_layers {
+	struct watch *watch;
+	const char *frame;
+	uint64_t *hashes; // Of the frame
+	int z_begin, z_end; // Layers of blocks
+};
+
+
+
+// FNV-1a over 64-bit words, the tail of a row is padded with zeros
+uint64_t hash_bytes(uint64_t h, const char *bytes, size_t n)
+{
+	size_t words = n / 8;
+	for (size_t i = 0; i < words; i++) {
+		uint64_t w;
+		memcpy(&w, bytes + 8 * i, 8);
+		h = (h ^ w) * 1099511628211u;
+	}
+	if (n % 8 != 0) {
+		uint64_t w = 0;
+		memcpy(&w, bytes + 8 * words, n % 8);
+		h = (h ^ w) * 1099511628211u;
+	}
+	return h;
+}
+
+
+
+void* hash_layers(void *arg)
+{
+	struct watch_layers *layers = arg;
+	struct viewer *viewer = layers->watch->viewer;
+	int *nb = layers->watch->nblocks;
+	bool labels = layers->watch->labels;
+	size_t bytes = dtype_size[labels ? viewer->label_dtype : viewer->dtype];
+	ptrdiff_t *strides = labels ? viewer->label_strides : viewer->strides;
+	for (int bz = layers->z_begin; bz < layers->z_end; bz++) {
+		for (int by = 0; by < nb[1]; by++) {
+			for (int bx = 0; bx < nb[0]; bx++) {
+				int lower[3] = {bx * WATCH_BLOCK, by * WATCH_BLOCK, bz * WATCH_BLOCK};
+				int upper[3];
+				for (int i = 0; i < 3; i++) upper[i] = fmin(viewer->size[i], lower[i] + WATCH_BLOCK);
+				uint64_t h = 14695981039346656037u;
+				for (int z = lower[2]; z < upper[2]; z++) {
+					for (int y = lower[1]; y < upper[1]; y++) {
+						const char *row = layers->frame + lower[0] * strides[0] + y * strides[1] + z * strides[2];
+						if (strides[0] == (ptrdiff_t)bytes) h = hash_bytes(h, row, bytes * (upper[0] - lower[0]));
+						else for (int x = 0; x < upper[0] - lower[0]; x++) h = hash_bytes(h, row + x * strides[0], bytes);
+					}
+				}
+				layers->hashes[bx + nb[0] * (by + nb[1] * bz)] = h;
+			}
+		}
+	}
+	return NULL;
+}
+
+
+
+// In parallel over layers of blocks, split into tasks on the shared workers (workers.c)
+void hash_frame(struct watch *watch, int frame, uint64_t *hashes)
+{
+	int n = watch->nblocks[2];
+	struct worker_pool *workers = shared_workers();
+	int ntasks = fmax(1, fmin(workers->nthreads + 1, n));
+	struct watch_layers layers[ntasks];
+	const char *image = watch->labels ? watch->viewer->labels : watch->viewer->image + frame * watch->viewer->strides[3];
+	for (int t = 0; t < ntasks; t++) layers[t] = (struct watch_layers) { watch, image, hashes, t * n / ntasks, (t + 1) * n / ntasks };
+	run_tasks(workers, hash_layers, layers, sizeof(struct watch_layers), ntasks);
+	return;
+}
+
+
+
+// Boxes (in blocks, upper inclusive) of the runs of layers with changed blocks, at most WATCH_BOXES
+int changed_boxes(struct watch *watch, struct change boxes[WATCH_BOXES])
+{
+	int *nb = watch->nblocks;
+	int n = 0;
+	bool open = false;
+	for (int bz = 0; bz < nb[2]; bz++) {
+		int lower[3] = {nb[0], nb[1], bz};
+		int upper[3] = {-1, -1, bz};
+		for (int by = 0; by < nb[1]; by++) {
+			for (int bx = 0; bx < nb[0]; bx++) {
+				if (!watch->changed[bx + nb[0] * (by + nb[1] * bz)]) continue;
+				lower[0] = fmin(lower[0], bx);
+				lower[1] = fmin(lower[1], by);
+				upper[0] = fmax(upper[0], bx);
+				upper[1] = fmax(upper[1], by);
+			}
+		}
+		if (upper[0] == -1) {
+			open = false;
+			continue;
+		}
+		if (!open && n < WATCH_BOXES) boxes[n++] = (struct change) { 0, {lower[0], lower[1], lower[2]}, {upper[0], upper[1], upper[2]} };
+		else {
+			// Continues the run of the last box, or is merged into it if there are as many boxes as allowed
+			struct change *box = &boxes[n - 1];
+			for (int i = 0; i < 3; i++) {
+				box->lower[i] = fmin(box->lower[i], lower[i]);
+				box->upper[i] = fmax(box->upper[i], upper[i]);
+			}
+		}
+		open = true;
+	}
+	return n;
+}
+
+
+
+// Hashes all frames again and reports the boxes of changed blocks. If they would take more than half of the viewer's
+// queue, e.g. because every frame changed, one box around all is reported for all frames.
+void check_watched(struct watch *watch)
+{
+	struct viewer *viewer = watch->viewer;
+	int *nb = watch->nblocks;
+	size_t blocks = (size_t)nb[0] * nb[1] * nb[2];
+	uint64_t *hashes = malloc(sizeof(uint64_t) * blocks);
+	struct change *boxes = malloc(sizeof(struct change) * WATCH_BOXES * watch->nframes);
+	int nboxes = 0;
+	for (int f = 0; f < watch->nframes; f++) {
+		uint64_t *old = watch->hashes + f * blocks;
+		hash_frame(watch, f, hashes);
+		for (size_t b = 0; b < blocks; b++) watch->changed[b] = hashes[b] != old[b];
+		memcpy(old, hashes, sizeof(uint64_t) * blocks);
+		int n = changed_boxes(watch, boxes + nboxes);
+		for (int i = 0; i < n; i++) boxes[nboxes + i].frame = f;
+		nboxes += n;
+	}
+
+	if (nboxes > MAX_CHANGES / 2) {
+		struct change *merged = &boxes[0];
+		for (int c = 1; c < nboxes; c++) {
+			if (boxes[c].frame != merged->frame) merged->frame = -1;
+			for (int i = 0; i < 3; i++) {
+				merged->lower[i] = fmin(merged->lower[i], boxes[c].lower[i]);
+				merged->upper[i] = fmax(merged->upper[i], boxes[c].upper[i]);
+			}
+		}
+		nboxes = 1;
+	}
+	for (int c = 0; c < nboxes; c++) {
+		for (int i = 0; i < 3; i++) {
+			boxes[c].lower[i] *= WATCH_BLOCK;
+			boxes[c].upper[i] = (boxes[c].upper[i] + 1) * WATCH_BLOCK;
+		}
+		if (watch->labels) report_label_change(viewer, boxes[c].lower, boxes[c].upper);
+		else report_change(viewer, boxes[c].frame, boxes[c].lower, boxes[c].upper);
+	}
+	free(hashes);
+	free(boxes);
+	return;
+}
+
+
+
+void* watch_loop(void *arg)
+{
+	struct watch *watch = arg;
+	struct pollfd fds[2] = {{watch->quit_pipe[0], POLLIN, 0}, {watch->inotify, POLLIN, 0}};
+	int nfds = watch->inotify == -1 ? 1 : 2;
+	while (true) {
+		int ready = poll(fds, nfds, 1000 * watch->interval);
+		if (ready > 0 && (fds[0].revents & POLLIN)) break;
+		if (ready > 0 && nfds == 2 && (fds[1].revents & POLLIN)) {
+			// Events only wake the loop, what changed is found by hashing
+			char events[4096];
+			while (read(watch->inotify, events, sizeof(events)) > 0);
+		}
+		check_watched(watch);
+	}
+	return NULL;
+}
+
+
+
+// Path can be NULL if there is no file to be notified about, e.g. memory of the host process (libpoirot.c).
+// With labels, the viewer's label map is watched, which must be set before and not replaced while watched.
+// Returns false if the watch can't be started, nothing is left to stop then.
+bool start_watch(struct watch *watch, struct viewer *viewer, const char *path, double interval, bool labels)
+{
+	watch->viewer = viewer;
+	watch->labels = labels;
+	watch->nframes = labels ? 1 : viewer->nframes;
+	watch->interval = interval;
+	for (int i = 0; i < 3; i++) watch->nblocks[i] = (viewer->size[i] + WATCH_BLOCK - 1) / WATCH_BLOCK;
+	size_t blocks = (size_t)watch->nblocks[0] * watch->nblocks[1] * watch->nblocks[2];
+	watch->hashes = malloc(sizeof(uint64_t) * blocks * watch->nframes);
+	watch->changed = malloc(sizeof(bool) * blocks);
+	for (int f = 0; f < watch->nframes; f++) hash_frame(watch, f, watch->hashes + f * blocks);
+
+	watch->inotify = -1;
+	if (path != NULL) {
+		watch->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (watch->inotify != -1 && inotify_add_watch(watch->inotify, path, IN_MODIFY | IN_CLOSE_WRITE) == -1) {
+			printf("Could not watch %s for writes, it is checked every %.1f s\n", path, interval);
+			close(watch->inotify);
+			watch->inotify = -1;
+		}
+	}
+	if (pipe(watch->quit_pipe) != 0) {
+		printf("Error: could not create a pipe for watching\n");
+		if (watch->inotify != -1) close(watch->inotify);
+		free(watch->hashes);
+		free(watch->changed);
+		return false;
+	}
+	pthread_create(&watch->thread, NULL, watch_loop, watch);
+	return true;
+}
+
+
+
+void stop_watch(struct watch *watch)
+{
+	char quit = 1;
+	if (write(watch->quit_pipe[1], &quit, 1) != 1) printf("Error: could not stop watching\n");
+	pthread_join(watch->thread, NULL);
+	close(watch->quit_pipe[0]);
+	close(watch->quit_pipe[1]);
+	if (watch->inotify != -1) close(watch->inotify);
+	free(watch->hashes);
+	free(watch->changed);
+	return;
+}
@@ -1,20 +1,101 @@
 
+// Doesn't exit, failures are returned, e.g. by open_window(), so that a host process of the library survives them
 void error_callback(int error, const char* description)
 {
 	fprintf(stderr, "GLFW Error: %s\n", description);
-	exit(EXIT_FAILURE);
 	return;
 }
 
 
 
-GLFWwindow* open_window(int width, int height)
+// Input of a window, recorded by GLFW's callbacks while the input thread waits for events and coalesced per poll:
+// a key or button is down for a poll if it was down at any time since the previous one, so that taps between
+// polls aren't lost, and scrolling adds up. The handlers read it instead of glfwGetKey().
+struct window_events {
+	bool held[GLFW_KEY_LAST + 1], down[GLFW_KEY_LAST + 1];
+	bool held_buttons[GLFW_MOUSE_BUTTON_LAST + 1], down_buttons[GLFW_MOUSE_BUTTON_LAST + 1];
+	double scroll; // Steps of the wheel, positive away from the user
+};
+
+
+
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+	struct window_events *events = glfwGetWindowUserPointer(window);
+	if (key < 0 || key > GLFW_KEY_LAST || action == GLFW_REPEAT) return;
+	events->held[key] = action == GLFW_PRESS;
+	events->down[key] |= events->held[key];
+	return;
+}
+
+
+
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
+{
+	struct window_events *events = glfwGetWindowUserPointer(window);
+	if (button < 0 || button > GLFW_MOUSE_BUTTON_LAST) return;
+	events->held_buttons[button] = action == GLFW_PRESS;
+	events->down_buttons[button] |= events->held_buttons[button];
+	return;
+}
+
+
+
+void scroll_callback(GLFWwindow *window, double x, double y)
+{
+	struct window_events *events = glfwGetWindowUserPointer(window);
+	events->scroll += y;
+	return;
+}
+
+
+
+void setup_window_events(GLFWwindow *window, struct window_events *events)
+{
+	memset(events, 0, sizeof(struct window_events));
+	glfwSetWindowUserPointer(window, events);
+	glfwSetKeyCallback(window, key_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
+	glfwSetScrollCallback(window, scroll_callback);
+	return;
+}
+
+
+
+bool key_down(GLFWwindow *window, int key)
+{
+	const struct window_events *events = glfwGetWindowUserPointer(window);
+	return events->down[key];
+}
+
+
+
+bool button_down(GLFWwindow *window, int button)
+{
+	const struct window_events *events = glfwGetWindowUserPointer(window);
+	return events->down_buttons[button];
+}
+
+
+
+// After polling, what was released since is up again
+void end_window_events(struct window_events *events)
 {
-	GLFWwindow* window = glfwCreateWindow(width, height, "", NULL, NULL); //glfwGetPrimaryMonitor()
+	memcpy(events->down, events->held, sizeof(events->down));
+	memcpy(events->down_buttons, events->held_buttons, sizeof(events->down_buttons));
+	events->scroll = 0;
+	return;
+}
+
+
+
+// Objects are shared with the context of share, which can be NULL. Returns NULL if the window can't be opened.
+GLFWwindow* open_window(int width, int height, GLFWwindow *share)
+{
+	GLFWwindow* window = glfwCreateWindow(width, height, "", NULL, share); //glfwGetPrimaryMonitor()
 	if (!window) {
-		printf("Error: could not open window");
-		glfwTerminate();
-		exit(EXIT_FAILURE);
+		printf("Error: could not open window\n");
+		return NULL;
 	}
 	glfwMakeContextCurrent(window);
 	glfwSwapInterval(0); // TODO: turn on?
@@ -43,3 +124,62 @@ void update_mouse_position(GLFWwindow *window, int width, int height, float mous
 	return;
 }
 
+
+
+// Planes are drawn into an offscreen framebuffer which keeps its content between frames,
+// so that only changed planes are redrawn, it is copied to the window before swapping.
+struct framebuffer {
+	GLuint id, colour;
+	int width, height;
+};
+
+
+
+void setup_framebuffer(struct framebuffer *framebuffer, int width, int height)
+{
+	framebuffer->width = width;
+	framebuffer->height = height;
+	glGenTextures(1, &framebuffer->colour);
+	glBindTexture(GL_TEXTURE_2D, framebuffer->colour);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+	glGenFramebuffers(1, &framebuffer->id);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer->id);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, framebuffer->colour, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return;
+}
+
+
+
+void delete_framebuffer(struct framebuffer *framebuffer)
+{
+	glDeleteFramebuffers(1, &framebuffer->id);
+	glDeleteTextures(1, &framebuffer->colour);
+	return;
+}
+
+
+
+void resize_framebuffer(struct framebuffer *framebuffer, int width, int height)
+{
+	delete_framebuffer(framebuffer);
+	setup_framebuffer(framebuffer, width, height);
+	return;
+}
+
+
+
+// Into the window's framebuffer, which is left bound
+void copy_framebuffer(struct framebuffer *framebuffer)
+{
+	glBlitNamedFramebuffer(
+		framebuffer->id, 0,
+		0, 0, framebuffer->width, framebuffer->height,
+		0, 0, framebuffer->width, framebuffer->height,
+		GL_COLOR_BUFFER_BIT, GL_NEAREST
+	);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return;
+}
+
@@ -0,0 +1,152 @@
+#include <pthread.h>
+#include <unistd.h>
+
+// Threads kept for the parallel loops of the CPU work, e.g. mip levels or decoding chunks, which run on every frame
+// with changes, so that they don't create and join threads each time. Calls of run_tasks() from any thread are queued,
+// their tasks are taken by the workers and by the calling thread, which returns when its own tasks are done.
+struct worker_job {
+	void* (*function)(void *);
+	char *args;
+	size_t arg_size; // 0 if all tasks take the same argument
+	int n;
+	int next;        // Task to be taken
+	int running;     // Taken and not finished
+	struct worker_job *following;
+};
+
+struct worker_pool {
+	int nthreads; // Workers, the caller is another
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t work; // A job was queued or the workers quit
+	pthread_cond_t done; // A task finished
+	struct worker_job *first, *last; // Jobs with tasks to be taken
+	bool quit;
+};
+
+
+
+// On the lock, the job of the task leaves the queue with its last task
+void* take_task(struct worker_pool *pool, struct worker_job *job)
+{
+	void *arg = job->args + job->arg_size * job->next;
+	job->next++;
+	job->running++;
+	if (job->next == job->n) {
+		struct worker_job **previous = &pool->first;
+		while (*previous != job) previous = &(*previous)->following;
+		*previous = job->following;
+		if (pool->last == job) pool->last = NULL;
+		for (struct worker_job *j = pool->first; j != NULL; j = j->following) pool->last = j;
+	}
+	return arg;
+}
+
+
+
+void finish_task(struct worker_pool *pool, struct worker_job *job)
+{
+	pthread_mutex_lock(&pool->lock);
+	job->running--;
+	if (job->running == 0 && job->next == job->n) pthread_cond_broadcast(&pool->done);
+	pthread_mutex_unlock(&pool->lock);
+	return;
+}
+
+
+
+void* worker_thread(void *arg)
+{
+	struct worker_pool *pool = arg;
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (pool->first == NULL && !pool->quit) pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->quit) break;
+		struct worker_job *job = pool->first;
+		void *task = take_task(pool, job);
+		pthread_mutex_unlock(&pool->lock);
+		job->function(task);
+		finish_task(pool, job);
+		pthread_mutex_lock(&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+
+
+// One worker less than cores, the caller of run_tasks() works too
+void setup_worker_pool(struct worker_pool *pool)
+{
+	memset(pool, 0, sizeof(struct worker_pool));
+	long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+	pool->nthreads = fmax(0, ncores - 1);
+	pool->threads = malloc(sizeof(pthread_t) * (pool->nthreads + 1));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for (int t = 0; t < pool->nthreads; t++) pthread_create(&pool->threads[t], NULL, worker_thread, pool);
+	return;
+}
+
+
+
+void delete_worker_pool(struct worker_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (int t = 0; t < pool->nthreads; t++) pthread_join(pool->threads[t], NULL);
+	free(pool->threads);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	return;
+}
+
+
+
+// Calls function for n tasks, args is an array of n arguments of arg_size bytes, or one argument for all if arg_size is 0
+void run_tasks(struct worker_pool *pool, void* (*function)(void *), void *args, size_t arg_size, int n)
+{
+	if (n < 1) return;
+	struct worker_job job = { function, args, arg_size, n, 0, 0, NULL };
+	pthread_mutex_lock(&pool->lock);
+	if (pool->last == NULL) pool->first = &job;
+	else pool->last->following = &job;
+	pool->last = &job;
+	pthread_cond_broadcast(&pool->work);
+	while (job.next < job.n) {
+		void *task = take_task(pool, &job);
+		pthread_mutex_unlock(&pool->lock);
+		function(task);
+		finish_task(pool, &job);
+		pthread_mutex_lock(&pool->lock);
+	}
+	while (job.running > 0) pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+	return;
+}
+
+
+
+struct worker_pool cpu_workers;
+pthread_once_t cpu_workers_once = PTHREAD_ONCE_INIT;
+
+
+
+void setup_cpu_workers()
+{
+	setup_worker_pool(&cpu_workers);
+	return;
+}
+
+
+
+// Shared by the parallel loops which don't keep a pool of their own, started on first use and kept until the process ends
+struct worker_pool* shared_workers()
+{
+	pthread_once(&cpu_workers_once, setup_cpu_workers);
+	return &cpu_workers;
+}